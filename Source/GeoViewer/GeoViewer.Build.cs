@@ -47,6 +47,7 @@ public class GeoViewer : ModuleRules
 				"EditorStyle",
 				"LevelEditor",
 				"HTTP",
+				"HTTPServer",
 				"DesktopPlatform",
 				"LandscapeEditor",
 				"Landscape"
@@ -0,0 +1,309 @@
+﻿#include "Commandlets/GeoViewerBenchmarkCommandlet.h"
+
+#include "GeoViewer.h"
+#include "GeoViewerEdModeConfig.h"
+#include "HttpManager.h"
+#include "HttpModule.h"
+#include "TileCache.h"
+#include "TileDownloader.h"
+#include "TileStandInServer.h"
+#include "ReferenceSystems/WorldReferenceSystem.h"
+#include "TileAPIs/XYZTileAPI.h"
+
+/** Zoom level of the benchmark segments, around the level used by the overlay */
+static constexpr int BenchmarkZoomLevel = 17;
+
+/** Stop waiting for downloads after this many seconds */
+static constexpr double BenchmarkTimeout = 300.0;
+
+UGeoViewerBenchmarkCommandlet::UGeoViewerBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UGeoViewerBenchmarkCommandlet::Main(const FString& Params)
+{
+	int32 NumSegments = 500;
+	int32 NumTiles = 16;
+	FParse::Value(*Params, TEXT("segments="), NumSegments);
+	FParse::Value(*Params, TEXT("tiles="), NumTiles);
+
+	// Latency, jitter and bandwidth are given in milliseconds and MB/s
+	FTileStandInSettings Settings;
+	double LatencyMs = Settings.Latency * 1000;
+	double JitterMs = Settings.Jitter * 1000;
+	double BandwidthMB = 0;
+	FParse::Value(*Params, TEXT("port="), Settings.Port);
+	FParse::Value(*Params, TEXT("latency="), LatencyMs);
+	FParse::Value(*Params, TEXT("jitter="), JitterMs);
+	FParse::Value(*Params, TEXT("errorrate="), Settings.ErrorRate);
+	FParse::Value(*Params, TEXT("bandwidth="), BandwidthMB);
+	Settings.Latency = LatencyMs / 1000;
+	Settings.Jitter = JitterMs / 1000;
+	Settings.Bandwidth = BandwidthMB * 1024 * 1024;
+
+	FString FormatString = TEXT("png");
+	FParse::Value(*Params, TEXT("format="), FormatString);
+	const ETileStandInFormat Format = FormatString == TEXT("jpg") ? ETileStandInFormat::JPEG
+		: FormatString == TEXT("terrain") ? ETileStandInFormat::TerrainRGB : ETileStandInFormat::PNG;
+
+	FTileStandInServer Server;
+	if (!Server.Start(Settings))
+	{
+		return 1;
+	}
+
+	// Every run uses new cache keys so nothing is loaded from an earlier run
+	const FString URLTemplate = Server.GetURLTemplate(Format) + TEXT("?run=") + FGuid::NewGuid().ToString();
+
+	UGeoViewerEdModeConfig* Config = NewObject<UGeoViewerEdModeConfig>(GetTransientPackage());
+	Config->Load();
+	Config->OverlaySystem = EOverlayMapSystem::XYZ;
+	Config->XYZ.URLTemplate = URLTemplate;
+	Config->XYZ.ZoomLevel = BenchmarkZoomLevel;
+
+	FBenchmarkResult DownloaderResult = RunDownloaderBenchmark(URLTemplate, NumSegments);
+	FBenchmarkResult LoadTileResult = RunLoadTileBenchmark(Config, NumTiles);
+	Server.Stop();
+
+	// The stand-in tiles are only useful to this run so they don't take space from real tiles,
+	// the keys are the ones given by RunDownloaderBenchmark and FXYZTileAPI
+	const uint32 URLHash = FCrc::StrCrc32(*URLTemplate);
+	FTileCache::Get().RemoveTiles(FString::Printf(TEXT("Benchmark,%08x"), URLHash));
+	FTileCache::Get().RemoveTiles(FString::Printf(TEXT("XYZ,%08x"), URLHash));
+
+	const double DownloaderP95 = DownloaderResult.Report(TEXT("FTileDownloader"));
+	const double LoadTileP95 = LoadTileResult.Report(TEXT("LoadTile"));
+
+	// Limits for catching regressions
+	int32 ExitCode = 0;
+	double MaxP95Ms = 0;
+	double MinTilesPerSecond = 0;
+	double MaxTileP95Ms = 0;
+	if (FParse::Value(*Params, TEXT("maxp95="), MaxP95Ms) && DownloaderP95 * 1000 > MaxP95Ms)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("p95 segment latency %.1fms is over the limit of %.1fms"), DownloaderP95 * 1000, MaxP95Ms);
+		ExitCode = 1;
+	}
+	if (FParse::Value(*Params, TEXT("maxtilep95="), MaxTileP95Ms) && LoadTileP95 * 1000 > MaxTileP95Ms)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("p95 tile latency %.1fms is over the limit of %.1fms"), LoadTileP95 * 1000, MaxTileP95Ms);
+		ExitCode = 1;
+	}
+
+	// Without injected errors every tile should load
+	if (Settings.ErrorRate <= 0 && LoadTileResult.Failures > 0)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("%d of %d tiles failed to load"), LoadTileResult.Failures, NumTiles);
+		ExitCode = 1;
+	}
+
+	const double TilesPerSecond = DownloaderResult.Latencies.Num() / FMath::Max(DownloaderResult.Duration, UE_SMALL_NUMBER);
+	if (FParse::Value(*Params, TEXT("mintilespersecond="), MinTilesPerSecond) && TilesPerSecond < MinTilesPerSecond)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("%.1f segments/s is under the limit of %.1f"), TilesPerSecond, MinTilesPerSecond);
+		ExitCode = 1;
+	}
+
+	return ExitCode;
+}
+
+UGeoViewerBenchmarkCommandlet::FBenchmarkResult UGeoViewerBenchmarkCommandlet::RunDownloaderBenchmark(
+	const FString& URLTemplate, const int32 NumSegments) const
+{
+	FBenchmarkResult Result;
+	const FString KeyPrefix = FString::Printf(TEXT("Benchmark,%08x"), FCrc::StrCrc32(*URLTemplate));
+	const int Columns = FMath::Max(FMath::CeilToInt(FMath::Sqrt(static_cast<float>(NumSegments))), 1);
+
+	TArray<TSharedRef<FTileDownloader>> Downloaders;
+	const FTileCancellationTokenRef CancellationToken = MakeShared<FTileCancellationToken, ESPMode::ThreadSafe>();
+	TSharedRef<int32> NumFinished = MakeShared<int32>(0);
+	const double StartTime = FPlatformTime::Seconds();
+	double LastTickTime = StartTime;
+
+	// Everything is queued at once so the scheduler decides how many requests are in flight
+	for (int i = 0; i < NumSegments; i++)
+	{
+		const FIntPoint Coordinates(i % Columns, i / Columns);
+		const FString URL = URLTemplate
+			.Replace(TEXT("{z}"), *FString::FromInt(BenchmarkZoomLevel))
+			.Replace(TEXT("{x}"), *FString::FromInt(Coordinates.X))
+			.Replace(TEXT("{y}"), *FString::FromInt(Coordinates.Y));
+
+		TSharedRef<FTileDownloader> Downloader = MakeShared<FTileDownloader>();
+		Downloader->SetExtentMetaData(FVector(Coordinates.X * 300.0, -Coordinates.Y * 300.0, 0), FVector2D(300, 300), 3857);
+		Downloader->SetSchedulingInfo(TEXT("StandIn"), FGeographicCoordinates(0, 0, 0));
+
+		// Latency starts once the scheduler sends the request, otherwise it mostly measures the queue
+		const double QueueTime = FPlatformTime::Seconds();
+		Downloader->OnDownloaded.AddLambda([&Result, NumFinished, QueueTime](const FTileDownloader* Segment)
+		{
+			(*NumFinished)++;
+			if (Segment->DecodedTile.IsValid())
+			{
+				const double SendTime = Segment->GetRequestStartTime() > 0 ? Segment->GetRequestStartTime() : QueueTime;
+				Result.Latencies.Add(FPlatformTime::Seconds() - SendTime);
+				Result.QueueWaits.Add(SendTime - QueueTime);
+			}
+			else
+			{
+				Result.Failures++;
+			}
+		});
+
+		Downloader->AddCancellationToken(CancellationToken);
+		Downloader->BeginDownload(URL, FString::Printf(TEXT("%s,%d,%d,%d"), *KeyPrefix, BenchmarkZoomLevel, Coordinates.X, Coordinates.Y));
+		Downloaders.Add(Downloader);
+	}
+	Result.GameThreadTime += FPlatformTime::Seconds() - StartTime;
+
+	while (*NumFinished < NumSegments && FPlatformTime::Seconds() - StartTime < BenchmarkTimeout)
+	{
+		Result.GameThreadTime += PumpGameThread(LastTickTime);
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	Result.Duration = FPlatformTime::Seconds() - StartTime;
+	Result.Failures += NumSegments - *NumFinished;
+
+	// Downloads still running after a timeout mustn't report to the result once it's returned
+	CancellationToken->Cancel();
+	for (const TSharedRef<FTileDownloader>& Downloader : Downloaders)
+	{
+		Downloader->OnDownloaded.Clear();
+		Downloader->OnTileCancelled();
+	}
+
+	return Result;
+}
+
+UGeoViewerBenchmarkCommandlet::FBenchmarkResult UGeoViewerBenchmarkCommandlet::RunLoadTileBenchmark(
+	UGeoViewerEdModeConfig* Config, const int32 NumTiles) const
+{
+	FBenchmarkResult Result;
+
+	// Tiles need a reference system to convert their bounds, which needs a world to live in
+	UWorld* World = UWorld::CreateWorld(EWorldType::Editor, false);
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Editor);
+	WorldContext.SetCurrentWorld(World);
+	AWorldReferenceSystem* ReferenceSystem = AWorldReferenceSystem::GetWorldReferenceSystem(World);
+
+	const int Columns = FMath::Max(FMath::CeilToInt(FMath::Sqrt(static_cast<float>(NumTiles))), 1);
+	const int TileSize = Config->TileSize;
+
+	TArray<TSharedRef<FGeoTileAPI>> TileAPIs;
+	TSharedRef<int32> NumFinished = MakeShared<int32>(0);
+	const double StartTime = FPlatformTime::Seconds();
+	double LastTickTime = StartTime;
+
+	for (int i = 0; i < NumTiles; i++)
+	{
+		const FVector Corner1(i % Columns * TileSize, i / Columns * TileSize, 0);
+		const FVector Corner2 = Corner1 + FVector(TileSize, TileSize, 0);
+
+		FProjectedBounds TileBounds;
+		ReferenceSystem->EngineToProjected(Corner1, TileBounds.TopLeft);
+		ReferenceSystem->EngineToProjected(Corner2, TileBounds.BottomRight);
+
+		TSharedRef<FGeoTileAPI> TileAPI = MakeShared<FXYZTileAPI>(Config, ReferenceSystem);
+
+		// Each tile is only counted once even if it reports again
+		const double RequestTime = FPlatformTime::Seconds();
+		TSharedRef<bool> bFinished = MakeShared<bool>(false);
+		TileAPI->OnComplete.BindLambda([&Result, NumFinished, RequestTime, bFinished](GDALDataset* Dataset)
+		{
+			if (*bFinished)
+			{
+				if (Dataset)
+				{
+					GDALClose(Dataset);
+				}
+				return;
+			}
+
+			*bFinished = true;
+			(*NumFinished)++;
+			if (Dataset)
+			{
+				Result.Latencies.Add(FPlatformTime::Seconds() - RequestTime);
+				GDALClose(Dataset);
+			}
+			else
+			{
+				Result.Failures++;
+			}
+		});
+
+		TileAPI->LoadTile(TileBounds);
+		TileAPIs.Add(TileAPI);
+	}
+	Result.GameThreadTime += FPlatformTime::Seconds() - StartTime;
+
+	while (*NumFinished < NumTiles && FPlatformTime::Seconds() - StartTime < BenchmarkTimeout)
+	{
+		Result.GameThreadTime += PumpGameThread(LastTickTime);
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	Result.Duration = FPlatformTime::Seconds() - StartTime;
+	Result.Failures += NumTiles - *NumFinished;
+
+	// Tiles still loading after a timeout mustn't report to the result once it's returned
+	for (const TSharedRef<FGeoTileAPI>& TileAPI : TileAPIs)
+	{
+		TileAPI->Cancel();
+	}
+	TileAPIs.Empty();
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+
+	return Result;
+}
+
+double UGeoViewerBenchmarkCommandlet::PumpGameThread(double& LastTickTime)
+{
+	const double CurrentTime = FPlatformTime::Seconds();
+	const float DeltaTime = CurrentTime - LastTickTime;
+	LastTickTime = CurrentTime;
+
+	FTSTicker::GetCoreTicker().Tick(DeltaTime);
+	FHttpModule::Get().GetHttpManager().Tick(DeltaTime);
+	FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+
+	return FPlatformTime::Seconds() - CurrentTime;
+}
+
+double UGeoViewerBenchmarkCommandlet::FBenchmarkResult::Report(const TCHAR* Name)
+{
+	Latencies.Sort();
+	QueueWaits.Sort();
+
+	auto Percentile = [](const TArray<double>& Values, const double Fraction)
+	{
+		if (Values.Num() == 0)
+		{
+			return 0.0;
+		}
+		const int Index = FMath::Clamp(FMath::CeilToInt(Fraction * Values.Num()) - 1, 0, Values.Num() - 1);
+		return Values[Index];
+	};
+
+	const int32 Completed = Latencies.Num();
+	UE_LOG(LogGeoViewer, Display,
+		TEXT("%s: %d tiles (%d failed) in %.2fs, %.1f tiles/s, latency p50 %.1fms p95 %.1fms p99 %.1fms, game thread %.3fms per tile"),
+		Name, Completed, Failures, Duration,
+		Completed / FMath::Max(Duration, UE_SMALL_NUMBER),
+		Percentile(Latencies, 0.5) * 1000, Percentile(Latencies, 0.95) * 1000, Percentile(Latencies, 0.99) * 1000,
+		Completed > 0 ? GameThreadTime * 1000 / Completed : 0.0);
+
+	if (QueueWaits.Num() > 0)
+	{
+		UE_LOG(LogGeoViewer, Display, TEXT("%s: queue wait p50 %.1fms p95 %.1fms p99 %.1fms"),
+			Name, Percentile(QueueWaits, 0.5) * 1000, Percentile(QueueWaits, 0.95) * 1000, Percentile(QueueWaits, 0.99) * 1000);
+	}
+
+	return Percentile(Latencies, 0.95);
+}
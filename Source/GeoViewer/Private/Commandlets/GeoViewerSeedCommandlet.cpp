@@ -0,0 +1,210 @@
+﻿#include "Commandlets/GeoViewerSeedCommandlet.h"
+
+#include "GeoViewer.h"
+#include "GeoViewerEdModeConfig.h"
+#include "HttpManager.h"
+#include "HttpModule.h"
+#include "TileCache.h"
+#include "TileDownloader.h"
+#include "TileAPIs/BingMapsAPI.h"
+#include "TileAPIs/GoogleMapsAPI.h"
+#include "TileAPIs/MapBoxTerrain.h"
+#include "TileAPIs/XYZTileAPI.h"
+
+/** Seconds between progress reports */
+static constexpr double ReportInterval = 5.0;
+
+UGeoViewerSeedCommandlet::UGeoViewerSeedCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UGeoViewerSeedCommandlet::Main(const FString& Params)
+{
+	// Area to seed as MinLon,MinLat,MaxLon,MaxLat
+	FString BoundsString;
+	TArray<FString> BoundsValues;
+	if (!FParse::Value(*Params, TEXT("bbox="), BoundsString) || BoundsString.ParseIntoArray(BoundsValues, TEXT(",")) != 4)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("-bbox=MinLon,MinLat,MaxLon,MaxLat is required"));
+		return 1;
+	}
+
+	FGeoBounds Bounds;
+	Bounds.TopLeft = FGeographicCoordinates(FCString::Atod(*BoundsValues[0]), FCString::Atod(*BoundsValues[3]), 0);
+	Bounds.BottomRight = FGeographicCoordinates(FCString::Atod(*BoundsValues[2]), FCString::Atod(*BoundsValues[1]), 0);
+
+	// Either a single zoom level or an inclusive range such as 15-19
+	FString ZoomString;
+	if (!FParse::Value(*Params, TEXT("zooms="), ZoomString))
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("-zooms=Min-Max is required"));
+		return 1;
+	}
+
+	FString MinZoomString, MaxZoomString;
+	if (!ZoomString.Split(TEXT("-"), &MinZoomString, &MaxZoomString))
+	{
+		MinZoomString = MaxZoomString = ZoomString;
+	}
+	const int MinZoom = FMath::Clamp(FCString::Atoi(*MinZoomString), 0, 22);
+	const int MaxZoom = FMath::Clamp(FCString::Atoi(*MaxZoomString), MinZoom, 22);
+
+	int32 MaxParallel = 64;
+	FParse::Value(*Params, TEXT("parallel="), MaxParallel);
+	MaxParallel = FMath::Max(MaxParallel, 1);
+
+	// The provider settings and API keys are read from the same config as the editor mode
+	UGeoViewerEdModeConfig* Config = NewObject<UGeoViewerEdModeConfig>(GetTransientPackage());
+	Config->Load();
+
+	FString Provider = TEXT("Google");
+	FParse::Value(*Params, TEXT("provider="), Provider);
+	FParse::Value(*Params, TEXT("url="), Config->XYZ.URLTemplate);
+
+	TSharedPtr<FWebMapTileAPI> TileAPI;
+	if (Provider == TEXT("Google"))
+	{
+		TileAPI = MakeShared<FGoogleMapsAPI>(Config, nullptr);
+	}
+	else if (Provider == TEXT("Bing"))
+	{
+		TileAPI = MakeShared<FBingMapsAPI>(Config, nullptr);
+	}
+	else if (Provider == TEXT("XYZ"))
+	{
+		if (Config->XYZ.URLTemplate.IsEmpty())
+		{
+			UE_LOG(LogGeoViewer, Error, TEXT("-url=Template is required for the XYZ provider"));
+			return 1;
+		}
+		TileAPI = MakeShared<FXYZTileAPI>(Config, nullptr);
+	}
+	else if (Provider == TEXT("Mapbox"))
+	{
+		TileAPI = MakeShared<FMapBoxTerrain>(Config, nullptr);
+	}
+	else
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("Unknown provider '%s', expected Google, Bing, XYZ or Mapbox"), *Provider);
+		return 1;
+	}
+
+	int32 Failures = 0;
+	for (int Zoom = MinZoom; Zoom <= MaxZoom; Zoom++)
+	{
+		TArray<FTileSegment> Segments;
+		TileAPI->SetZoomLevel(Zoom);
+		TileAPI->GetSegmentsInBounds(Bounds, Segments);
+
+		UE_LOG(LogGeoViewer, Display, TEXT("Seeding zoom %d: %d segments"), Zoom, Segments.Num());
+		Failures += DownloadSegments(Segments, MaxParallel);
+	}
+
+	FTileCache::Get().Flush();
+	UE_LOG(LogGeoViewer, Display, TEXT("Seeding finished with %d failed segments"), Failures);
+
+	return Failures > 0 ? 1 : 0;
+}
+
+int32 UGeoViewerSeedCommandlet::DownloadSegments(const TArray<FTileSegment>& Segments, const int32 MaxParallel) const
+{
+	FTileCache& Cache = FTileCache::Get();
+
+	struct FActiveDownload
+	{
+		TSharedRef<FTileDownloader> Downloader;
+		TSharedRef<bool> bFinished;
+	};
+	TArray<FActiveDownload> ActiveDownloads;
+
+	int32 NextSegment = 0;
+	int32 Skipped = 0;
+	int32 Downloaded = 0;
+	int32 Failures = 0;
+	int64 DownloadedBytes = 0;
+
+	const double StartTime = FPlatformTime::Seconds();
+	double LastReportTime = StartTime;
+	double LastTickTime = StartTime;
+
+	while (NextSegment < Segments.Num() || ActiveDownloads.Num() > 0)
+	{
+		// Keep the window full, the scheduler still limits how many requests are sent to the provider
+		while (NextSegment < Segments.Num() && ActiveDownloads.Num() < MaxParallel)
+		{
+			const FTileSegment& Segment = Segments[NextSegment++];
+
+			// Segments from an earlier run are already in the cache
+			if (Cache.Contains(Segment.Key))
+			{
+				Skipped++;
+				continue;
+			}
+
+			TSharedRef<FTileDownloader> Downloader = MakeShared<FTileDownloader>();
+			Downloader->SetExtentMetaData(Segment.TopCorner, Segment.Size, 3857);
+			Downloader->SetSchedulingInfo(Segment.Provider, Segment.Center);
+			Downloader->SetCacheEncoding(Segment.Encoding);
+
+			TSharedRef<bool> bFinished = MakeShared<bool>(false);
+			Downloader->OnDownloaded.AddLambda([bFinished](const FTileDownloader*) { *bFinished = true; });
+
+			if (Downloader->BeginDownload(Segment.URL, Segment.Key))
+			{
+				ActiveDownloads.Add({Downloader, bFinished});
+			}
+			else
+			{
+				Failures++;
+			}
+		}
+
+		// Nothing else ticks the HTTP module or runs game thread tasks in a commandlet
+		const double CurrentTime = FPlatformTime::Seconds();
+		FHttpModule::Get().GetHttpManager().Tick(CurrentTime - LastTickTime);
+		FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+		LastTickTime = CurrentTime;
+
+		for (int i = ActiveDownloads.Num() - 1; i >= 0; i--)
+		{
+			if (*ActiveDownloads[i].bFinished)
+			{
+				const TSharedRef<FTileDownloader>& Downloader = ActiveDownloads[i].Downloader;
+				if (Downloader->DecodedTile.IsValid())
+				{
+					Downloaded++;
+					DownloadedBytes += Downloader->GetDownloadedBytes();
+				}
+				else
+				{
+					Failures++;
+				}
+				ActiveDownloads.RemoveAtSwap(i);
+			}
+		}
+
+		if (CurrentTime - LastReportTime > ReportInterval)
+		{
+			const double Elapsed = CurrentTime - StartTime;
+			UE_LOG(LogGeoViewer, Display, TEXT("%d/%d segments (%d cached, %d failed), %.1f tiles/s, %.2f MB/s"),
+				NextSegment - ActiveDownloads.Num(), Segments.Num(), Skipped, Failures,
+				Downloaded / Elapsed, DownloadedBytes / Elapsed / (1024 * 1024));
+			LastReportTime = CurrentTime;
+
+			// Write the finished segments so little is lost if the run is interrupted
+			Cache.Flush();
+		}
+
+		FPlatformProcess::Sleep(0.005f);
+	}
+
+	const double Elapsed = FMath::Max(FPlatformTime::Seconds() - StartTime, UE_SMALL_NUMBER);
+	UE_LOG(LogGeoViewer, Display, TEXT("Downloaded %d segments (%d already cached, %d failed) in %.1fs, %.1f tiles/s, %.2f MB/s"),
+		Downloaded, Skipped, Failures, Elapsed, Downloaded / Elapsed, DownloadedBytes / Elapsed / (1024 * 1024));
+
+	return Failures;
+}
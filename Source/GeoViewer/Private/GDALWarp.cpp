@@ -1,38 +1,179 @@
 ﻿#include "GDALWarp.h"
 #include "GeoViewer.h"
+#include "SpatialReferenceCache.h"
+#include "Async/ParallelFor.h"
 
-GDALDatasetRef FGDALWarp::WarpDataset(const GDALDatasetRef& Dataset, const FString CurrentCRS, const FString FinalCRS)
-{
-	const FString SrcWKT = ConvertToWKT(CurrentCRS);
-	const FString DstWKT = ConvertToWKT(FinalCRS);
-
-	GDALDataset* DstDataset = (GDALDataset*) GDALAutoCreateWarpedVRT(
-		Dataset.Get(),
-		TCHAR_TO_UTF8(*SrcWKT),
-		TCHAR_TO_UTF8(*DstWKT),
-		GRA_Lanczos,
-		1,
-		NULL
-		);
+/** Number of warps running at once, the CPU cores are shared between them */
+static FThreadSafeCounter ActiveWarps;
 
-	return GDALDatasetRef(DstDataset);
-}
-
-GDALDatasetRef FGDALWarp::CropDataset(
+GDALDatasetRef FGDALWarp::WarpToBounds(
 	GDALDataset* SrcDataset,
+	const FString& SrcCRS,
+	const FString& DstCRS,
 	const FVector TopLeft,
 	const FVector BottomRight,
-	FString& OutFileName
+	const FIntVector2 Size,
+	const ESamplingAlgorithm Algorithm,
+	const FTileCancellationToken* CancellationToken
 	)
 {
-	TArray<FString> TranslateParameters;
-	TranslateParameters.Add("-projwin");
-	TranslateParameters.Add(FString::SanitizeFloat(BottomRight.X));
-	TranslateParameters.Add(FString::SanitizeFloat(BottomRight.Y));
-	TranslateParameters.Add(FString::SanitizeFloat(TopLeft.X));
-	TranslateParameters.Add(FString::SanitizeFloat(TopLeft.Y));
-	
-	return TranslateDataset(SrcDataset, TranslateParameters, OutFileName);
+	double SrcGeoTransform[6];
+	if (!SrcDataset || SrcDataset->GetRasterCount() == 0 || SrcDataset->GetGeoTransform(SrcGeoTransform) != CE_None)
+	{
+		return GDALDatasetRef();
+	}
+
+	// The reprojection comes from the cache instead of being set up again for every warp
+	const FString DstWKT = ConvertToWKT(DstCRS);
+	void* Transformer = FSpatialReferenceCache::Get().CreateImageTransformer(ConvertToWKT(SrcCRS), SrcGeoTransform, DstWKT);
+	if (!Transformer)
+	{
+		return GDALDatasetRef();
+	}
+
+	const double MinX = FMath::Min(TopLeft.X, BottomRight.X);
+	const double MaxX = FMath::Max(TopLeft.X, BottomRight.X);
+	const double MinY = FMath::Min(TopLeft.Y, BottomRight.Y);
+	const double MaxY = FMath::Max(TopLeft.Y, BottomRight.Y);
+
+	FIntVector2 DstSize = Size;
+	if (DstSize.X <= 0 || DstSize.Y <= 0)
+	{
+		// Keep the resolution of the source, the identity makes destination pixels georeferenced coordinates
+		const double Identity[6] = { 0, 1, 0, 0, 0, 1 };
+		FSpatialReferenceCache::SetDstGeoTransform(Transformer, Identity);
+
+		double SuggestedGeoTransform[6];
+		int SuggestedXSize = 0;
+		int SuggestedYSize = 0;
+		if (GDALSuggestedWarpOutput(SrcDataset, &FSpatialReferenceCache::Transform, Transformer,
+			SuggestedGeoTransform, &SuggestedXSize, &SuggestedYSize) != CE_None)
+		{
+			GDALDestroyTransformer(Transformer);
+			return GDALDatasetRef();
+		}
+
+		DstSize.X = FMath::Max(1, FMath::RoundToInt((MaxX - MinX) / FMath::Abs(SuggestedGeoTransform[1])));
+		DstSize.Y = FMath::Max(1, FMath::RoundToInt((MaxY - MinY) / FMath::Abs(SuggestedGeoTransform[5])));
+	}
+
+	double DstGeoTransform[6] = { MinX, (MaxX - MinX) / DstSize.X, 0, MaxY, 0, -(MaxY - MinY) / DstSize.Y };
+	FSpatialReferenceCache::SetDstGeoTransform(Transformer, DstGeoTransform);
+
+	GDALDriver* MemDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+	GDALDatasetRef DstDataset = GDALDatasetRef(MemDriver->Create(
+		"",
+		DstSize.X,
+		DstSize.Y,
+		SrcDataset->GetRasterCount(),
+		SrcDataset->GetRasterBand(1)->GetRasterDataType(),
+		nullptr
+		));
+	if (!DstDataset)
+	{
+		GDALDestroyTransformer(Transformer);
+		return GDALDatasetRef();
+	}
+	DstDataset->SetGeoTransform(DstGeoTransform);
+	DstDataset->SetProjection(TCHAR_TO_UTF8(*DstWKT));
+
+	GDALWarpOptions* WarpOptions = CreateWarpOptions(SrcDataset, DstDataset.Get(), Algorithm);
+
+	// Error threshold of an eighth of a pixel, the same as gdalwarp
+	void* ApproxTransformer = GDALCreateApproxTransformer(&FSpatialReferenceCache::Transform, Transformer, 0.125);
+	GDALApproxTransformerOwnsSubtransformer(ApproxTransformer, TRUE);
+	WarpOptions->pfnTransformer = GDALApproxTransform;
+	WarpOptions->pTransformerArg = ApproxTransformer;
+
+	if (CancellationToken)
+	{
+		WarpOptions->pfnProgress = [](double, const char*, void* ProgressData) -> int
+		{
+			return !static_cast<const FTileCancellationToken*>(ProgressData)->IsCancelled();
+		};
+		WarpOptions->pProgressArg = const_cast<FTileCancellationToken*>(CancellationToken);
+	}
+
+	// Tiles are warped on pool threads, so split the cores between the warps running at once
+	// rather than every warp starting a kernel thread per core
+	const int32 RunningWarps = ActiveWarps.Increment();
+	const int32 NumThreads = FMath::Max(1, FPlatformMisc::NumberOfCoresIncludingHyperthreads() / RunningWarps);
+	WarpOptions->papszWarpOptions = CSLSetNameValue(
+		WarpOptions->papszWarpOptions, "NUM_THREADS", TCHAR_TO_UTF8(*FString::FromInt(NumThreads)));
+
+	// Read the source on one thread while the kernel runs on the others
+	GDALWarpOperation Operation;
+	CPLErr Error = Operation.Initialize(WarpOptions);
+	if (Error == CE_None)
+	{
+		Error = Operation.ChunkAndWarpMulti(0, 0, DstSize.X, DstSize.Y);
+	}
+	ActiveWarps.Decrement();
+
+	GDALDestroyWarpOptions(WarpOptions);
+	GDALDestroyTransformer(ApproxTransformer);
+
+	if (Error != CE_None || (CancellationToken && CancellationToken->IsCancelled()))
+	{
+		return GDALDatasetRef();
+	}
+
+	return DstDataset;
+}
+
+GDALWarpOptions* FGDALWarp::CreateWarpOptions(GDALDataset* SrcDataset, GDALDataset* DstDataset, const ESamplingAlgorithm Algorithm)
+{
+	GDALWarpOptions* WarpOptions = GDALCreateWarpOptions();
+	WarpOptions->eResampleAlg = GetResampleAlg(Algorithm);
+	WarpOptions->hSrcDS = SrcDataset;
+	WarpOptions->hDstDS = DstDataset;
+
+	// Carry the alpha band over as alpha rather than as a colour band
+	int BandCount = SrcDataset->GetRasterCount();
+	if (BandCount > 0 && SrcDataset->GetRasterBand(BandCount)->GetColorInterpretation() == GCI_AlphaBand)
+	{
+		WarpOptions->nSrcAlphaBand = BandCount;
+		WarpOptions->nDstAlphaBand = BandCount;
+		DstDataset->GetRasterBand(BandCount)->SetColorInterpretation(GCI_AlphaBand);
+		BandCount--;
+	}
+
+	WarpOptions->nBandCount = BandCount;
+	WarpOptions->panSrcBands = static_cast<int*>(CPLMalloc(sizeof(int) * FMath::Max(BandCount, 1)));
+	WarpOptions->panDstBands = static_cast<int*>(CPLMalloc(sizeof(int) * FMath::Max(BandCount, 1)));
+	for (int i = 0; i < BandCount; i++)
+	{
+		WarpOptions->panSrcBands[i] = i + 1;
+		WarpOptions->panDstBands[i] = i + 1;
+	}
+
+	// Keep no data areas empty, mainly used by terrain
+	int bHasNoData = FALSE;
+	if (BandCount > 0)
+	{
+		SrcDataset->GetRasterBand(1)->GetNoDataValue(&bHasNoData);
+	}
+	if (bHasNoData)
+	{
+		WarpOptions->padfSrcNoDataReal = static_cast<double*>(CPLMalloc(sizeof(double) * BandCount));
+		WarpOptions->padfSrcNoDataImag = static_cast<double*>(CPLCalloc(BandCount, sizeof(double)));
+		WarpOptions->padfDstNoDataReal = static_cast<double*>(CPLMalloc(sizeof(double) * BandCount));
+		WarpOptions->padfDstNoDataImag = static_cast<double*>(CPLCalloc(BandCount, sizeof(double)));
+		for (int i = 0; i < BandCount; i++)
+		{
+			const double NoData = SrcDataset->GetRasterBand(i + 1)->GetNoDataValue();
+			WarpOptions->padfSrcNoDataReal[i] = NoData;
+			WarpOptions->padfDstNoDataReal[i] = NoData;
+			DstDataset->GetRasterBand(i + 1)->SetNoDataValue(NoData);
+		}
+		WarpOptions->papszWarpOptions = CSLSetNameValue(WarpOptions->papszWarpOptions, "INIT_DEST", "NO_DATA");
+	}
+	else
+	{
+		WarpOptions->papszWarpOptions = CSLSetNameValue(WarpOptions->papszWarpOptions, "INIT_DEST", "0");
+	}
+
+	return WarpOptions;
 }
 
 void FGDALWarp::DeleteVRTDatasets(TArray<FString>& DatasetPaths)
@@ -45,7 +186,7 @@ void FGDALWarp::DeleteVRTDatasets(TArray<FString>& DatasetPaths)
 	}
 }
 
-GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDatasetRef>& Datasets)
+GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDatasetRef>& Datasets, const bool bAddAlpha)
 {
 	TArray<GDALDataset*> DatasetPtrs;
 
@@ -54,10 +195,10 @@ GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDatasetRef>& Datasets)
 		DatasetPtrs.Add(DatasetRef.Get());
 	}
 
-	return MergeDatasets(DatasetPtrs);
+	return MergeDatasets(DatasetPtrs, bAddAlpha);
 }
 
-GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDataset*>& Datasets)
+GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDataset*>& Datasets, const bool bAddAlpha)
 {
 	std::vector<GDALDataset*> DatasetsVector;
 
@@ -66,6 +207,20 @@ GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDataset*>& Datasets)
 		DatasetsVector.push_back(Dataset);
 	}
 
+	mergetiff::ArgsArray ParametersChar;
+	if (bAddAlpha)
+	{
+		// Selecting the bands lets segments cached with and without alpha be merged together
+		ParametersChar.add("-b");
+		ParametersChar.add("1");
+		ParametersChar.add("-b");
+		ParametersChar.add("2");
+		ParametersChar.add("-b");
+		ParametersChar.add("3");
+		ParametersChar.add("-addalpha");
+	}
+	GDALBuildVRTOptions* Options = GDALBuildVRTOptionsNew(ParametersChar.get(), nullptr);
+
 	int OutputError = FALSE;
 
 	GDALAllRegister();
@@ -75,9 +230,10 @@ GDALDatasetRef FGDALWarp::MergeDatasets(TArray<GDALDataset*>& Datasets)
 			DatasetsVector.size(),
 			(GDALDatasetH*)DatasetsVector.data(),
 			nullptr,
-			nullptr,
+			Options,
 			&OutputError
 			);
+	GDALBuildVRTOptionsFree(Options);
 
 	return GDALDatasetRef(MergedDataset);
 }
@@ -100,17 +256,7 @@ GDALDatasetRef FGDALWarp::ResizeDataset(
 
 FString FGDALWarp::ConvertToWKT(FString CRS)
 {
-	// If the string is the correct length try and convert it
-	//EPSG:3857 - The first part is 5 digits plus 4 or 5 digits for the EPSG code
-	if (CRS.Len() == 9 || CRS.Len() == 10)
-	{
-		const FString EPSGCode = CRS.Mid(5); //Remove EPSG: prefix
-		const uint16 EPSGInt = FCString::Atoi(*EPSGCode);
-		return ConvertToWKT(EPSGInt);
-	}
-
-	// If the wrong length it may be invalid or already in the form of a WKT
-	return CRS;
+	return FSpatialReferenceCache::Get().GetWKT(CRS);
 }
 
 FString FGDALWarp::ConvertToFString(char* Text)
@@ -181,15 +327,168 @@ UTexture2D* FGDALWarp::CreateTexture2D(UObject* Outer, TArray<uint8>& RawImage,
 	return Texture;
 }
 
-FString FGDALWarp::ConvertToWKT(const uint16 EPSGInt)
+bool FGDALWarp::ReadRaster(
+	GDALDataset* Dataset,
+	void* OutData,
+	const GDALDataType DataType,
+	const int Channels,
+	const FTileCancellationToken* CancellationToken
+	)
 {
-	OGRSpatialReference SpatialReference;
-	SpatialReference.importFromEPSG(EPSGInt);
+	// Strips smaller than this spend more time opening handles than reading
+	constexpr int MinRowsPerStrip = 64;
+	constexpr int64 MinParallelPixels = 1024 * 1024;
+
+	const int XSize = Dataset->GetRasterXSize();
+	const int YSize = Dataset->GetRasterYSize();
+	const int ValueSize = GDALGetDataTypeSizeBytes(DataType);
+	const int64 LineSpace = (int64)ValueSize * Channels * XSize;
+
+	// MEM datasets are already in memory so are copied quicker than another handle can be opened
+	const GDALDriver* Driver = Dataset->GetDriver();
+	const bool bInMemory = Driver && EQUAL(Driver->GetDescription(), "MEM");
+
+	int NumWorkers = 1;
+	int RowsPerStrip = YSize;
+	if (!bInMemory && (int64)XSize * YSize >= MinParallelPixels)
+	{
+		NumWorkers = FMath::Max(1, FMath::Min(FPlatformMisc::NumberOfCoresIncludingHyperthreads(), YSize / MinRowsPerStrip));
 
-	char* Wkt;
-	SpatialReference.exportToWkt(&Wkt);
-	
-	return ConvertToFString(Wkt);
+		// A few strips per worker so one slow part of the image doesn't hold up the rest
+		RowsPerStrip = FMath::Max(MinRowsPerStrip, FMath::DivideAndRoundUp(YSize, NumWorkers * 4));
+	}
+	const int NumStrips = FMath::DivideAndRoundUp(YSize, RowsPerStrip);
+
+	// GDAL reports progress between blocks, returning false from the callback stops the read
+	GDALRasterIOExtraArg ExtraArg;
+	INIT_RASTERIO_EXTRA_ARG(ExtraArg);
+	if (CancellationToken)
+	{
+		ExtraArg.pfnProgress = [](double, const char*, void* ProgressData) -> int
+		{
+			return !static_cast<const FTileCancellationToken*>(ProgressData)->IsCancelled();
+		};
+		ExtraArg.pProgressData = const_cast<FTileCancellationToken*>(CancellationToken);
+	}
+
+	FThreadSafeCounter NextStrip;
+	FThreadSafeBool bFailed = false;
+
+	ParallelFor(NumWorkers, [&](const int32 Worker)
+	{
+		// The first worker reads from the original dataset so every strip is read even if no other handle opens
+		GDALDatasetRef Handle = Worker > 0 ? OpenReadHandle(Dataset) : GDALDatasetRef();
+		GDALDataset* WorkerDataset = Worker > 0 ? Handle.Get() : Dataset;
+		if (!WorkerDataset
+			|| WorkerDataset->GetRasterXSize() != XSize
+			|| WorkerDataset->GetRasterYSize() != YSize
+			|| WorkerDataset->GetRasterCount() < Channels)
+		{
+			return;
+		}
+
+		GDALRasterIOExtraArg WorkerExtraArg = ExtraArg;
+		for (int Strip = NextStrip.Increment() - 1; Strip < NumStrips; Strip = NextStrip.Increment() - 1)
+		{
+			if (bFailed || (CancellationToken && CancellationToken->IsCancelled()))
+			{
+				return;
+			}
+
+			const int YOffset = Strip * RowsPerStrip;
+			const int Rows = FMath::Min(RowsPerStrip, YSize - YOffset);
+
+			// Every band is read straight into its position in the interleaved image
+			const CPLErr Error = WorkerDataset->RasterIO(
+				GF_Read,
+				0,
+				YOffset,
+				XSize,
+				Rows,
+				static_cast<uint8*>(OutData) + YOffset * LineSpace,
+				XSize,
+				Rows,
+				DataType,
+				Channels,
+				nullptr,
+				(GSpacing)ValueSize * Channels,
+				LineSpace,
+				ValueSize,
+				&WorkerExtraArg
+				);
+
+			if (Error != CE_None)
+			{
+				bFailed = true;
+			}
+		}
+	}, NumWorkers == 1);
+
+	return !bFailed && !(CancellationToken && CancellationToken->IsCancelled());
+}
+
+GDALDataset* FGDALWarp::OpenMemoryDataset(
+	const void* Data,
+	const GDALDataType DataType,
+	const int XSize,
+	const int YSize,
+	const int Bands
+	)
+{
+	if (!Data || XSize <= 0 || YSize <= 0 || Bands <= 0)
+	{
+		return nullptr;
+	}
+
+	const int ValueSize = GDALGetDataTypeSizeBytes(DataType);
+	const FString DatasetName = FString::Printf(
+		TEXT("MEM:::DATAPOINTER=0x%llx,PIXELS=%d,LINES=%d,BANDS=%d,DATATYPE=%s,PIXELOFFSET=%d,LINEOFFSET=%lld,BANDOFFSET=%d"),
+		(uint64)(UPTRINT)Data,
+		XSize,
+		YSize,
+		Bands,
+		UTF8_TO_TCHAR(GDALGetDataTypeName(DataType)),
+		ValueSize * Bands,
+		(int64)ValueSize * Bands * XSize,
+		ValueSize
+		);
+
+	return (GDALDataset*)GDALOpen(TCHAR_TO_UTF8(*DatasetName), GA_ReadOnly);
+}
+
+GDALDatasetRef FGDALWarp::OpenReadHandle(GDALDataset* Dataset)
+{
+	const GDALDriver* Driver = Dataset->GetDriver();
+	if (!Driver || EQUAL(Driver->GetDescription(), "MEM"))
+	{
+		return GDALDatasetRef();
+	}
+
+	const char* Path = Dataset->GetDescription();
+
+	// VRTs created in memory have no file but the XML describing them can be opened instead
+	if (EQUAL(Driver->GetDescription(), "VRT"))
+	{
+		char** VRTXML = Dataset->GetMetadata("xml:VRT");
+		if (!VRTXML || !VRTXML[0])
+		{
+			return GDALDatasetRef();
+		}
+		Path = VRTXML[0];
+	}
+
+	if (!Path || Path[0] == '\0')
+	{
+		return GDALDatasetRef();
+	}
+
+	return GDALDatasetRef((GDALDataset*)GDALOpenEx(Path, GDAL_OF_RASTER | GDAL_OF_READONLY, nullptr, nullptr, nullptr));
+}
+
+FString FGDALWarp::ConvertToWKT(const uint16 EPSGInt)
+{
+	// Looking up the EPSG database is slow so each code is only converted once
+	return FSpatialReferenceCache::Get().GetWKT(EPSGInt);
 }
 
 GDALDatasetRef FGDALWarp::TranslateDataset(
@@ -216,6 +515,25 @@ GDALDatasetRef FGDALWarp::TranslateDataset(
 	return GDALDatasetRef(TranslatedDataset);
 }
 
+GDALResampleAlg FGDALWarp::GetResampleAlg(const ESamplingAlgorithm Algorithm)
+{
+	switch (Algorithm)
+	{
+	case ESamplingAlgorithm::Nearest: return GRA_NearestNeighbour;
+	case ESamplingAlgorithm::Average: return GRA_Average;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 3, 0)
+	case ESamplingAlgorithm::Rms: return GRA_RMS;
+#else
+	case ESamplingAlgorithm::Rms: return GRA_Average;
+#endif
+	case ESamplingAlgorithm::Bilinear: return GRA_Bilinear;
+	case ESamplingAlgorithm::Cubic: return GRA_Cubic;
+	case ESamplingAlgorithm::CubicSpline: return GRA_CubicSpline;
+	case ESamplingAlgorithm::Mode: return GRA_Mode;
+	default: return GRA_Lanczos;
+	}
+}
+
 FString FGDALWarp::GetSamplingParameter(ESamplingAlgorithm Algorithm)
 {
 	switch (Algorithm)
@@ -4,6 +4,12 @@
 #include "GeoViewerEdMode.h"
 #include "GeoViewerSettings.h"
 #include "GeoViewerStyle.h"
+#include "RasterReadPool.h"
+#include "SpatialReferenceCache.h"
+#include "TileAPIs/GeoTIFFTileAPI.h"
+#include "TileAPIs/HGTIndex.h"
+#include "TileCache.h"
+#include "TileMemoryCache.h"
 #include "ISettingsModule.h"
 
 #define LOCTEXT_NAMESPACE "FGeoViewerModule"
@@ -39,10 +45,30 @@ void FGeoViewerModule::StartupModule()
 	CPLSetConfigOption("GDAL_DATA", TCHAR_TO_UTF8(*GDALDataPath));
 	
 	GDALAllRegister();
+	FSpatialReferenceCache::Get().Initialize();
+
+	// Load the index of cached tiles
+	FTileCache::Get().Initialize();
+	FTileCache::Get().SetSizeLimit(GetDefault<UGeoViewerSettings>()->GetCacheSizeLimit());
+	FTileMemoryCache::Get().SetSizeLimit(GetDefault<UGeoViewerSettings>()->GetMemoryCacheSizeLimit());
+
+	FRasterReadPool::Get().Initialize();
+
+	// Find the terrain files available for imports
+	FHGTIndex::Get().Refresh();
 }
 
 void FGeoViewerModule::ShutdownModule()
 {
+	// Stop reading overlay tiles before the segments they use are released
+	FRasterReadPool::Get().Shutdown();
+	FGeoTIFFTileAPI::CloseSourceFiles();
+
+	// Write any tiles still waiting to be cached
+	FTileCache::Get().Shutdown();
+	FTileMemoryCache::Get().Empty();
+	FSpatialReferenceCache::Get().Shutdown();
+
 	FGeoViewerStyle::Shutdown();
 	
 	FEditorModeRegistry::Get().UnregisterMode(FGeoViewerEdMode::EM_GeoViewerEdModeId);
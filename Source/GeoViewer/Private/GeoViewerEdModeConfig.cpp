@@ -9,6 +9,11 @@ void UGeoViewerEdModeConfig::Load()
 	int32 OverlaySystemInt = (int32)EOverlayMapSystem::GoogleMaps;
 	GConfig->GetInt(TEXT("GeoViewer"), TEXT("OverlaySystem"), OverlaySystemInt, GEditorSettingsIni);
 	OverlaySystem = (EOverlayMapSystem)OverlaySystemInt;
+	GConfig->GetBool(TEXT("GeoViewer"), TEXT("SnapToPixelGrid"), bSnapToPixelGrid, GEditorSettingsIni);
+	GConfig->GetInt(TEXT("GeoViewer"), TEXT("PrefetchDistance"), PrefetchDistance, GEditorSettingsIni);
+	GConfig->GetBool(TEXT("GeoViewer"), TEXT("PrefetchNeighbours"), bPrefetchNeighbours, GEditorSettingsIni);
+	GConfig->GetInt(TEXT("GeoViewer"), TEXT("CancelDistance"), CancelDistance, GEditorSettingsIni);
+	GConfig->GetBool(TEXT("GeoViewer"), TEXT("ProgressiveLoading"), bProgressiveLoading, GEditorSettingsIni);
 
 	// Bing Maps
 	GConfig->GetInt(TEXT("GeoViewer"), TEXT("BingZoomLevel"), BingMaps.ZoomLevel, GEditorSettingsIni);
@@ -26,10 +31,19 @@ void UGeoViewerEdModeConfig::Load()
 	GConfig->GetInt(TEXT("GeoViewer"), TEXT("GoogleType"), GoogleMapTypeInt, GEditorSettingsIni);
 	GoogleMaps.Type = (EGoogleMapType)GoogleMapTypeInt;
 
+	// XYZ Tile Server
+	GConfig->GetString(TEXT("GeoViewer"), TEXT("XYZURLTemplate"), XYZ.URLTemplate, GEditorSettingsIni);
+	GConfig->GetInt(TEXT("GeoViewer"), TEXT("XYZZoomLevel"), XYZ.ZoomLevel, GEditorSettingsIni);
+
+	// Local GeoTIFF
+	GConfig->GetString(TEXT("GeoViewer"), TEXT("GeoTIFFFile"), GeoTIFF.File.FilePath, GEditorPerProjectIni);
+	GConfig->GetInt(TEXT("GeoViewer"), TEXT("GeoTIFFTileResolution"), GeoTIFF.TileResolution, GEditorSettingsIni);
+
 	// Landscape
 	int32 LandscapeFormatInt = (int32)ELandscapeFormat::STRM;
 	GConfig->GetInt(TEXT("GeoViewer"), TEXT("LandscapeFormat"), LandscapeFormatInt, GEditorSettingsIni);
 	LandscapeFormat = (ELandscapeFormat)LandscapeFormatInt;
+	GConfig->GetString(TEXT("GeoViewer"), TEXT("LandscapeGeoTIFF"), LandscapeGeoTIFF.FilePath, GEditorPerProjectIni);
 
 	int32 LandscapeReSamplingAlgorithmInt = (int32)ESamplingAlgorithm::Lanczos;
 	GConfig->GetInt(TEXT("GeoViewer"), TEXT("LandscapeAlgorithm"), LandscapeReSamplingAlgorithmInt, GEditorSettingsIni);
@@ -52,6 +66,11 @@ void UGeoViewerEdModeConfig::Save()
 {
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("MainTileSize"), TileSize, GEditorSettingsIni);
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("OverlaySystem"), (int32)OverlaySystem, GEditorSettingsIni);
+	GConfig->SetBool(TEXT("GeoViewer"), TEXT("SnapToPixelGrid"), bSnapToPixelGrid, GEditorSettingsIni);
+	GConfig->SetInt(TEXT("GeoViewer"), TEXT("PrefetchDistance"), PrefetchDistance, GEditorSettingsIni);
+	GConfig->SetBool(TEXT("GeoViewer"), TEXT("PrefetchNeighbours"), bPrefetchNeighbours, GEditorSettingsIni);
+	GConfig->SetInt(TEXT("GeoViewer"), TEXT("CancelDistance"), CancelDistance, GEditorSettingsIni);
+	GConfig->SetBool(TEXT("GeoViewer"), TEXT("ProgressiveLoading"), bProgressiveLoading, GEditorSettingsIni);
 
 	// Bing Maps
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("BingZoomLevel"), BingMaps.ZoomLevel, GEditorSettingsIni);
@@ -63,8 +82,17 @@ void UGeoViewerEdModeConfig::Save()
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("GoogleTileResolution"), GoogleMaps.TileResolution, GEditorSettingsIni);
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("GoogleType"), (int32)GoogleMaps.Type, GEditorSettingsIni);
 
+	// XYZ Tile Server
+	GConfig->SetString(TEXT("GeoViewer"), TEXT("XYZURLTemplate"), *XYZ.URLTemplate, GEditorSettingsIni);
+	GConfig->SetInt(TEXT("GeoViewer"), TEXT("XYZZoomLevel"), XYZ.ZoomLevel, GEditorSettingsIni);
+
+	// Local GeoTIFF
+	GConfig->SetString(TEXT("GeoViewer"), TEXT("GeoTIFFFile"), *GeoTIFF.File.FilePath, GEditorPerProjectIni);
+	GConfig->SetInt(TEXT("GeoViewer"), TEXT("GeoTIFFTileResolution"), GeoTIFF.TileResolution, GEditorSettingsIni);
+
 	// Landscape
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("LandscapeFormat"), (int32)LandscapeFormat, GEditorSettingsIni);
+	GConfig->SetString(TEXT("GeoViewer"), TEXT("LandscapeGeoTIFF"), *LandscapeGeoTIFF.FilePath, GEditorPerProjectIni);
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("LandscapeAlgorithm"), (int32)LandscapeResamplingAlgorithm, GEditorSettingsIni);
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("LandscapeSectionSize"), SectionSize, GEditorPerProjectIni);
 	GConfig->SetInt(TEXT("GeoViewer"), TEXT("NumberOfComponents"), NumberOfComponents, GEditorPerProjectIni);
@@ -84,12 +112,16 @@ void UGeoViewerEdModeConfig::PostEditChangeProperty(FPropertyChangedEvent& Prope
 		PropertyName == GET_MEMBER_NAME_CHECKED(UGeoViewerEdModeConfig, OverlaySystem) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(UGeoViewerEdModeConfig, TileSize) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(UGeoViewerEdModeConfig, MaxNumberOfTiles) ||
+		PropertyName == GET_MEMBER_NAME_CHECKED(UGeoViewerEdModeConfig, bSnapToPixelGrid) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(FGoogleMapsOverlayConfig, Type) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(FGoogleMapsOverlayConfig, TileResolution) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(FGoogleMapsOverlayConfig, ZoomLevel) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(FBingMapsOverlayConfig, Type) ||
 		PropertyName == GET_MEMBER_NAME_CHECKED(FBingMapsOverlayConfig, TileResolution) ||
-		PropertyName == GET_MEMBER_NAME_CHECKED(FBingMapsOverlayConfig, ZoomLevel);
+		PropertyName == GET_MEMBER_NAME_CHECKED(FBingMapsOverlayConfig, ZoomLevel) ||
+		PropertyName == GET_MEMBER_NAME_CHECKED(FXYZOverlayConfig, URLTemplate) ||
+		PropertyName == GET_MEMBER_NAME_CHECKED(FXYZOverlayConfig, ZoomLevel) ||
+		PropertyChangedEvent.GetMemberPropertyName() == GET_MEMBER_NAME_CHECKED(UGeoViewerEdModeConfig, GeoTIFF);
 		
 	if (bMainOverlaySettingChanged && PropertyChangedEvent.ChangeType != EPropertyChangeType::Interactive)
 	{
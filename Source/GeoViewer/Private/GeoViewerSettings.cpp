@@ -1,2 +1,19 @@
-﻿
-#include "GeoViewerSettings.h"
+﻿#include "GeoViewerSettings.h"
+#include "TileCache.h"
+#include "TileMemoryCache.h"
+
+#if WITH_EDITOR
+void UGeoViewerSettings::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	if (PropertyChangedEvent.GetPropertyName() == GET_MEMBER_NAME_CHECKED(UGeoViewerSettings, CacheSizeLimitMB))
+	{
+		FTileCache::Get().SetSizeLimit(GetCacheSizeLimit());
+	}
+	else if (PropertyChangedEvent.GetPropertyName() == GET_MEMBER_NAME_CHECKED(UGeoViewerSettings, MemoryCacheSizeMB))
+	{
+		FTileMemoryCache::Get().SetSizeLimit(GetMemoryCacheSizeLimit());
+	}
+}
+#endif
@@ -9,6 +9,7 @@
 #include "SWeightMapImportDlg.h"
 #include "HAL/FileManagerGeneric.h"
 #include "Kismet/GameplayStatics.h"
+#include "TileAPIs/GeoTIFFTileAPI.h"
 #include "TileAPIs/HGTTileAPI.h"
 #include "TileAPIs/MapBoxTerrain.h"
 
@@ -88,7 +89,9 @@ void FLandscapeImporter::LoadTile(FVector LandscapePosition, bool bLoadManyTiles
 		WeightMaps.Empty();
 		ImportWeightMap(WeightMaps, TileBounds);
 		
+		// Heights are warped straight to the resolution of the landscape
 		const TSharedRef<FGeoTileAPI> TileAPI = GetTileAPI();
+		TileAPI->SetOutputSize(GetTotalSize(), EdModeConfig->LandscapeResamplingAlgorithm);
 		TileAPI->LoadTile(TileBounds);
 		
 		CachedTileAPI = TileAPI;
@@ -165,24 +168,31 @@ void FLandscapeImporter::OnTileDataLoaded(GDALDataset* Dataset)
 		// Size of final image containing all tiles
 		FIntVector2 FinalSize = GetTotalSize();
 		
-		// Create new dataset so the height data can be resized
-		const GDALDatasetRef HeightDataset =
-			FGDALWarp::CreateDataset(HeightData, InitialXSize, InitialYSize, ERGBFormat::Gray);
-
 		TArray<FString> FilesToDelete;
 		
-		// Resize height data
-		FString DatasetFilePath;
-		GDALDatasetRef ResizedHeightDataset = FGDALWarp::ResizeDataset(
-			HeightDataset.Get(),
-			FinalSize,
-			DatasetFilePath,
-			EdModeConfig->LandscapeResamplingAlgorithm
-			);
-		FilesToDelete.Add(DatasetFilePath);
-
+		// Resize height data, the tile API normally warps it to the final size already
 		TArray<uint16> HeightDataResized;
-		FGDALWarp::GetRawImage(ResizedHeightDataset, HeightDataResized);
+		if (InitialXSize == FinalSize.X && InitialYSize == FinalSize.Y)
+		{
+			HeightDataResized = MoveTemp(HeightData);
+		}
+		else
+		{
+			// Wrap the height data in a dataset so it can be resized without copying it
+			const GDALDatasetRef HeightDataset =
+				FGDALWarp::WrapRawImage(HeightData, InitialXSize, InitialYSize, ERGBFormat::Gray);
+
+			FString DatasetFilePath;
+			GDALDatasetRef ResizedHeightDataset = FGDALWarp::ResizeDataset(
+				HeightDataset.Get(),
+				FinalSize,
+				DatasetFilePath,
+				EdModeConfig->LandscapeResamplingAlgorithm
+				);
+			FilesToDelete.Add(DatasetFilePath);
+
+			FGDALWarp::GetRawImage(ResizedHeightDataset, HeightDataResized);
+		}
 		
 		// Cut giant image down into tiles then add create landscape proxies from this data.
 		for (int x = 0; x < NumOfTiles.X; x++)
@@ -438,7 +448,7 @@ void FLandscapeImporter::ImportWeightMap(TArray<TArray<uint8>>& RawData, FProjec
 			}
 		}
 		
-		Layers.Add(Layer);
+		Layers.Add(MoveTemp(Layer));
 	}
 	
 	FIntVector2 RequiredResolution = GetTotalSize();
@@ -447,33 +457,23 @@ void FLandscapeImporter::ImportWeightMap(TArray<TArray<uint8>>& RawData, FProjec
 	{
 		FString WorldCRS = ReferenceSystem->ProjectedCRS;
 		
-		// Paths to temp datasets that must be deleted before this function ends
-		TArray<FString> DatasetPaths;
-		
 		// Warp, crop and resize each layer
 		for (TArray<uint8>& Layer : Layers)
 		{
 			GDALDatasetRef LayerDataset =
-				FGDALWarp::CreateDataset(Layer, MergedXSize, MergedYSize, ERGBFormat::Gray);
+				FGDALWarp::WrapRawImage(Layer, MergedXSize, MergedYSize, ERGBFormat::Gray);
 			LayerDataset->SetProjection(MergedProjection);
 			LayerDataset->SetGeoTransform(MergedGeoTransform);
 			
-			GDALDatasetRef WarpedLayer =
-				FGDALWarp::WarpDataset(LayerDataset, MergedProjection, WorldCRS);
-
-			FString CroppedDatasetPath;
-			GDALDatasetRef CroppedDataset =
-				FGDALWarp::CropDataset(WarpedLayer.Get(), Bounds.TopLeft, Bounds.BottomRight, CroppedDatasetPath);
-			DatasetPaths.Add(CroppedDatasetPath);
-
-			FString ResizedDatasetPath;
 			GDALDatasetRef ResizedDataset =
-				FGDALWarp::ResizeDataset(
-					CroppedDataset.Get(),
+				FGDALWarp::WarpToBounds(
+					LayerDataset.Get(),
+					MergedProjection,
+					WorldCRS,
+					Bounds.TopLeft,
+					Bounds.BottomRight,
 					RequiredResolution,
-					ResizedDatasetPath,
 					EdModeConfig->LandscapeResamplingAlgorithm);
-			DatasetPaths.Add(ResizedDatasetPath);
 
 			TArray<uint8> CompletedLayer;
 			FGDALWarp::GetRawImage(
@@ -484,12 +484,12 @@ void FLandscapeImporter::ImportWeightMap(TArray<TArray<uint8>>& RawData, FProjec
 				1
 				);
 
-			RawData.Add(CompletedLayer);
+			RawData.Add(MoveTemp(CompletedLayer));
 
+			// The layer dataset reads from the layer so must be closed first
+			LayerDataset.Reset();
 			Layer.Empty();
 		}
-
-		FGDALWarp::DeleteVRTDatasets(DatasetPaths);
 	}
 	
 }
@@ -506,6 +506,13 @@ TSharedRef<FGeoTileAPI> FLandscapeImporter::GetTileAPI()
 					AWorldReferenceSystem::GetWorldReferenceSystem(World)
 					);
 			break;
+		case ELandscapeFormat::GeoTIFF:
+			Output = MakeShared<FGeoTIFFTileAPI>(
+				EdModeConfig,
+				AWorldReferenceSystem::GetWorldReferenceSystem(World),
+				EdModeConfig->LandscapeGeoTIFF.FilePath
+				);
+			break;
 		case ELandscapeFormat::STRM:
 		default:
 			Output = MakeShared<FHGTTileAPI>(
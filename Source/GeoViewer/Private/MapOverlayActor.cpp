@@ -8,6 +8,7 @@
 #include "Components/ArrowComponent.h"
 #include "Kismet/GameplayStatics.h"
 #include "ReferenceSystems/WorldReferenceSystem.h"
+#include "TileDownloadScheduler.h"
 #include "TileAPIs/BingMapsAPI.h"
 #include "UObject/ConstructorHelpers.h"
 
@@ -22,6 +23,7 @@ AMapOverlayActor::AMapOverlayActor()
 	SetRootComponent(Component);
 
 	bOverlayActive = false;
+	CompletedReads = MakeShared<FRasterReadQueue, ESPMode::ThreadSafe>();
 	
 	//Material used on the decals to display the overlay
 	static ConstructorHelpers::FObjectFinder<UMaterial> BaseMaterial(TEXT("/GeoViewer/M_Overlay.M_Overlay"));
@@ -60,18 +62,50 @@ void AMapOverlayActor::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	// Give the images read since the last frame to the decals waiting for them
+	FRasterReadResult CompletedRead;
+	while (CompletedReads->Dequeue(CompletedRead))
+	{
+		for (UOverlayTileComponent* Decal : WebDecals)
+		{
+			if (Decal && Decal->FinishReading(CompletedRead))
+			{
+				break;
+			}
+		}
+	}
+
 	if (bOverlayActive)
 	{
 		const FViewportCursorLocation Cursor = GCurrentLevelEditingViewportClient->GetCursorWorldLocationFromMousePos();
 		const FVector UserPosition = Cursor.GetOrigin();
-		
+
+		// Download the segments closest to the cursor first
+		if (AWorldReferenceSystem* WorldReferenceSystem = GetWorldReferenceSystem())
+		{
+			FVector ProjectedPosition;
+			FGeographicCoordinates GeographicPosition;
+			WorldReferenceSystem->EngineToProjected(UserPosition, ProjectedPosition);
+			WorldReferenceSystem->ProjectedToGeographic(ProjectedPosition, GeographicPosition);
+			FTileDownloadScheduler::Get().SetFocus(GeographicPosition);
+		}
+
 		// Calculate the tile position/index between the origin and user
 		const int TileSize = EdModeConfig->TileSize;
 		const int X = FMath::Floor(UserPosition.X / TileSize);
 		const int Y = FMath::Floor(UserPosition.Y / TileSize);
 		
+		// Queue the tiles the cursor is moving towards in the background
+		Prefetcher.Update(UserPosition, DeltaTime, GetWorldReferenceSystem(), [this](const FString& TileKey)
+		{
+			return Tiles.Contains(TileKey);
+		});
+
+		// Stop loading tiles the cursor has moved away from
+		CancelDistantTiles(FIntPoint(X, Y));
+
 		// Form a string and check that tile doesn't already exist
-		const FString Key =  FString::FromInt(X) + "," + FString::FromInt(Y);
+		const FString Key = FOverlayPrefetcher::GetTileKey(FIntPoint(X, Y));
 		if (!Tiles.Contains(Key))
 		{
 			// Calculate UE coordinates for corner positions of the tile
@@ -118,6 +152,7 @@ void AMapOverlayActor::Activate()
 void AMapOverlayActor::Deactivate()
 {
 	bOverlayActive = false;
+	Prefetcher.Reset();
 
 	// Hide all tiles from web apis
 	for (UOverlayTileComponent* Decal : WebDecals)
@@ -132,6 +167,7 @@ void AMapOverlayActor::Deactivate()
 void AMapOverlayActor::SetConfig(UGeoViewerEdModeConfig* InConfig)
 {
 	EdModeConfig = InConfig;
+	Prefetcher.SetConfig(EdModeConfig);
 	ReloadConfig();
 }
 
@@ -149,6 +185,7 @@ void AMapOverlayActor::ReloadConfig()
 			if (Decal)
 			{
 				// Ensure all decals are properly unregistered from the actor
+				Decal->CancelLoading();
 				Decal->DestroyComponent();
 			}
 		}
@@ -157,52 +194,114 @@ void AMapOverlayActor::ReloadConfig()
 		WebDecals.Empty(EdModeConfig->MaxNumberOfTiles);
 		WebDecals.Init(nullptr, EdModeConfig->MaxNumberOfTiles);
 
+		// Tiles still being warped would otherwise call back with keys that no longer exist
+		for (const TPair<FString, TSharedPtr<FOverlayTileGenerator>>& Tile : Tiles)
+		{
+			if (Tile.Value.IsValid())
+			{
+				Tile.Value->Cancel();
+			}
+		}
 		Tiles.Empty();
+		Prefetcher.Reset();
 	}
 }
 
 void AMapOverlayActor::AddOverlayTile(GDALDataset* Dataset, FString Key)
 {
-	UOverlayTileComponent* NextComponent = GetNextComponent();
+	// The tile may have been removed while it was loading
+	TSharedPtr<FOverlayTileGenerator>* TileGeneratorPtr = Tiles.Find(Key);
+	if (!TileGeneratorPtr)
+	{
+		if (Dataset)
+		{
+			GDALClose(Dataset);
+		}
+		return;
+	}
 
 	// Remove the generator for the tiles map as it can be destroyed once the texture is created
-	const TSharedPtr<FOverlayTileGenerator> TileGenerator = Tiles[Key];
-	Tiles[Key].Reset();
+	const TSharedPtr<FOverlayTileGenerator> TileGenerator = *TileGeneratorPtr;
+	TileGeneratorPtr->Reset();
+
+	// Replace the preview in place so the tile doesn't disappear while the full image is read
+	UOverlayTileComponent* const* PreviewComponent = WebDecals.FindByPredicate(
+		[&Key](const UOverlayTileComponent* Decal)
+		{
+			return Decal && Decal->Key == Key && Decal->IsShowingPreview();
+		});
+	if (PreviewComponent)
+	{
+		(*PreviewComponent)->RefineDataset(Dataset, TileGenerator);
+		return;
+	}
 
 	if (!Dataset)
 	{
 		return;
 	}
 	
+	// If the component is still loading the previous tile the user is probably
+	// moving too fast so don't add the new overlay tile for now
+	if (!ShowDataset(Dataset, Key, TileGenerator, false))
+	{
+		GDALClose(Dataset);
+		Tiles.Remove(Key);
+	}
+}
+
+void AMapOverlayActor::AddOverlayPreview(GDALDataset* Dataset, FString Key)
+{
+	// The generator is kept in the tiles map until the full quality tile arrives
+	const TSharedPtr<FOverlayTileGenerator>* TileGenerator = Tiles.Find(Key);
+	if (!TileGenerator || !TileGenerator->IsValid())
+	{
+		GDALClose(Dataset);
+		return;
+	}
+
+	// Skipping the preview is fine, the full quality tile will try again
+	if (!ShowDataset(Dataset, Key, *TileGenerator, true))
+	{
+		GDALClose(Dataset);
+	}
+}
+
+bool AMapOverlayActor::ShowDataset(
+	GDALDataset* Dataset,
+	const FString& Key,
+	const TSharedPtr<FOverlayTileGenerator> TileGenerator,
+	const bool bIsPreview
+	)
+{
+	UOverlayTileComponent* NextComponent = GetNextComponent();
 	if (NextComponent)
 	{
-		// If the component is still loading the previous tile the user is probably
-		// moving too fast so don't add the new overlay tile for now
 		if (NextComponent->IsLoadingTile())
 		{
-			Tiles.Remove(Key);
-		}
-		else
-		{
-			Tiles.Remove(NextComponent->Key);
-			NextComponent->Key = Key;
-			
-			NextComponent->SetDataset(Dataset, TileGenerator);
-			IncrementQueueIndex();
+			return false;
 		}
+
+		Tiles.Remove(NextComponent->Key);
+		NextComponent->Key = Key;
+		
+		NextComponent->SetDataset(Dataset, TileGenerator, nullptr, bIsPreview);
+		IncrementQueueIndex();
 	}
 	else
 	{
 		// Create a new component if one does not exist as this point in the array
 		UOverlayTileComponent* TileComponent = NewObject<UOverlayTileComponent>(this);
 		TileComponent->CreationMethod = EComponentCreationMethod::Instance;
-		TileComponent->SetDataset(Dataset, TileGenerator, LoadingMaterial);
+		TileComponent->SetDataset(Dataset, TileGenerator, LoadingMaterial, bIsPreview);
 		TileComponent->RegisterComponent();
 		TileComponent->Key = Key;
 		TileComponent->SetOpacity(EdModeConfig->Opacity);
 		WebDecals[DecalQueueIdx] = TileComponent;
 		IncrementQueueIndex();
 	}
+
+	return true;
 }
 
 void AMapOverlayActor::UpdateOpacity()
@@ -236,6 +335,47 @@ TSharedRef<FOverlayTileGenerator> AMapOverlayActor::LoadNewTile(const FVector Co
 	return Tile;
 }
 
+void AMapOverlayActor::CancelDistantTiles(const FIntPoint CurrentTile)
+{
+	const int CancelDistance = EdModeConfig->CancelDistance;
+	if (CancelDistance <= 0)
+	{
+		return;
+	}
+
+	auto IsDistant = [CurrentTile, CancelDistance](const FString& TileKey)
+	{
+		FIntPoint TileIndex;
+		if (!FOverlayPrefetcher::ParseTileKey(TileKey, TileIndex))
+		{
+			return false;
+		}
+
+		const FIntPoint Offset = TileIndex - CurrentTile;
+		return FMath::Max(FMath::Abs(Offset.X), FMath::Abs(Offset.Y)) > CancelDistance;
+	};
+
+	// Tiles still downloading or being merged keep their generator in the map
+	for (auto It = Tiles.CreateIterator(); It; ++It)
+	{
+		if (It.Value().IsValid() && IsDistant(It.Key()))
+		{
+			It.Value()->Cancel();
+			It.RemoveCurrent();
+		}
+	}
+
+	// Tiles being read into a texture
+	for (UOverlayTileComponent* Decal : WebDecals)
+	{
+		if (Decal && Decal->IsLoadingTile() && IsDistant(Decal->Key))
+		{
+			Tiles.Remove(Decal->Key);
+			Decal->CancelLoading();
+		}
+	}
+}
+
 AWorldReferenceSystem* AMapOverlayActor::GetWorldReferenceSystem()
 {
 	if (!CachedWorldReference.IsValid())
@@ -0,0 +1,217 @@
+﻿#include "OverlayPrefetcher.h"
+#include "OverlayTileGenerator.h"
+
+/** Cosine of the angle the cursor direction has to turn by before the prefetches are replanned */
+static constexpr float DirectionChangeCos = 0.7f;
+
+FOverlayPrefetcher::FOverlayPrefetcher():
+	Velocity(FVector2D::ZeroVector),
+	LastPosition(FVector::ZeroVector),
+	bHasLastPosition(false),
+	PlannedTile(FIntPoint::ZeroValue),
+	PlannedDirection(FVector2D::ZeroVector),
+	bHasPlan(false)
+{
+}
+
+FOverlayPrefetcher::~FOverlayPrefetcher()
+{
+	Reset();
+}
+
+void FOverlayPrefetcher::SetConfig(const TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig)
+{
+	EdModeConfig = InEdModeConfig;
+	Reset();
+}
+
+void FOverlayPrefetcher::Reset()
+{
+	// Cancels any downloads no other tile is waiting for
+	for (TPair<FString, FPrefetchTile>& Pair : PrefetchTiles)
+	{
+		if (Pair.Value.TileAPI.IsValid())
+		{
+			Pair.Value.TileAPI->Cancel();
+		}
+	}
+	PrefetchTiles.Empty();
+
+	Velocity = FVector2D::ZeroVector;
+	bHasLastPosition = false;
+	bHasPlan = false;
+}
+
+FString FOverlayPrefetcher::GetTileKey(const FIntPoint TileIndex)
+{
+	return FString::FromInt(TileIndex.X) + "," + FString::FromInt(TileIndex.Y);
+}
+
+bool FOverlayPrefetcher::ParseTileKey(const FString& Key, FIntPoint& OutTileIndex)
+{
+	FString X, Y;
+	if (!Key.Split(TEXT(","), &X, &Y))
+	{
+		return false;
+	}
+
+	OutTileIndex = FIntPoint(FCString::Atoi(*X), FCString::Atoi(*Y));
+	return true;
+}
+
+void FOverlayPrefetcher::Update(
+	const FVector& CursorPosition,
+	const float DeltaTime,
+	AWorldReferenceSystem* ReferencingSystem,
+	const TFunctionRef<bool(const FString&)> IsTileLoaded
+	)
+{
+	if (!EdModeConfig.IsValid() || !ReferencingSystem)
+	{
+		return;
+	}
+
+	// Smooth the velocity so small movements of the mouse don't change the prediction
+	if (bHasLastPosition && DeltaTime > 0)
+	{
+		const FVector2D Movement = FVector2D(CursorPosition - LastPosition) / DeltaTime;
+		Velocity = FMath::Lerp(Velocity, Movement, FMath::Min(DeltaTime * 5.f, 1.f));
+	}
+	LastPosition = CursorPosition;
+	bHasLastPosition = true;
+
+	// Anything slower than a quarter of a tile per second is treated as still
+	const int TileSize = EdModeConfig->TileSize;
+	const bool bMoving = Velocity.Size() > TileSize * 0.25f;
+	const FVector2D Direction = bMoving ? Velocity.GetSafeNormal() : FVector2D::ZeroVector;
+
+	const FIntPoint CurrentTile(
+		FMath::FloorToInt(CursorPosition.X / TileSize),
+		FMath::FloorToInt(CursorPosition.Y / TileSize)
+		);
+
+	const bool bWasMoving = !PlannedDirection.IsZero();
+	const bool bDirectionChanged = bMoving != bWasMoving ||
+		(bMoving && FVector2D::DotProduct(Direction, PlannedDirection) < DirectionChangeCos);
+
+	if (!bHasPlan || CurrentTile != PlannedTile || bDirectionChanged)
+	{
+		PlanPrefetches(CurrentTile, Direction, ReferencingSystem, IsTileLoaded);
+	}
+
+	// Completed tile APIs can't be released in their own callback so are released here
+	for (TPair<FString, FPrefetchTile>& Pair : PrefetchTiles)
+	{
+		if (Pair.Value.bComplete)
+		{
+			Pair.Value.TileAPI.Reset();
+		}
+	}
+}
+
+void FOverlayPrefetcher::PlanPrefetches(
+	const FIntPoint CurrentTile,
+	const FVector2D& Direction,
+	AWorldReferenceSystem* ReferencingSystem,
+	const TFunctionRef<bool(const FString&)> IsTileLoaded
+	)
+{
+	PlannedTile = CurrentTile;
+	PlannedDirection = Direction;
+	bHasPlan = true;
+
+	// Tiles along the path of the cursor come first as they are needed soonest
+	TArray<FIntPoint> WantedTiles;
+	if (!Direction.IsZero())
+	{
+		const int TileSize = EdModeConfig->TileSize;
+		const FVector2D TileCenter = (FVector2D(CurrentTile) + 0.5f) * TileSize;
+		for (int i = 1; i <= EdModeConfig->PrefetchDistance; i++)
+		{
+			const FVector2D Position = TileCenter + Direction * TileSize * i;
+			WantedTiles.AddUnique(FIntPoint(
+				FMath::FloorToInt(Position.X / TileSize),
+				FMath::FloorToInt(Position.Y / TileSize)
+				));
+		}
+	}
+
+	if (EdModeConfig->bPrefetchNeighbours)
+	{
+		for (int Y = -1; Y <= 1; Y++)
+		{
+			for (int X = -1; X <= 1; X++)
+			{
+				WantedTiles.AddUnique(CurrentTile + FIntPoint(X, Y));
+			}
+		}
+	}
+
+	// The overlay loads the tile under the cursor itself
+	WantedTiles.Remove(CurrentTile);
+
+	TSet<FString> WantedKeys;
+	for (const FIntPoint& TileIndex : WantedTiles)
+	{
+		WantedKeys.Add(GetTileKey(TileIndex));
+	}
+
+	// Cancel tiles that are no longer ahead of the cursor
+	for (auto It = PrefetchTiles.CreateIterator(); It; ++It)
+	{
+		if (!WantedKeys.Contains(It.Key()))
+		{
+			if (It.Value().TileAPI.IsValid())
+			{
+				It.Value().TileAPI->Cancel();
+			}
+			It.RemoveCurrent();
+		}
+	}
+
+	for (const FIntPoint& TileIndex : WantedTiles)
+	{
+		const FString Key = GetTileKey(TileIndex);
+		if (!PrefetchTiles.Contains(Key) && !IsTileLoaded(Key))
+		{
+			StartPrefetch(TileIndex, ReferencingSystem);
+		}
+	}
+}
+
+void FOverlayPrefetcher::StartPrefetch(const FIntPoint TileIndex, AWorldReferenceSystem* ReferencingSystem)
+{
+	// Use the same corners as the overlay so the same segments are requested
+	const int TileSize = EdModeConfig->TileSize;
+	const FVector Corner1 = FVector(TileIndex.X * TileSize, TileIndex.Y * TileSize, 0);
+	const FVector Corner2 = FVector(TileSize, TileSize, 0) + Corner1;
+
+	FProjectedBounds TileBounds;
+	ReferencingSystem->EngineToProjected(Corner2, TileBounds.TopLeft);
+	ReferencingSystem->EngineToProjected(Corner1, TileBounds.BottomRight);
+
+	// Add the tile before loading as it may complete straight away if all segments are cached
+	const FString Key = GetTileKey(TileIndex);
+	FPrefetchTile& PrefetchTile = PrefetchTiles.Add(Key);
+	PrefetchTile.TileAPI = FOverlayTileGenerator::CreateTileAPI(EdModeConfig, ReferencingSystem);
+	PrefetchTile.TileAPI->SetPrefetch(true);
+	PrefetchTile.TileAPI->OnComplete.BindRaw(this, &FOverlayPrefetcher::OnPrefetchComplete, Key);
+
+	// Hold a reference while loading so the tile API outlives its own callbacks
+	const TSharedPtr<FGeoTileAPI> TileAPI = PrefetchTile.TileAPI;
+	TileAPI->LoadTile(TileBounds);
+}
+
+void FOverlayPrefetcher::OnPrefetchComplete(GDALDataset* Dataset, const FString Key)
+{
+	// Only the cached segments are wanted, any tile API that still creates a dataset has it closed here
+	if (Dataset)
+	{
+		GDALClose(Dataset);
+	}
+
+	if (FPrefetchTile* PrefetchTile = PrefetchTiles.Find(Key))
+	{
+		PrefetchTile->bComplete = true;
+	}
+}
@@ -1,6 +1,7 @@
 ﻿#include "OverlayTileComponent.h"
 
 #include "GDALWarp.h"
+#include "MapOverlayActor.h"
 #include "Materials/MaterialInstanceDynamic.h"
 #include "ReferenceSystems/WorldReferenceSystem.h"
 
@@ -8,34 +9,33 @@
 // Sets default values for this component's properties
 UOverlayTileComponent::UOverlayTileComponent()
 {
-	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
-	PrimaryComponentTick.bCanEverTick = true;
+	// Completed reads are handed over by the overlay actor so the component never needs to tick
+	PrimaryComponentTick.bCanEverTick = false;
 
+	PendingReadID = 0;
+	bIsPreview = false;
 }
 
 void UOverlayTileComponent::BeginDestroy()
 {
 	Super::BeginDestroy();
 	
-	if (TextureWorker)
-	{
-		delete TextureWorker;
-		TextureWorker = nullptr;
-	}
-	
-	RawImage.Empty();
+	StopReading();
 }
 
 void UOverlayTileComponent::SetDataset(
 	GDALDataset* Dataset,
 	const TSharedPtr<FOverlayTileGenerator> InTileGenerator,
-	UMaterialInterface* InParentMaterial
+	UMaterialInterface* InParentMaterial,
+	const bool bInIsPreview
 	)
 {
 	//TODO: Check the projection matches the engine projection otherwise it must be reprojected.
 
 	// Store the generator as the Dataset may require other datasets that it holds.
 	TileGenerator = InTileGenerator;
+	bIsPreview = bInIsPreview;
+	StopReading();
 
 	// Remove current texture
 	if (Texture)
@@ -60,7 +60,7 @@ void UOverlayTileComponent::SetDataset(
 	Dataset->GetGeoTransform(GeoTransform);
 	
 	// Create texture from dataset
-	TextureWorker = new FGDALRasterReaderWorker(Dataset, RawImage);
+	StartReading(Dataset);
 
 	// Calculate projected bounds
 	AWorldReferenceSystem* ReferenceSystem = AWorldReferenceSystem::GetWorldReferenceSystem(GetWorld());
@@ -98,11 +98,41 @@ void UOverlayTileComponent::SetDataset(
 	// Resize and position decal for the dataset
 	SetRelativeRotation(FRotator(270, 0, 0));
 	SetWorldLocation(Center);
+
+	// Show the decal again if a previous tile was cancelled
+	const AMapOverlayActor* OverlayActor = Cast<AMapOverlayActor>(GetOwner());
+	SetVisibility(!OverlayActor || OverlayActor->GetOverlayState());
+}
+
+void UOverlayTileComponent::RefineDataset(GDALDataset* Dataset, const TSharedPtr<FOverlayTileGenerator> InTileGenerator)
+{
+	// The preview isn't needed anymore if it's still being read
+	StopReading();
+
+	bIsPreview = false;
+	TileGenerator = InTileGenerator;
+
+	if (!Dataset)
+	{
+		TileGenerator.Reset();
+		return;
+	}
+
+	StartReading(Dataset);
+}
+
+void UOverlayTileComponent::CancelLoading()
+{
+	StopReading();
+	TileGenerator.Reset();
+	bIsPreview = false;
+	Key.Empty();
+	SetVisibility(false);
 }
 
 bool UOverlayTileComponent::IsLoadingTile() const
 {
-	return !Texture && TextureWorker;
+	return PendingReadID != 0 || bIsPreview;
 }
 
 void UOverlayTileComponent::SetOpacity(const float Opacity) const
@@ -111,32 +141,44 @@ void UOverlayTileComponent::SetOpacity(const float Opacity) const
 	DynamicMaterial->SetScalarParameterValue("Opacity", Opacity);
 }
 
-void UOverlayTileComponent::TickComponent(float DeltaTime, ELevelTick TickType,
-                                          FActorComponentTickFunction* ThisTickFunction)
+bool UOverlayTileComponent::FinishReading(FRasterReadResult& Result)
 {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	if (PendingReadID == 0 || Result.ReadID != PendingReadID)
+	{
+		return false;
+	}
+
+	PendingReadID = 0;
+	ReadCancellationToken.Reset();
 
-	if (IsLoadingTile())
+	if (Result.bCancelled)
 	{
-		if (TextureWorker->bDone)
-		{
-			TextureWorker->bDone = false;
-			
-			Texture = FGDALWarp::CreateTexture2D(
-				this,
-				RawImage,
-				TextureWorker->SizeX,
-				TextureWorker->SizeY
-				);
-			SetTextureMaterial();
-
-			delete TextureWorker;
-			TextureWorker = nullptr;
-			RawImage.Empty();
-
-			TileGenerator.Reset();
-		}
+		CancelLoading();
+		return true;
 	}
+
+	// Replaces the preview once the full quality image has been read
+	if (Texture)
+	{
+		Texture->ConditionalBeginDestroy();
+		Texture = nullptr;
+	}
+	
+	Texture = FGDALWarp::CreateTexture2D(
+		this,
+		Result.RawImage,
+		Result.SizeX,
+		Result.SizeY
+		);
+	SetTextureMaterial();
+
+	// The generator is still needed to refine the preview
+	if (!bIsPreview)
+	{
+		TileGenerator.Reset();
+	}
+
+	return true;
 }
 
 void UOverlayTileComponent::SetTextureMaterial() const
@@ -145,3 +187,32 @@ void UOverlayTileComponent::SetTextureMaterial() const
 	UMaterialInstanceDynamic* DynamicMaterial = Cast<UMaterialInstanceDynamic>(DecalMaterial);
 	DynamicMaterial->SetTextureParameterValue("MapTexture", Texture);
 }
+
+void UOverlayTileComponent::StartReading(GDALDataset* Dataset)
+{
+	// The read stops early if the tile is cancelled. Previews use their own token
+	// as replacing one before it's read must not cancel the whole tile.
+	ReadCancellationToken = TileGenerator.IsValid() && !bIsPreview ? TileGenerator->GetCancellationToken() : nullptr;
+	if (!ReadCancellationToken.IsValid())
+	{
+		ReadCancellationToken = MakeShared<FTileCancellationToken, ESPMode::ThreadSafe>();
+	}
+
+	const AMapOverlayActor* OverlayActor = CastChecked<AMapOverlayActor>(GetOwner());
+	PendingReadID = FRasterReadPool::Get().Read(
+		Dataset,
+		OverlayActor->GetCompletedReads(),
+		ReadCancellationToken.ToSharedRef()
+		);
+}
+
+void UOverlayTileComponent::StopReading()
+{
+	if (ReadCancellationToken.IsValid())
+	{
+		ReadCancellationToken->Cancel();
+		ReadCancellationToken.Reset();
+	}
+
+	PendingReadID = 0;
+}
@@ -2,14 +2,18 @@
 #include "GDALWarp.h"
 #include "MapOverlayActor.h"
 #include "TileAPIs/BingMapsAPI.h"
+#include "TileAPIs/GeoTIFFTileAPI.h"
 #include "TileAPIs/GoogleMapsAPI.h"
+#include "TileAPIs/XYZTileAPI.h"
 
-FOverlayTileGenerator::FOverlayTileGenerator(): ParentActor(nullptr)
+FOverlayTileGenerator::FOverlayTileGenerator()
 {
 }
 
 FOverlayTileGenerator::~FOverlayTileGenerator()
 {
+	// The tile API may outlive the generator while a warp is running, stop it calling back
+	Cancel();
 }
 
 void FOverlayTileGenerator::GenerateTile(AMapOverlayActor* InParentActor,
@@ -19,19 +23,71 @@ void FOverlayTileGenerator::GenerateTile(AMapOverlayActor* InParentActor,
 {
 	ParentActor = InParentActor;
 	
+	TileLoader = CreateTileAPI(InEdModeConfig, ReferencingSystem);
+	TileLoader->OnComplete.BindSP(this, &FOverlayTileGenerator::OnTileFinishedLoading);
+	if (InEdModeConfig->bProgressiveLoading)
+	{
+		TileLoader->OnPreview.BindSP(this, &FOverlayTileGenerator::OnPreviewLoaded);
+	}
+	TileLoader->LoadTile(TileBounds);
+}
+
+void FOverlayTileGenerator::Cancel() const
+{
+	if (TileLoader.IsValid())
+	{
+		TileLoader->Cancel();
+	}
+}
+
+FTileCancellationTokenPtr FOverlayTileGenerator::GetCancellationToken() const
+{
+	return TileLoader.IsValid() ? FTileCancellationTokenPtr(TileLoader->GetCancellationToken()) : nullptr;
+}
+
+TSharedRef<FGeoTileAPI> FOverlayTileGenerator::CreateTileAPI(TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
+                                                             AWorldReferenceSystem* ReferencingSystem)
+{
 	if (InEdModeConfig->OverlaySystem == EOverlayMapSystem::BingMaps)
 	{
-		TileLoader = MakeShared<FBingMapsAPI>(InEdModeConfig, ReferencingSystem);
-	} else
+		return MakeShared<FBingMapsAPI>(InEdModeConfig, ReferencingSystem);
+	} else if (InEdModeConfig->OverlaySystem == EOverlayMapSystem::XYZ)
+	{
+		return MakeShared<FXYZTileAPI>(InEdModeConfig, ReferencingSystem);
+	} else if (InEdModeConfig->OverlaySystem == EOverlayMapSystem::GeoTIFF)
 	{
-		TileLoader = MakeShared<FGoogleMapsAPI>(InEdModeConfig, ReferencingSystem);
+		const TSharedRef<FGeoTileAPI> TileAPI =
+			MakeShared<FGeoTIFFTileAPI>(InEdModeConfig, ReferencingSystem, InEdModeConfig->GeoTIFF.File.FilePath);
+
+		// Read the overview matching the decal resolution instead of the full resolution image
+		const int Resolution = InEdModeConfig->GeoTIFF.TileResolution;
+		TileAPI->SetOutputSize(FIntVector2(Resolution, Resolution), ESamplingAlgorithm::Lanczos);
+		return TileAPI;
 	}
-	
-	TileLoader->OnComplete.BindRaw(this, &FOverlayTileGenerator::OnTileFinishedLoading);
-	TileLoader->LoadTile(TileBounds);
+
+	return MakeShared<FGoogleMapsAPI>(InEdModeConfig, ReferencingSystem);
 }
 
 void FOverlayTileGenerator::OnTileFinishedLoading(GDALDataset* Dataset) const
 {
-	ParentActor->AddOverlayTile(Dataset, Key);
+	if (ParentActor.IsValid())
+	{
+		ParentActor->AddOverlayTile(Dataset, Key);
+	}
+	else if (Dataset)
+	{
+		GDALClose(Dataset);
+	}
+}
+
+void FOverlayTileGenerator::OnPreviewLoaded(GDALDataset* Dataset) const
+{
+	if (ParentActor.IsValid())
+	{
+		ParentActor->AddOverlayPreview(Dataset, Key);
+	}
+	else if (Dataset)
+	{
+		GDALClose(Dataset);
+	}
 }
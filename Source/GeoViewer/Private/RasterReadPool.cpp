@@ -0,0 +1,120 @@
+﻿#include "RasterReadPool.h"
+#include "GeoViewer.h"
+#include "GDALWarp.h"
+#include "Misc/QueuedThreadPool.h"
+
+/** Reads one dataset on a pool thread */
+class FRasterReadTask : public IQueuedWork
+{
+public:
+	FRasterReadTask(
+		const uint64 InReadID,
+		GDALDataset* InDataset,
+		const FRasterReadQueueRef& InCompletedReads,
+		const FTileCancellationTokenRef& InCancellationToken
+		)
+		: ReadID(InReadID)
+		, Dataset(InDataset)
+		, CompletedReads(InCompletedReads)
+		, CancellationToken(InCancellationToken)
+	{
+	}
+
+	// IQueuedWork Interface
+	virtual void DoThreadedWork() override
+	{
+		FRasterReadResult Result;
+		Result.ReadID = ReadID;
+
+		if (Dataset.IsValid() && !CancellationToken->IsCancelled())
+		{
+			Result.SizeX = Dataset->GetRasterXSize();
+			Result.SizeY = Dataset->GetRasterYSize();
+			FGDALWarp::GetRawImage(Dataset, Result.RawImage, *CancellationToken);
+		}
+		Result.bCancelled = CancellationToken->IsCancelled();
+
+		// Close the dataset here rather than on the game thread
+		Dataset.Reset();
+
+		CompletedReads->Enqueue(MoveTemp(Result));
+		delete this;
+	}
+
+	virtual void Abandon() override
+	{
+		FRasterReadResult Result;
+		Result.ReadID = ReadID;
+		Result.bCancelled = true;
+
+		CompletedReads->Enqueue(MoveTemp(Result));
+		delete this;
+	}
+	// End of IQueuedWork Interface
+
+private:
+	uint64 ReadID;
+	GDALDatasetRef Dataset;
+	FRasterReadQueueRef CompletedReads;
+	FTileCancellationTokenRef CancellationToken;
+};
+
+FRasterReadPool::FRasterReadPool()
+{
+}
+
+FRasterReadPool& FRasterReadPool::Get()
+{
+	static FRasterReadPool Pool;
+	return Pool;
+}
+
+void FRasterReadPool::Initialize()
+{
+	if (ThreadPool.IsValid())
+	{
+		return;
+	}
+
+	// Leave most cores for the editor and the warps running on the global thread pool
+	const int32 NumThreads = FMath::Clamp(FPlatformMisc::NumberOfCoresIncludingHyperthreads() / 4, 1, 4);
+
+	ThreadPool.Reset(FQueuedThreadPool::Allocate());
+	if (!ThreadPool->Create(NumThreads, 128 * 1024, TPri_BelowNormal, TEXT("GeoViewerRasterReadPool")))
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("Failed to create the raster read pool, overlay tiles will not be shown."));
+		ThreadPool.Reset();
+	}
+}
+
+void FRasterReadPool::Shutdown()
+{
+	if (ThreadPool.IsValid())
+	{
+		// Waits for running reads and abandons the queued ones
+		ThreadPool->Destroy();
+		ThreadPool.Reset();
+	}
+}
+
+uint64 FRasterReadPool::Read(
+	GDALDataset* Dataset,
+	const FRasterReadQueueRef& CompletedReads,
+	const FTileCancellationTokenRef& CancellationToken
+	)
+{
+	const uint64 ReadID = LastReadID.Increment();
+	FRasterReadTask* Task = new FRasterReadTask(ReadID, Dataset, CompletedReads, CancellationToken);
+
+	if (ThreadPool.IsValid())
+	{
+		ThreadPool->AddQueuedWork(Task);
+	}
+	else
+	{
+		// Only happens while the module is shutting down
+		Task->Abandon();
+	}
+
+	return ReadID;
+}
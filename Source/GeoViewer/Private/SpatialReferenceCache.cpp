@@ -0,0 +1,306 @@
+﻿#include "SpatialReferenceCache.h"
+#include <gdal_alg_priv.h>
+
+/**
+ * Transformer from source pixels to destination pixels using a pooled reprojection. The GDAL
+ * header must come first so GDALDestroyTransformer and the warper can recognise it.
+ */
+struct FCachedImageTransformer
+{
+	GDALTransformerInfo Info;
+
+	double SrcGeoTransform[6];
+	double SrcInvGeoTransform[6];
+	double DstGeoTransform[6];
+	double DstInvGeoTransform[6];
+
+	FString SrcWKT;
+	FString DstWKT;
+	void* Reprojection;
+
+	static void Destroy(void* TransformerArg);
+	static void* CreateSimilar(void* TransformerArg, double SrcRatioX, double SrcRatioY);
+	static CPLXMLNode* Serialize(void* TransformerArg);
+	static void* Deserialize(CPLXMLNode* Tree);
+
+	/** Name of the XML node written by 'Serialize' */
+	static constexpr const char* ClassName = "GeoViewerCachedTransformer";
+};
+
+namespace
+{
+	void WriteGeoTransform(CPLXMLNode* Parent, const char* Name, const double* GeoTransform)
+	{
+		const FString Value = FString::Printf(TEXT("%.18g,%.18g,%.18g,%.18g,%.18g,%.18g"),
+			GeoTransform[0], GeoTransform[1], GeoTransform[2], GeoTransform[3], GeoTransform[4], GeoTransform[5]);
+		CPLCreateXMLElementAndValue(Parent, Name, TCHAR_TO_UTF8(*Value));
+	}
+
+	bool ReadGeoTransform(CPLXMLNode* Parent, const char* Name, double* OutGeoTransform)
+	{
+		TArray<FString> Values;
+		FString(UTF8_TO_TCHAR(CPLGetXMLValue(Parent, Name, ""))).ParseIntoArray(Values, TEXT(","));
+		if (Values.Num() != 6)
+		{
+			return false;
+		}
+
+		for (int i = 0; i < 6; i++)
+		{
+			OutGeoTransform[i] = FCString::Atod(*Values[i]);
+		}
+		return true;
+	}
+}
+
+void FCachedImageTransformer::Destroy(void* TransformerArg)
+{
+	FCachedImageTransformer* Transformer = static_cast<FCachedImageTransformer*>(TransformerArg);
+	FSpatialReferenceCache::Get().ReleaseReprojection(Transformer->SrcWKT, Transformer->DstWKT, Transformer->Reprojection);
+	delete Transformer;
+}
+
+void* FCachedImageTransformer::CreateSimilar(void* TransformerArg, const double SrcRatioX, const double SrcRatioY)
+{
+	// Used by GDAL for overviews of the source, the pixels are larger by the ratio
+	const FCachedImageTransformer* Transformer = static_cast<FCachedImageTransformer*>(TransformerArg);
+	double GeoTransform[6];
+	FMemory::Memcpy(GeoTransform, Transformer->SrcGeoTransform, sizeof(GeoTransform));
+	GeoTransform[1] *= SrcRatioX;
+	GeoTransform[2] *= SrcRatioY;
+	GeoTransform[4] *= SrcRatioX;
+	GeoTransform[5] *= SrcRatioY;
+
+	void* Similar = FSpatialReferenceCache::Get().CreateImageTransformer(Transformer->SrcWKT, GeoTransform, Transformer->DstWKT);
+	if (Similar)
+	{
+		FSpatialReferenceCache::SetDstGeoTransform(Similar, Transformer->DstGeoTransform);
+	}
+	return Similar;
+}
+
+CPLXMLNode* FCachedImageTransformer::Serialize(void* TransformerArg)
+{
+	// GDAL clones the transformer this way for every warp thread, 'Deserialize' takes the clone's reprojection from the pool
+	const FCachedImageTransformer* Transformer = static_cast<FCachedImageTransformer*>(TransformerArg);
+	CPLXMLNode* Tree = CPLCreateXMLNode(nullptr, CXT_Element, ClassName);
+	CPLCreateXMLElementAndValue(Tree, "SrcSRS", TCHAR_TO_UTF8(*Transformer->SrcWKT));
+	CPLCreateXMLElementAndValue(Tree, "DstSRS", TCHAR_TO_UTF8(*Transformer->DstWKT));
+	WriteGeoTransform(Tree, "SrcGeoTransform", Transformer->SrcGeoTransform);
+	WriteGeoTransform(Tree, "DstGeoTransform", Transformer->DstGeoTransform);
+	return Tree;
+}
+
+void* FCachedImageTransformer::Deserialize(CPLXMLNode* Tree)
+{
+	double SrcGeoTransform[6];
+	double DstGeoTransform[6];
+	if (!ReadGeoTransform(Tree, "SrcGeoTransform", SrcGeoTransform) || !ReadGeoTransform(Tree, "DstGeoTransform", DstGeoTransform))
+	{
+		return nullptr;
+	}
+
+	void* Transformer = FSpatialReferenceCache::Get().CreateImageTransformer(
+		UTF8_TO_TCHAR(CPLGetXMLValue(Tree, "SrcSRS", "")),
+		SrcGeoTransform,
+		UTF8_TO_TCHAR(CPLGetXMLValue(Tree, "DstSRS", "")));
+	if (Transformer)
+	{
+		FSpatialReferenceCache::SetDstGeoTransform(Transformer, DstGeoTransform);
+	}
+	return Transformer;
+}
+
+/////////////////////////////////////////////////////
+// FSpatialReferenceCache
+
+FSpatialReferenceCache& FSpatialReferenceCache::Get()
+{
+	static FSpatialReferenceCache Cache;
+	return Cache;
+}
+
+void FSpatialReferenceCache::Initialize()
+{
+	if (!Deserializer)
+	{
+		Deserializer = GDALRegisterTransformDeserializer(
+			FCachedImageTransformer::ClassName,
+			&FSpatialReferenceCache::Transform,
+			&FCachedImageTransformer::Deserialize);
+	}
+}
+
+void FSpatialReferenceCache::Shutdown()
+{
+	if (Deserializer)
+	{
+		GDALUnregisterTransformDeserializer(Deserializer);
+		Deserializer = nullptr;
+	}
+
+	Empty();
+}
+
+FString FSpatialReferenceCache::GetWKT(const uint16 EPSG)
+{
+	{
+		FScopeLock Lock(&CacheLock);
+		if (const FString* Definition = EPSGDefinitions.Find(EPSG))
+		{
+			return *Definition;
+		}
+	}
+
+	// Looked up outside of the lock as the projection database is slow
+	OGRSpatialReference SpatialReference;
+	FString Definition;
+	if (SpatialReference.importFromEPSG(EPSG) == OGRERR_NONE)
+	{
+		char* Wkt = nullptr;
+		SpatialReference.exportToWkt(&Wkt);
+		const CPLStringRef WktRef(Wkt);
+		Definition = UTF8_TO_TCHAR(WktRef.Get());
+	}
+
+	FScopeLock Lock(&CacheLock);
+	EPSGDefinitions.Add(EPSG, Definition);
+	return Definition;
+}
+
+FString FSpatialReferenceCache::GetWKT(const FString& CRS)
+{
+	// If the string is the correct length try and convert it
+	//EPSG:3857 - The first part is 5 digits plus 4 or 5 digits for the EPSG code
+	if (CRS.Len() == 9 || CRS.Len() == 10)
+	{
+		const FString EPSGCode = CRS.Mid(5); //Remove EPSG: prefix
+		return GetWKT(static_cast<uint16>(FCString::Atoi(*EPSGCode)));
+	}
+
+	// If the wrong length it may be invalid or already in the form of a WKT
+	return CRS;
+}
+
+void* FSpatialReferenceCache::CreateImageTransformer(const FString& SrcWKT, const double* SrcGeoTransform, const FString& DstWKT)
+{
+	FCachedImageTransformer* Transformer = new FCachedImageTransformer();
+	FMemory::Memcpy(Transformer->SrcGeoTransform, SrcGeoTransform, sizeof(Transformer->SrcGeoTransform));
+	if (!GDALInvGeoTransform(Transformer->SrcGeoTransform, Transformer->SrcInvGeoTransform))
+	{
+		delete Transformer;
+		return nullptr;
+	}
+
+	// Same as the source until the size of the warped dataset is known
+	FMemory::Memcpy(Transformer->DstGeoTransform, SrcGeoTransform, sizeof(Transformer->DstGeoTransform));
+	FMemory::Memcpy(Transformer->DstInvGeoTransform, Transformer->SrcInvGeoTransform, sizeof(Transformer->DstInvGeoTransform));
+
+	Transformer->SrcWKT = SrcWKT;
+	Transformer->DstWKT = DstWKT;
+	Transformer->Reprojection = AcquireReprojection(SrcWKT, DstWKT);
+	if (!Transformer->Reprojection && SrcWKT != DstWKT)
+	{
+		delete Transformer;
+		return nullptr;
+	}
+
+	FMemory::Memcpy(Transformer->Info.abySignature, GDAL_GTI2_SIGNATURE, strlen(GDAL_GTI2_SIGNATURE));
+	Transformer->Info.pszClassName = FCachedImageTransformer::ClassName;
+	Transformer->Info.pfnTransform = &FSpatialReferenceCache::Transform;
+	Transformer->Info.pfnCleanup = &FCachedImageTransformer::Destroy;
+	Transformer->Info.pfnSerialize = &FCachedImageTransformer::Serialize;
+	Transformer->Info.pfnCreateSimilar = &FCachedImageTransformer::CreateSimilar;
+
+	return Transformer;
+}
+
+void FSpatialReferenceCache::SetDstGeoTransform(void* TransformerArg, const double* DstGeoTransform)
+{
+	FCachedImageTransformer* Transformer = static_cast<FCachedImageTransformer*>(TransformerArg);
+	FMemory::Memcpy(Transformer->DstGeoTransform, DstGeoTransform, sizeof(Transformer->DstGeoTransform));
+	GDALInvGeoTransform(Transformer->DstGeoTransform, Transformer->DstInvGeoTransform);
+}
+
+int FSpatialReferenceCache::Transform(void* TransformerArg, const int bDstToSrc, const int PointCount,
+                                      double* X, double* Y, double* Z, int* Success)
+{
+	const FCachedImageTransformer* Transformer = static_cast<FCachedImageTransformer*>(TransformerArg);
+	const double* FromPixel = bDstToSrc ? Transformer->DstGeoTransform : Transformer->SrcGeoTransform;
+	const double* ToPixel = bDstToSrc ? Transformer->SrcInvGeoTransform : Transformer->DstInvGeoTransform;
+
+	// Pixels to georeferenced coordinates
+	for (int i = 0; i < PointCount; i++)
+	{
+		const double PixelX = X[i];
+		X[i] = FromPixel[0] + PixelX * FromPixel[1] + Y[i] * FromPixel[2];
+		Y[i] = FromPixel[3] + PixelX * FromPixel[4] + Y[i] * FromPixel[5];
+		Success[i] = TRUE;
+	}
+
+	if (Transformer->Reprojection &&
+		!GDALReprojectionTransform(Transformer->Reprojection, bDstToSrc, PointCount, X, Y, Z, Success))
+	{
+		return FALSE;
+	}
+
+	// Georeferenced coordinates to pixels
+	for (int i = 0; i < PointCount; i++)
+	{
+		if (Success[i])
+		{
+			const double GeoX = X[i];
+			X[i] = ToPixel[0] + GeoX * ToPixel[1] + Y[i] * ToPixel[2];
+			Y[i] = ToPixel[3] + GeoX * ToPixel[4] + Y[i] * ToPixel[5];
+		}
+	}
+
+	return TRUE;
+}
+
+void FSpatialReferenceCache::Empty()
+{
+	FScopeLock Lock(&CacheLock);
+
+	for (TPair<TTuple<FString, FString>, TArray<void*>>& Pool : FreeReprojections)
+	{
+		for (void* Reprojection : Pool.Value)
+		{
+			GDALDestroyReprojectionTransformer(Reprojection);
+		}
+	}
+
+	FreeReprojections.Empty();
+	EPSGDefinitions.Empty();
+}
+
+void* FSpatialReferenceCache::AcquireReprojection(const FString& SrcWKT, const FString& DstWKT)
+{
+	// Nothing to reproject
+	if (SrcWKT == DstWKT)
+	{
+		return nullptr;
+	}
+
+	{
+		FScopeLock Lock(&CacheLock);
+		if (TArray<void*>* Pool = FreeReprojections.Find(MakeTuple(SrcWKT, DstWKT)))
+		{
+			if (Pool->Num() > 0)
+			{
+				return Pool->Pop(false);
+			}
+		}
+	}
+
+	return GDALCreateReprojectionTransformer(TCHAR_TO_UTF8(*SrcWKT), TCHAR_TO_UTF8(*DstWKT));
+}
+
+void FSpatialReferenceCache::ReleaseReprojection(const FString& SrcWKT, const FString& DstWKT, void* Reprojection)
+{
+	if (Reprojection)
+	{
+		FScopeLock Lock(&CacheLock);
+		FreeReprojections.FindOrAdd(MakeTuple(SrcWKT, DstWKT)).Add(Reprojection);
+	}
+}
@@ -59,6 +59,21 @@ FString FBingMapsAPI::GetFileName(FGeographicCoordinates Coordinates) const
 		+ FString::SanitizeFloat(Coordinates.Longitude);
 }
 
+FString FBingMapsAPI::GetGridFileName(const FIntPoint GridIndex) const
+{
+	return
+		"BingGrid,"
+		+ MapType
+		+ ","
+		+ FString::FromInt(TileResolution)
+		+ ","
+		+ FString::FromInt(ZoomLevel)
+		+ ","
+		+ FString::FromInt(GridIndex.X)
+		+ ","
+		+ FString::FromInt(GridIndex.Y);
+}
+
 FString FBingMapsAPI::GetTileURL(FGeographicCoordinates Coordinates) const
 {
 	return
@@ -0,0 +1,352 @@
+﻿#include "TileAPIs/GeoTIFFTileAPI.h"
+#include "Async/Async.h"
+#include "GeoViewer.h"
+
+FCriticalSection FGeoTIFFTileAPI::SourceFilesLock;
+TMap<FString, FGeoTIFFTileAPI::FSourceFilePtr> FGeoTIFFTileAPI::SourceFiles;
+
+FGeoTIFFTileAPI::FGeoTIFFTileAPI(
+	const TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
+	AWorldReferenceSystem* ReferencingSystem,
+	const FString& InFilePath) :
+	FGeoTileAPI(InEdModeConfig, ReferencingSystem), FilePath(InFilePath)
+{
+}
+
+void FGeoTIFFTileAPI::LoadTile(const FProjectedBounds InTileBounds)
+{
+	TileBounds = InTileBounds;
+
+	Source = OpenSourceFile(FilePath);
+	if (!Source.IsValid() || !TileReferenceSystem)
+	{
+		CreateTileDataset(nullptr);
+		return;
+	}
+
+	// Local files don't need to be downloaded ahead of time
+	if (bPrefetch)
+	{
+		TriggerOnCompleted(nullptr);
+		return;
+	}
+
+	EPSG = Source->EPSG;
+	const FProjectedBounds ProjectedBounds = GetProjectedBounds();
+
+	// Find the pixels covered by the tile at full resolution
+	double InverseTransform[6];
+	if (!GDALInvGeoTransform(Source->GeoTransform, InverseTransform))
+	{
+		CreateTileDataset(nullptr);
+		return;
+	}
+
+	const FVector2D Corners[4] = {
+		FVector2D(ProjectedBounds.TopLeft.X, ProjectedBounds.TopLeft.Y),
+		FVector2D(ProjectedBounds.BottomRight.X, ProjectedBounds.TopLeft.Y),
+		FVector2D(ProjectedBounds.TopLeft.X, ProjectedBounds.BottomRight.Y),
+		FVector2D(ProjectedBounds.BottomRight.X, ProjectedBounds.BottomRight.Y)
+	};
+
+	FBox2D PixelBounds(ForceInit);
+	for (const FVector2D& Corner : Corners)
+	{
+		PixelBounds += FVector2D(
+			InverseTransform[0] + Corner.X * InverseTransform[1] + Corner.Y * InverseTransform[2],
+			InverseTransform[3] + Corner.X * InverseTransform[4] + Corner.Y * InverseTransform[5]
+			);
+	}
+
+	// Keep one pixel outside the tile on each side so resampling at the edges has its neighbours
+	FIntRect Window(
+		FMath::FloorToInt(PixelBounds.Min.X) - 1,
+		FMath::FloorToInt(PixelBounds.Min.Y) - 1,
+		FMath::CeilToInt(PixelBounds.Max.X) + 1,
+		FMath::CeilToInt(PixelBounds.Max.Y) + 1
+		);
+	Window.Clip(FIntRect(FIntPoint::ZeroValue, Source->LevelSizes[0]));
+
+	if (Window.Width() <= 0 || Window.Height() <= 0)
+	{
+		UE_LOG(LogGeoViewer, Warning, TEXT("Tile is outside of %s"), *FilePath);
+		CreateTileDataset(nullptr);
+		return;
+	}
+
+	const int32 Level = SelectLevel(*Source, Window, OutputSize);
+	const FIntRect LevelWindow = GetLevelWindow(*Source, Level, Window);
+	const FString Key = GetWindowKey(Level, LevelWindow);
+
+	// Tiles shown again read the window from memory
+	if (const FDecodedTilePtr CachedTile = FTileMemoryCache::Get().Find(Key))
+	{
+		OnWindowRead(CachedTile);
+		return;
+	}
+
+	Async(EAsyncExecution::ThreadPool,
+		[This = StaticCastSharedRef<FGeoTIFFTileAPI>(AsShared()), Level, LevelWindow, Key]()
+	{
+		const FDecodedTilePtr Tile = ReadWindow(This->Source, Level, LevelWindow, This->CancellationToken);
+		if (Tile.IsValid())
+		{
+			FTileMemoryCache::Get().Add(Key, Tile);
+		}
+
+		AsyncTask(ENamedThreads::GameThread, [This, Tile]()
+		{
+			This->OnWindowRead(Tile);
+		});
+	});
+}
+
+void FGeoTIFFTileAPI::CloseSourceFiles()
+{
+	FScopeLock Lock(&SourceFilesLock);
+	SourceFiles.Empty();
+}
+
+FGeoTIFFTileAPI::FSourceFilePtr FGeoTIFFTileAPI::OpenSourceFile(const FString& Path)
+{
+	if (Path.IsEmpty())
+	{
+		UE_LOG(LogGeoViewer, Warning, TEXT("No GeoTIFF file has been set"));
+		return nullptr;
+	}
+
+	const FString FullPath = FPaths::ConvertRelativePathToFull(Path);
+
+	FScopeLock Lock(&SourceFilesLock);
+	if (const FSourceFilePtr* ExistingFile = SourceFiles.Find(FullPath))
+	{
+		return *ExistingFile;
+	}
+
+	GDALDatasetRef Dataset = GDALDatasetRef((GDALDataset*)GDALOpen(TCHAR_TO_UTF8(*FullPath), GA_ReadOnly));
+	if (!Dataset || Dataset->GetRasterCount() == 0)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("Could not open %s"), *FullPath);
+		return nullptr;
+	}
+
+	const FSourceFilePtr File = MakeShared<FSourceFile, ESPMode::ThreadSafe>();
+	if (Dataset->GetGeoTransform(File->GeoTransform) != CE_None)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("%s is not georeferenced"), *FullPath);
+		return nullptr;
+	}
+
+	// The tile APIs reproject by EPSG code, so find the code matching the CRS of the file
+	File->ProjectionWKT = UTF8_TO_TCHAR(Dataset->GetProjectionRef());
+	OGRSpatialReference SpatialReference(Dataset->GetProjectionRef());
+	if (!SpatialReference.GetAuthorityCode(nullptr))
+	{
+		SpatialReference.AutoIdentifyEPSG();
+	}
+
+	const char* AuthorityName = SpatialReference.GetAuthorityName(nullptr);
+	const char* AuthorityCode = SpatialReference.GetAuthorityCode(nullptr);
+	if (!AuthorityName || !AuthorityCode || !EQUAL(AuthorityName, "EPSG"))
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("The CRS of %s has no EPSG code"), *FullPath);
+		return nullptr;
+	}
+	File->EPSG = FCStringAnsi::Atoi(AuthorityCode);
+
+	GDALRasterBand* Band = Dataset->GetRasterBand(1);
+	int bHasNoData = FALSE;
+	File->NoData = Band->GetNoDataValue(&bHasNoData);
+	File->bHasNoData = bHasNoData != FALSE;
+
+	// Level 0 is the full resolution image, followed by each overview
+	int BlockX, BlockY;
+	Band->GetBlockSize(&BlockX, &BlockY);
+	File->LevelSizes.Add(FIntPoint(Band->GetXSize(), Band->GetYSize()));
+	File->LevelBlockSizes.Add(FIntPoint(BlockX, BlockY));
+
+	for (int Overview = 0; Overview < Band->GetOverviewCount(); Overview++)
+	{
+		GDALRasterBand* OverviewBand = Band->GetOverview(Overview);
+		OverviewBand->GetBlockSize(&BlockX, &BlockY);
+		File->LevelSizes.Add(FIntPoint(OverviewBand->GetXSize(), OverviewBand->GetYSize()));
+		File->LevelBlockSizes.Add(FIntPoint(BlockX, BlockY));
+	}
+
+	UE_LOG(LogGeoViewer, Log, TEXT("Opened %s with %d overviews"), *FullPath, File->LevelSizes.Num() - 1);
+
+	File->Dataset = MoveTemp(Dataset);
+	File->Path = FullPath;
+	File->OverviewDatasets.SetNum(File->LevelSizes.Num() - 1);
+	SourceFiles.Add(FullPath, File);
+	return File;
+}
+
+int32 FGeoTIFFTileAPI::SelectLevel(const FSourceFile& InSource, const FIntRect& Window, const FIntVector2 InOutputSize)
+{
+	if (InOutputSize.X <= 0 || InOutputSize.Y <= 0)
+	{
+		return 0;
+	}
+
+	// How many full resolution pixels make up one output pixel
+	const double TargetFactor = FMath::Min(
+		(double)Window.Width() / InOutputSize.X,
+		(double)Window.Height() / InOutputSize.Y
+		);
+
+	int32 BestLevel = 0;
+	double BestFactor = 1;
+	for (int32 Level = 1; Level < InSource.LevelSizes.Num(); Level++)
+	{
+		const double Factor = (double)InSource.LevelSizes[0].X / InSource.LevelSizes[Level].X;
+		if (Factor <= TargetFactor && Factor > BestFactor)
+		{
+			BestLevel = Level;
+			BestFactor = Factor;
+		}
+	}
+
+	return BestLevel;
+}
+
+FIntRect FGeoTIFFTileAPI::GetLevelWindow(const FSourceFile& InSource, const int32 Level, const FIntRect& Window)
+{
+	const FIntPoint& LevelSize = InSource.LevelSizes[Level];
+	const FIntPoint& BlockSize = InSource.LevelBlockSizes[Level];
+	const double FactorX = (double)InSource.LevelSizes[0].X / LevelSize.X;
+	const double FactorY = (double)InSource.LevelSizes[0].Y / LevelSize.Y;
+
+	// Whole blocks are decoded anyway, so the window is grown to the edges of the blocks it touches
+	FIntRect LevelWindow;
+	LevelWindow.Min.X = FMath::FloorToInt(Window.Min.X / FactorX) / BlockSize.X * BlockSize.X;
+	LevelWindow.Min.Y = FMath::FloorToInt(Window.Min.Y / FactorY) / BlockSize.Y * BlockSize.Y;
+	LevelWindow.Max.X = FMath::DivideAndRoundUp(FMath::CeilToInt(Window.Max.X / FactorX), BlockSize.X) * BlockSize.X;
+	LevelWindow.Max.Y = FMath::DivideAndRoundUp(FMath::CeilToInt(Window.Max.Y / FactorY), BlockSize.Y) * BlockSize.Y;
+	LevelWindow.Clip(FIntRect(FIntPoint::ZeroValue, LevelSize));
+
+	return LevelWindow;
+}
+
+FDecodedTilePtr FGeoTIFFTileAPI::ReadWindow(
+	const FSourceFilePtr& InSource,
+	const int32 Level,
+	const FIntRect& Window,
+	const FTileCancellationTokenRef& Token)
+{
+	FScopeLock Lock(&InSource->ReadLock);
+
+	if (Token->IsCancelled())
+	{
+		return nullptr;
+	}
+
+	// Overviews are opened as datasets so every band of a block is read from one decode
+	GDALDataset* Dataset = InSource->Dataset.Get();
+	if (Level > 0)
+	{
+		GDALDatasetRef& Overview = InSource->OverviewDatasets[Level - 1];
+		if (!Overview)
+		{
+			const FTCHARToUTF8 OverviewLevel(*FString::Printf(TEXT("OVERVIEW_LEVEL=%d"), Level - 1));
+			const char* OpenOptions[] = { OverviewLevel.Get(), nullptr };
+			Overview = GDALDatasetRef((GDALDataset*)GDALOpenEx(
+				TCHAR_TO_UTF8(*InSource->Path), GDAL_OF_RASTER | GDAL_OF_READONLY, nullptr, OpenOptions, nullptr));
+		}
+
+		Dataset = Overview.Get();
+		if (!Dataset || Dataset->GetRasterCount() != InSource->Dataset->GetRasterCount())
+		{
+			return nullptr;
+		}
+	}
+
+	const TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> Tile = MakeShared<FDecodedTile, ESPMode::ThreadSafe>();
+	Tile->XSize = Window.Width();
+	Tile->YSize = Window.Height();
+	Tile->Bands = Dataset->GetRasterCount();
+	Tile->DataType = Dataset->GetRasterBand(1)->GetRasterDataType();
+	Tile->ProjectionWKT = InSource->ProjectionWKT;
+
+	const int ValueSize = GDALGetDataTypeSizeBytes(Tile->DataType);
+	const int32 PixelBytes = Tile->Bands * ValueSize;
+	Tile->Pixels.SetNumUninitialized(Tile->XSize * Tile->YSize * PixelBytes);
+
+	// Every band is read in one call so each block is only decoded once
+	const CPLErr Error = Dataset->RasterIO(
+		GF_Read,
+		Window.Min.X, Window.Min.Y,
+		Tile->XSize, Tile->YSize,
+		Tile->Pixels.GetData(),
+		Tile->XSize, Tile->YSize,
+		Tile->DataType,
+		Tile->Bands,
+		nullptr,
+		PixelBytes,
+		(GSpacing)Tile->XSize * PixelBytes,
+		ValueSize
+		);
+
+	if (Error != CE_None || Token->IsCancelled())
+	{
+		return nullptr;
+	}
+
+	// Pixels of an overview cover several pixels of the full resolution image
+	const double* Transform = InSource->GeoTransform;
+	const double FactorX = (double)InSource->LevelSizes[0].X / InSource->LevelSizes[Level].X;
+	const double FactorY = (double)InSource->LevelSizes[0].Y / InSource->LevelSizes[Level].Y;
+	const double Column = Window.Min.X * FactorX;
+	const double Row = Window.Min.Y * FactorY;
+
+	Tile->GeoTransform[0] = Transform[0] + Column * Transform[1] + Row * Transform[2];
+	Tile->GeoTransform[1] = Transform[1] * FactorX;
+	Tile->GeoTransform[2] = Transform[2] * FactorY;
+	Tile->GeoTransform[3] = Transform[3] + Column * Transform[4] + Row * Transform[5];
+	Tile->GeoTransform[4] = Transform[4] * FactorX;
+	Tile->GeoTransform[5] = Transform[5] * FactorY;
+
+	return Tile;
+}
+
+void FGeoTIFFTileAPI::OnWindowRead(const FDecodedTilePtr& Tile)
+{
+	if (CancellationToken->IsCancelled())
+	{
+		return;
+	}
+
+	GDALDataset* Dataset = OpenDecodedTile(Tile);
+	if (!Dataset)
+	{
+		CreateTileDataset(nullptr);
+		return;
+	}
+
+	if (Source->bHasNoData)
+	{
+		for (int Band = 1; Band <= Dataset->GetRasterCount(); Band++)
+		{
+			Dataset->GetRasterBand(Band)->SetNoDataValue(Source->NoData);
+		}
+	}
+
+	// Imagery without alpha gets one the same way as downloaded segments
+	bAddAlphaOnMerge = Tile->Bands == 3;
+	DatasetsToMerge.Add(Dataset);
+
+	CreateTileDataset(MergeDatasets());
+}
+
+FString FGeoTIFFTileAPI::GetWindowKey(const int32 Level, const FIntRect& Window) const
+{
+	return FString::Printf(
+		TEXT("GeoTIFF_%08x_%d_%d_%d_%d_%d"),
+		FCrc::StrCrc32(*FPaths::ConvertRelativePathToFull(FilePath)),
+		Level,
+		Window.Min.X,
+		Window.Min.Y,
+		Window.Width(),
+		Window.Height()
+		);
+}
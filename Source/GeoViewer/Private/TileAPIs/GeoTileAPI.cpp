@@ -1,5 +1,7 @@
 ﻿#include "TileAPIS/GeoTileAPI.h"
 #include "GDALWarp.h"
+#include "TileCache.h"
+#include "Async/Async.h"
 #include "Interfaces/IPluginManager.h"
 
 /////////////////////////////////////////////////////
@@ -112,7 +114,7 @@ FGeoBounds FProjectedBounds::ConvertToGeoBounds(AGeoViewerReferenceSystem* Refer
 FGeoTileAPI::FGeoTileAPI(
 	TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
 	AWorldReferenceSystem* ReferencingSystem
-	)
+	) : CancellationToken(MakeShared<FTileCancellationToken, ESPMode::ThreadSafe>())
 {
 	EdModeConfigPtr = InEdModeConfig;
 	TileReferenceSystem = ReferencingSystem;
@@ -120,11 +122,17 @@ FGeoTileAPI::FGeoTileAPI(
 
 FGeoTileAPI::~FGeoTileAPI()
 {
+	// Downloads shared with other tiles no longer wait on this one
+	CancellationToken->Cancel();
+
 	EmptyDatasetsToMerge();
 	CachedDatasets.Empty();
 
 	// Delete any vrt datasets stored in memory
 	FGDALWarp::DeleteVRTDatasets(CachedDatasetPaths);
+
+	// Only release the decoded segments once nothing is reading from them
+	PinnedTiles.Empty();
 }
 
 FString FGeoTileAPI::GetCacheFolderPath()
@@ -133,18 +141,105 @@ FString FGeoTileAPI::GetCacheFolderPath()
 	return PluginManager->GetBaseDir() + TEXT("/Resources/CachedTiles/");
 }
 
+void FGeoTileAPI::Cancel()
+{
+	CancellationToken->Cancel();
+	EmptyDatasetsToMerge();
+}
+
 void FGeoTileAPI::TriggerOnCompleted(GDALDataset* Dataset) const
 {
+	// Whatever cancelled the tile no longer expects a result
+	if (CancellationToken->IsCancelled())
+	{
+		if (Dataset)
+		{
+			GDALClose(Dataset);
+		}
+		return;
+	}
+
 	OnComplete.ExecuteIfBound(Dataset);
 }
 
-GDALDataset* FGeoTileAPI::WarpDataset(int CachedDatasetIdx)
+void FGeoTileAPI::TriggerOnPreview(GDALDataset* Dataset) const
 {
+	if (!Dataset)
+	{
+		return;
+	}
+
+	if (CancellationToken->IsCancelled() || !OnPreview.IsBound())
+	{
+		GDALClose(Dataset);
+		return;
+	}
+
+	OnPreview.Execute(Dataset);
+}
+
+FIntVector2 FGeoTileAPI::GetPreviewSize(const FProjectedBounds& Bounds)
+{
+	const double Width = FMath::Abs(Bounds.BottomRight.X - Bounds.TopLeft.X);
+	const double Height = FMath::Abs(Bounds.TopLeft.Y - Bounds.BottomRight.Y);
+	if (Width <= 0 || Height <= 0)
+	{
+		return FIntVector2(PreviewResolution, PreviewResolution);
+	}
+
+	const double Scale = PreviewResolution / FMath::Max(Width, Height);
+	return FIntVector2(
+		FMath::Max(1, FMath::RoundToInt(Width * Scale)),
+		FMath::Max(1, FMath::RoundToInt(Height * Scale))
+		);
+}
+
+void FGeoTileAPI::CreateTileDataset(GDALDataset* MergedDataset)
+{
+	if (!MergedDataset)
+	{
+		TriggerOnCompleted(nullptr);
+		return;
+	}
+
+	// Kept open until this object is destroyed as the merged dataset reads from the segments
+	CachedDatasets.Add(GDALDatasetRef(MergedDataset));
+
 	const FString CurrentCRS = AGeoViewerReferenceSystem::EPSGToString(EPSG);
 	const FString FinalCRS = TileReferenceSystem->ProjectedCRS;
-	GDALDatasetRef WarpedDataset =
-		FGDALWarp::WarpDataset(CachedDatasets[CachedDatasetIdx], CurrentCRS, FinalCRS);
-	return WarpedDataset.Release();
+	const bool bCreatePreview = OnPreview.IsBound();
+
+	// Holding a reference keeps the segments alive until the warp is done
+	Async(EAsyncExecution::ThreadPool,
+		[This = AsShared(), MergedDataset, CurrentCRS, FinalCRS, Bounds = TileBounds, Size = OutputSize,
+		 Algorithm = OutputAlgorithm, Token = CancellationToken, bCreatePreview]() mutable
+	{
+		// A small nearest neighbour warp is quick enough to show something while the full quality tile is made
+		if (bCreatePreview && !Token->IsCancelled())
+		{
+			GDALDataset* PreviewDataset = FGDALWarp::WarpToBounds(MergedDataset, CurrentCRS, FinalCRS,
+				Bounds.TopLeft, Bounds.BottomRight, GetPreviewSize(Bounds), ESamplingAlgorithm::Nearest,
+				&Token.Get()).Release();
+
+			AsyncTask(ENamedThreads::GameThread, [This, PreviewDataset]()
+			{
+				This->TriggerOnPreview(PreviewDataset);
+			});
+		}
+
+		GDALDataset* TileDataset = nullptr;
+		if (!Token->IsCancelled())
+		{
+			TileDataset = FGDALWarp::WarpToBounds(MergedDataset, CurrentCRS, FinalCRS,
+				Bounds.TopLeft, Bounds.BottomRight, Size, Algorithm, &Token.Get()).Release();
+		}
+
+		// Moved so the tile is always released on the game thread
+		AsyncTask(ENamedThreads::GameThread, [This = MoveTemp(This), TileDataset]()
+		{
+			This->TriggerOnCompleted(TileDataset);
+		});
+	});
 }
 
 GDALDataset* FGeoTileAPI::MergeDatasets()
@@ -154,7 +249,7 @@ GDALDataset* FGeoTileAPI::MergeDatasets()
 		return nullptr;
 	}
 	
-	GDALDataset* MergedDataset = FGDALWarp::MergeDatasets(DatasetsToMerge).Release();
+	GDALDataset* MergedDataset = FGDALWarp::MergeDatasets(DatasetsToMerge, bAddAlphaOnMerge).Release();
 
 	EmptyDatasetsToMerge();
 	
@@ -177,6 +272,58 @@ void FGeoTileAPI::EmptyDatasetsToMerge()
 	DatasetsToMerge.Empty();
 }
 
+GDALDataset* FGeoTileAPI::OpenCachedTile(const FString& Key)
+{
+	return OpenDecodedTile(FindCachedTile(Key));
+}
+
+FDecodedTilePtr FGeoTileAPI::FindCachedTile(const FString& Key)
+{
+	FTileMemoryCache& MemoryCache = FTileMemoryCache::Get();
+	FDecodedTilePtr Tile = MemoryCache.Find(Key);
+
+	if (!Tile.IsValid())
+	{
+		// Decode the tile from disk once so other tiles using the segment can read it from memory
+		FString MemoryFilePath;
+		GDALDataset* CachedDataset = FTileCache::Get().OpenTile(Key, MemoryFilePath);
+		Tile = FDecodedTile::CreateFromDataset(CachedDataset);
+
+		if (CachedDataset)
+		{
+			GDALClose(CachedDataset);
+		}
+		if (!MemoryFilePath.IsEmpty())
+		{
+			VSIUnlink(TCHAR_TO_UTF8(*MemoryFilePath));
+		}
+
+		if (!Tile.IsValid())
+		{
+			return nullptr;
+		}
+		MemoryCache.Add(Key, Tile);
+	}
+
+	return Tile;
+}
+
+GDALDataset* FGeoTileAPI::OpenDecodedTile(const FDecodedTilePtr& Tile)
+{
+	if (!Tile.IsValid())
+	{
+		return nullptr;
+	}
+
+	GDALDataset* Dataset = Tile->CreateDataset();
+	if (Dataset)
+	{
+		PinnedTiles.Add(Tile);
+	}
+
+	return Dataset;
+}
+
 FProjectedBounds FGeoTileAPI::GetProjectedBounds() const
 {
 	// Calculate all four corners of the tile.
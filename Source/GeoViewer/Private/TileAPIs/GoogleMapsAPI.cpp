@@ -32,6 +32,21 @@ FString FGoogleMapsAPI::GetFileName(FGeographicCoordinates Coordinates) const
 	+ FString::SanitizeFloat(Coordinates.Longitude);
 }
 
+FString FGoogleMapsAPI::GetGridFileName(const FIntPoint GridIndex) const
+{
+	return
+	"GoogleGrid,"
+	+ MapType
+	+ ","
+	+ FString::FromInt(TileResolution)
+	+ ","
+	+ FString::FromInt(ZoomLevel)
+	+ ","
+	+ FString::FromInt(GridIndex.X)
+	+ ","
+	+ FString::FromInt(GridIndex.Y);
+}
+
 FString FGoogleMapsAPI::GetTileURL(FGeographicCoordinates Coordinates) const
 {
 	FString TileResolutionStr = FString::FromInt(TileResolution);
@@ -0,0 +1,86 @@
+﻿#include "TileAPIs/HGTIndex.h"
+#include "GeoViewer.h"
+#include "HAL/FileManager.h"
+#include "Interfaces/IPluginManager.h"
+
+FHGTIndex::FHGTIndex()
+{
+}
+
+FHGTIndex& FHGTIndex::Get()
+{
+	static FHGTIndex Index;
+	return Index;
+}
+
+void FHGTIndex::Refresh()
+{
+	Cells.Empty();
+
+	const FString TerrainFolder = GetTerrainFolder();
+	TArray<FString> FileNames;
+	IFileManager::Get().FindFiles(FileNames, *TerrainFolder, TEXT("*"));
+
+	for (const FString& FileName : FileNames)
+	{
+		FIntPoint Cell;
+		if (ParseCellName(FileName, Cell))
+		{
+			FHGTCell& Entry = Cells.Add(Cell);
+			Entry.Path = FPaths::ConvertRelativePathToFull(TerrainFolder / FileName);
+			Entry.bZipped = FileName.EndsWith(TEXT(".zip"), ESearchCase::IgnoreCase);
+		}
+	}
+
+	UE_LOG(LogGeoViewer, Log, TEXT("Found %d HGT files in %s"), Cells.Num(), *TerrainFolder);
+}
+
+const FHGTCell* FHGTIndex::Find(const FIntPoint Cell) const
+{
+	return Cells.Find(Cell);
+}
+
+FString FHGTIndex::GetCellName(const FIntPoint Cell)
+{
+	return FString::Printf(
+		TEXT("%c%02d%c%03d.hgt"),
+		Cell.Y >= 0 ? TEXT('N') : TEXT('S'),
+		FMath::Abs(Cell.Y),
+		Cell.X >= 0 ? TEXT('E') : TEXT('W'),
+		FMath::Abs(Cell.X)
+		);
+}
+
+FString FHGTIndex::GetTerrainFolder()
+{
+	const TSharedPtr<IPlugin> PluginManager = IPluginManager::Get().FindPlugin(TEXT("GeoViewer"));
+	return PluginManager->GetBaseDir() + TEXT("/Resources/Terrain/HGT/");
+}
+
+bool FHGTIndex::ParseCellName(const FString& FileName, FIntPoint& OutCell)
+{
+	// e.g. N00W000.hgt or N00W000.hgt.zip
+	FString Name = FileName.ToUpper();
+	Name.RemoveFromEnd(TEXT(".ZIP"));
+	if (Name.Len() != 11 || !Name.EndsWith(TEXT(".HGT")))
+	{
+		return false;
+	}
+
+	const TCHAR NorthSouth = Name[0];
+	const TCHAR EastWest = Name[3];
+	const FString Latitude = Name.Mid(1, 2);
+	const FString Longitude = Name.Mid(4, 3);
+
+	if ((NorthSouth != TEXT('N') && NorthSouth != TEXT('S'))
+		|| (EastWest != TEXT('E') && EastWest != TEXT('W'))
+		|| !Latitude.IsNumeric()
+		|| !Longitude.IsNumeric())
+	{
+		return false;
+	}
+
+	OutCell.X = FCString::Atoi(*Longitude) * (EastWest == TEXT('E') ? 1 : -1);
+	OutCell.Y = FCString::Atoi(*Latitude) * (NorthSouth == TEXT('N') ? 1 : -1);
+	return true;
+}
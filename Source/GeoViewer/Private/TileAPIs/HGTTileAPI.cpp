@@ -1,9 +1,15 @@
 ﻿#include "TileAPIs/HGTTileAPI.h"
-#include "GDALWarp.h"
-#include "Interfaces/IPluginManager.h"
+#include "TileAPIs/HGTIndex.h"
+#include "Async/MappedFileHandle.h"
+#include "GeoViewer.h"
+#include "Math/VectorRegister.h"
+#include "SpatialReferenceCache.h"
 
 #define LOCTEXT_NAMESPACE "GeoViewerHGTTile"
 
+/** Value HGT files use for samples without any data */
+static constexpr int16 HGTNoData = -32768;
+
 FHGTTileAPI::FHGTTileAPI(
 	const TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
 	AWorldReferenceSystem* ReferencingSystem) :
@@ -16,119 +22,259 @@ void FHGTTileAPI::LoadTile(FProjectedBounds InTileBounds)
 {
 	TileBounds = InTileBounds;
 
+	// X is degrees east and Y is degrees north
 	const FProjectedBounds ProjectedBounds = GetProjectedBounds();
-	FGeoBounds Bounds;
-	Bounds.TopLeft = ProjectedBounds.TopLeft;
-	Bounds.BottomRight = ProjectedBounds.BottomRight;
-	
-	FGeographicCoordinates CurrentPosition = Bounds.TopLeft;
-	CurrentPosition.Longitude = Bounds.BottomRight.Longitude;
+	const FVector2D MinCorner(ProjectedBounds.TopLeft.X, ProjectedBounds.BottomRight.Y);
+	const FVector2D MaxCorner(ProjectedBounds.BottomRight.X, ProjectedBounds.TopLeft.Y);
 
-	// Load all terrain files that are needed to cover the bounds
-	while (CurrentPosition.Longitude < Bounds.TopLeft.Longitude)
+	// Find the cells needed to cover the bounds
+	TArray<FIntPoint> CellIndices;
+	for (int Y = FMath::FloorToInt(MinCorner.Y); Y < MaxCorner.Y; Y++)
 	{
-		while (CurrentPosition.Latitude < Bounds.BottomRight.Latitude)
+		for (int X = FMath::FloorToInt(MinCorner.X); X < MaxCorner.X; X++)
 		{
-			OpenDataset(CurrentPosition);
+			CellIndices.Add(FIntPoint(X, Y));
+		}
+	}
 
-			// Increase Longitude by 1 degree
-			CurrentPosition.Latitude = FMath::Floor(CurrentPosition.Latitude) + 1;
+	FHGTIndex& Index = FHGTIndex::Get();
+	const auto FindMissingCells = [&Index, &CellIndices]()
+	{
+		TArray<FString> Missing;
+		for (const FIntPoint& CellIndex : CellIndices)
+		{
+			if (!Index.Find(CellIndex))
+			{
+				Missing.Add(FHGTIndex::GetCellName(CellIndex));
+			}
 		}
+		return Missing;
+	};
+
+	TArray<FString> MissingCells = FindMissingCells();
+	if (MissingCells.Num() > 0)
+	{
+		// Files may have been added since the folder was last scanned
+		Index.Refresh();
+		MissingCells = FindMissingCells();
+	}
 
-		// Decrease the latitude by 1 degree
-		CurrentPosition.Longitude = FMath::Floor(CurrentPosition.Longitude) + 1;
+	// Report every missing file at once instead of asking for each one
+	if (MissingCells.Num() > 0)
+	{
+		const FText ErrorMsg = FText::Format(
+			LOCTEXT("MissingHGTFiles", "Cannot find these files in {0}:\n{1}\n\nContinue without them?"),
+			FText::FromString(FHGTIndex::GetTerrainFolder()),
+			FText::FromString(FString::Join(MissingCells, TEXT("\n")))
+			);
 
-		// Set the X coordinate back to the left
-		CurrentPosition.Latitude = Bounds.TopLeft.Latitude;
+		if (FMessageDialog::Open(EAppMsgType::YesNo, ErrorMsg) != EAppReturnType::Yes)
+		{
+			CreateTileDataset(nullptr);
+			return;
+		}
+	}
+
+	for (const FIntPoint& CellIndex : CellIndices)
+	{
+		if (const FHGTCell* Cell = Index.Find(CellIndex))
+		{
+			if (!ReadCell(CellIndex, *Cell, MinCorner, MaxCorner))
+			{
+				UE_LOG(LogGeoViewer, Warning, TEXT("Could not read HGT file %s"), *Cell->Path);
+			}
+		}
 	}
 	
-	GDALDataset* MergedDataset = MergeDatasets();
-	if (!MergedDataset) TriggerOnCompleted(nullptr);
-	
-	const int MergedDatasetIdx = CachedDatasets.Add(GDALDatasetRef(MergedDataset));
-	GDALDataset* WarpedDataset = WarpDataset(MergedDatasetIdx);
-	const int WarpedDatasetIdx = CachedDatasets.Add(GDALDatasetRef(WarpedDataset));
-	
-	FString CroppedDatasetPath;
-	GDALDataset* CroppedDataset = FGDALWarp::CropDataset(
-		CachedDatasets[WarpedDatasetIdx].Get(),
-		TileBounds.TopLeft,
-		TileBounds.BottomRight,
-		CroppedDatasetPath
-		).Release();
-	CachedDatasetPaths.Add(CroppedDatasetPath);
-	
-	TriggerOnCompleted(CroppedDataset);
+	CreateTileDataset(MergeDatasets());
 }
 
-int FHGTTileAPI::OpenDataset(const FGeographicCoordinates PositionWithinTile)
+bool FHGTTileAPI::ReadCell(const FIntPoint CellIndex, const FHGTCell& Cell, const FVector2D& MinCorner, const FVector2D& MaxCorner)
 {
-	const FString TerrainFolder = GetTerrainFolder();
-	const FString TileFileName = TerrainFolder + GetFileName(PositionWithinTile);
-	if (FPaths::FileExists(TileFileName))
+	const int32 Samples = GetSampleCount(Cell);
+	if (Samples <= 1)
+	{
+		return false;
+	}
+
+	// Samples are on the edges of the cell so neighbouring cells share a row and column
+	const double PixelSize = 1.0 / (Samples - 1);
+	const double North = CellIndex.Y + 1;
+
+	// Keep one sample outside the tile on each side so resampling at the edges has its neighbours
+	FIntRect Window;
+	Window.Min.X = FMath::FloorToInt((MinCorner.X - CellIndex.X) / PixelSize) - 1;
+	Window.Max.X = FMath::CeilToInt((MaxCorner.X - CellIndex.X) / PixelSize) + 2;
+	Window.Min.Y = FMath::FloorToInt((North - MaxCorner.Y) / PixelSize) - 1;
+	Window.Max.Y = FMath::CeilToInt((North - MinCorner.Y) / PixelSize) + 2;
+	Window.Clip(FIntRect(0, 0, Samples, Samples));
+
+	if (Window.Width() <= 0 || Window.Height() <= 0)
 	{
-		GDALDataset* Dataset = (GDALDataset*)GDALOpen(TCHAR_TO_UTF8(*TileFileName), GA_ReadOnly);
-		return DatasetsToMerge.Add(Dataset);
+		return false;
 	}
 
-	const FText ErrorMsg = FText::Format(LOCTEXT("MissingHGTFile", "Cannot find: {0}"), FText::FromString(TileFileName));
-	const EAppReturnType::Type Response = FMessageDialog::Open(EAppMsgType::CancelRetryContinue, ErrorMsg);
+	const TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> Tile = MakeShared<FDecodedTile, ESPMode::ThreadSafe>();
+	Tile->XSize = Window.Width();
+	Tile->YSize = Window.Height();
+	Tile->Bands = 1;
+	Tile->DataType = GDT_Int16;
+	Tile->Pixels.SetNumUninitialized(Tile->XSize * Tile->YSize * sizeof(int16));
+	Tile->ProjectionWKT = FSpatialReferenceCache::Get().GetWKT(EPSG);
 
-	if (Response == EAppReturnType::Retry)
+	// The geotransform describes the corner of the first pixel, not its centre
+	Tile->GeoTransform[0] = CellIndex.X + Window.Min.X * PixelSize - PixelSize / 2;
+	Tile->GeoTransform[1] = PixelSize;
+	Tile->GeoTransform[2] = 0;
+	Tile->GeoTransform[3] = North - Window.Min.Y * PixelSize + PixelSize / 2;
+	Tile->GeoTransform[4] = 0;
+	Tile->GeoTransform[5] = -PixelSize;
+
+	if (!ReadWindow(Cell, Samples, Window, reinterpret_cast<int16*>(Tile->Pixels.GetData())))
 	{
-		return OpenDataset(PositionWithinTile);
+		return false;
 	}
 
-	return -1;
+	GDALDataset* Dataset = OpenDecodedTile(Tile);
+	if (!Dataset)
+	{
+		return false;
+	}
+
+	Dataset->GetRasterBand(1)->SetNoDataValue(HGTNoData);
+	DatasetsToMerge.Add(Dataset);
+	return true;
 }
 
-FString FHGTTileAPI::GetFileName(const FGeographicCoordinates Coordinates) const
+bool FHGTTileAPI::ReadWindow(const FHGTCell& Cell, const int32 Samples, const FIntRect& Window, int16* OutHeights)
 {
-	const int LatitudeInt = FMath::Floor(Coordinates.Latitude);
-	const int LongitudeInt = FMath::Floor(Coordinates.Longitude);
+	const int64 RowBytes = (int64)Samples * sizeof(int16);
+	const int32 Width = Window.Width();
+	const int32 Height = Window.Height();
 
-	FString FileName = "";
+	// Plain files are mapped so only the pages of the rows in the window are read
+	if (!Cell.bZipped)
+	{
+		IMappedFileHandle* MappedFile = FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Cell.Path);
+		if (MappedFile)
+		{
+			IMappedFileRegion* Region = MappedFile->MapRegion(Window.Min.Y * RowBytes, Height * RowBytes);
+			if (Region)
+			{
+				const uint8* Rows = Region->GetMappedPtr();
+				for (int32 Row = 0; Row < Height; Row++)
+				{
+					SwapInt16(
+						Rows + Row * RowBytes + Window.Min.X * sizeof(int16),
+						reinterpret_cast<uint8*>(OutHeights + Row * Width),
+						Width
+						);
+				}
+				delete Region;
+			}
+			delete MappedFile;
 
-	if (LongitudeInt >= 0)
+			if (Region)
+			{
+				return true;
+			}
+		}
+	}
+
+	// Zipped files, or platforms that can't map files, are read a row at a time
+	VSILFILE* File = VSIFOpenL(TCHAR_TO_UTF8(*GetReadPath(Cell)), "rb");
+	if (!File)
 	{
-		FileName += "N";
-	} else
+		return false;
+	}
+
+	bool bSucceeded = true;
+	for (int32 Row = 0; Row < Height && bSucceeded; Row++)
 	{
-		FileName += "S";
+		uint8* RowData = reinterpret_cast<uint8*>(OutHeights + Row * Width);
+		const vsi_l_offset Offset = (Window.Min.Y + Row) * RowBytes + Window.Min.X * sizeof(int16);
+
+		bSucceeded = VSIFSeekL(File, Offset, SEEK_SET) == 0
+			&& VSIFReadL(RowData, sizeof(int16), Width, File) == (size_t)Width;
+
+		SwapInt16(RowData, RowData, Width);
 	}
 
-	FileName += ConvertIntToString(FMath::Abs(LongitudeInt), 2);
+	VSIFCloseL(File);
+	return bSucceeded;
+}
 
-	if (LatitudeInt > 0)
-	{
-		FileName += "E";
-	} else
+int32 FHGTTileAPI::GetSampleCount(const FHGTCell& Cell)
+{
+	VSIStatBufL Stat;
+	if (VSIStatL(TCHAR_TO_UTF8(*GetReadPath(Cell)), &Stat) != 0)
 	{
-		FileName += "W";
+		return 0;
 	}
 
-	FileName += ConvertIntToString(FMath::Abs(LatitudeInt), 3);
-	FileName += ".hgt";
-
-	return FileName;
+	const int64 NumSamples = Stat.st_size / sizeof(int16);
+	const int32 Samples = FMath::RoundToInt(FMath::Sqrt((double)NumSamples));
+	return (int64)Samples * Samples == NumSamples ? Samples : 0;
 }
 
-FString FHGTTileAPI::GetTerrainFolder()
+FString FHGTTileAPI::GetReadPath(const FHGTCell& Cell)
 {
-	const TSharedPtr<IPlugin> PluginManager = IPluginManager::Get().FindPlugin(TEXT("GeoViewer"));
-	return PluginManager->GetBaseDir() + TEXT("/Resources/Terrain/HGT/");
+	if (!Cell.bZipped)
+	{
+		return Cell.Path;
+	}
+
+	// The .hgt inside the archive usually has the same name but look for it in case it was renamed
+	const FString ArchivePath = TEXT("/vsizip/") + Cell.Path;
+	FString InnerName = FPaths::GetBaseFilename(Cell.Path);
+
+	if (char** Files = VSIReadDir(TCHAR_TO_UTF8(*ArchivePath)))
+	{
+		for (char** File = Files; *File; File++)
+		{
+			const FString Name = UTF8_TO_TCHAR(*File);
+			if (Name.EndsWith(TEXT(".hgt"), ESearchCase::IgnoreCase))
+			{
+				InnerName = Name;
+				break;
+			}
+		}
+		CSLDestroy(Files);
+	}
+
+	return ArchivePath / InnerName;
 }
 
-FString FHGTTileAPI::ConvertIntToString(const int Number, const int NumOfDigits)
+void FHGTTileAPI::SwapInt16(const uint8* Source, uint8* Dest, const int32 Num)
 {
-	FString NumberString = FString::FromInt(Number);
+#if PLATFORM_LITTLE_ENDIAN
+	// Swap eight values at a time by moving the bytes of each half of the 32 bit lanes
+	const VectorRegister4Int LowMask = VectorIntSet1(0x00FF00FF);
 
-	for (int i = NumberString.Len(); i < NumOfDigits; i++)
+	int32 Index = 0;
+	for (; Index + 8 <= Num; Index += 8)
 	{
-		NumberString = "0" + NumberString;
+		const VectorRegister4Int Values = VectorIntLoad(Source + Index * 2);
+		const VectorRegister4Int Swapped = VectorIntOr(
+			VectorShiftLeftImm(VectorIntAnd(Values, LowMask), 8),
+			VectorIntAnd(VectorShiftRightImmLogical(Values, 8), LowMask)
+			);
+		VectorIntStore(Swapped, Dest + Index * 2);
 	}
 
-	return NumberString;
+	for (; Index < Num; Index++)
+	{
+		const uint8 High = Source[Index * 2];
+		Dest[Index * 2] = Source[Index * 2 + 1];
+		Dest[Index * 2 + 1] = High;
+	}
+#else
+	// HGT files are already big endian
+	if (Source != Dest)
+	{
+		FMemory::Memcpy(Dest, Source, Num * sizeof(int16));
+	}
+#endif
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -1,221 +1,306 @@
 ﻿#include "TileAPIs/MapBoxTerrain.h"
 
-#include "GDALWarp.h"
+#include "Math/VectorRegister.h"
+#include "Async/Async.h"
+#include "GeoViewer.h"
 #include "GeoViewerSettings.h"
-#include "TileDownloader.h"
+#include "TileCache.h"
+
+// pshufb is SSSE3, which every x64 CPU UE5 supports has
+#if PLATFORM_ENABLE_VECTORINTRINSICS && !PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+#include <tmmintrin.h>
+#endif
+
+/** Prefix of the keys the decoded heights are cached with */
+static const TCHAR* HeightKeyPrefix = TEXT("MapboxHeights");
+
+/**
+ * Loads four RGB pixels into the lanes of a register as little endian RGBA with an empty alpha.
+ * Reads 16 bytes, 4 more than the pixels use.
+ */
+#if PLATFORM_ENABLE_VECTORINTRINSICS && !PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+static FORCEINLINE VectorRegister4Int LoadRGBPixels(const uint8* Pixels)
+{
+	return _mm_shuffle_epi8(
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(Pixels)),
+		_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+}
+#define MAPBOX_HAS_RGB_LOAD 1
+#elif PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+static FORCEINLINE VectorRegister4Int LoadRGBPixels(const uint8* Pixels)
+{
+	// Indices out of range are filled with zero
+	static const uint8 Indices[16] = { 0, 1, 2, 0xFF, 3, 4, 5, 0xFF, 6, 7, 8, 0xFF, 9, 10, 11, 0xFF };
+	return vreinterpretq_s32_u8(vqtbl1q_u8(vld1q_u8(Pixels), vld1q_u8(Indices)));
+}
+#define MAPBOX_HAS_RGB_LOAD 1
+#else
+#define MAPBOX_HAS_RGB_LOAD 0
+#endif
+
+/** Width of the @2x Terrain-RGB tiles in pixels */
+static constexpr int MapboxTileResolution = 512;
+
+/** Highest zoom level the Terrain-RGB tile set has data for */
+static constexpr int MapboxMaxZoomLevel = 15;
 
 FMapBoxTerrain::FMapBoxTerrain(TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
-                               AWorldReferenceSystem* ReferencingSystem) : FWebMapTileAPI(InEdModeConfig, ReferencingSystem)
+                               AWorldReferenceSystem* ReferencingSystem) : FXYZTileAPI(InEdModeConfig, ReferencingSystem)
 {
 	UGeoViewerSettings* Settings = GetMutableDefault<UGeoViewerSettings>();
 
+	FString APIKey;
 	if (Settings)
 	{
 		APIKey = Settings->MapboxAPIKey;
 	}
 
-	TileResolution = 256;
+	URLTemplate = "https://api.mapbox.com/v4/mapbox.terrain-rgb/{z}/{x}/{y}@2.png?access_token=" + APIKey;
+	KeyPrefix = "MapboxTerrain";
+	ProviderName = TEXT("Mapbox");
 	ZoomLevel = 14;
-}
 
-FMapBoxTerrain::~FMapBoxTerrain()
-{
-	GDALDriver* Driver = (GDALDriver*)GDALGetDriverByName("GTiff");
+	// Heights are encoded in the RGB values so must be cached without any loss
+	CacheEncoding = ETileCacheEncoding::Deflate;
 
-	for (FString DatasetPath : GTiffPaths)
-	{
-		Driver->Delete(TCHAR_TO_UTF8(*DatasetPath));
-	}
+	// Segments are converted to a single height band before being merged
+	bAddAlphaOnMerge = false;
 }
 
 void FMapBoxTerrain::LoadTile(const FProjectedBounds InTileBounds)
 {
-	TileBounds = InTileBounds;
+	// The zoom is part of the segment keys so must be chosen before anything is looked up
+	ZoomLevel = GetZoomForOutputSize(InTileBounds);
+
+	FXYZTileAPI::LoadTile(InTileBounds);
+}
 
-	if (TileReferenceSystem)
+int FMapBoxTerrain::GetZoomForOutputSize(const FProjectedBounds& InTileBounds) const
+{
+	if (!TileReferenceSystem || OutputSize.X <= 0 || OutputSize.Y <= 0)
 	{
-		// Find the bounds in XY coordinates used by Mapbox
-		const FGeoBounds GeoBounds = InTileBounds.ConvertToGeoBounds(TileReferenceSystem);
-		FVector2D TopLeft = GetSlippyMapCoordinates(GeoBounds.BottomRight);
-		FVector2D BottomRight = GetSlippyMapCoordinates(GeoBounds.TopLeft);
+		return ZoomLevel;
+	}
 
-		// Make sure both corners are the correct way round
-		if (TopLeft.X > BottomRight.X)
-		{
-			float Temp = TopLeft.X;
-			TopLeft.X = BottomRight.X;
-			BottomRight.X = Temp;
-		}
+	// Distance between the output pixels in meters, the finer axis decides the zoom
+	const double SpacingX = FMath::Abs(InTileBounds.BottomRight.X - InTileBounds.TopLeft.X) / OutputSize.X;
+	const double SpacingY = FMath::Abs(InTileBounds.TopLeft.Y - InTileBounds.BottomRight.Y) / OutputSize.Y;
+	const double TargetSpacing = FMath::Min(SpacingX, SpacingY);
+	if (TargetSpacing <= 0)
+	{
+		return ZoomLevel;
+	}
 
-		if (TopLeft.Y > BottomRight.Y)
-		{
-			float Temp = TopLeft.Y;
-			TopLeft.Y = BottomRight.Y;
-			BottomRight.Y = Temp;
-		}
-		
-		FVector2D CurrentPosition = TopLeft;
+	// Web Mercator pixels shrink on the ground by the cosine of the latitude
+	FGeographicCoordinates Center;
+	TileReferenceSystem->ProjectedToGeographic((InTileBounds.TopLeft + InTileBounds.BottomRight) / 2, Center);
+	const double GroundScale = FMath::Cos(FMath::DegreesToRadians(Center.Latitude));
 
-		while (CurrentPosition.Y <= BottomRight.Y)
+	int Zoom = 0;
+	for (; Zoom < MapboxMaxZoomLevel; Zoom++)
+	{
+		const double GroundResolution =
+			2 * WebMercatorHalfSize / (MapboxTileResolution * FMath::Pow(2.0, Zoom)) * GroundScale;
+		if (GroundResolution <= TargetSpacing)
 		{
-			while (CurrentPosition.X <= BottomRight.X)
-			{
-				// Get URL and filename
-				const FString URL = GetTileURL(CurrentPosition);
-				const FString FileName = GetFileName(CurrentPosition);
-
-				const FString CacheFolder = GetCacheFolderPath();
-				const FString FilePath = CacheFolder + FileName + ".tif";
-
-				// Check if file is cached
-				if (FPaths::FileExists(FilePath))
-				{
-					GDALDatasetRef Dataset(
-						(GDALDataset*)GDALOpen(TCHAR_TO_UTF8(*(FilePath)), GA_ReadOnly));
-					DatasetsToMerge.Add(ConvertFromRGB(Dataset));
-					GDALClose(Dataset.Release());
-				} else
-				{
-					// Setup tile downloader
-					const TSharedRef<FTileDownloader> Segment = MakeShared<FTileDownloader>();
-					Segment->OnDownloaded.BindRaw(this, &FMapBoxTerrain::OnSegmentCompleted);
-					SegmentsDownloaders.Add(Segment);
-				
-					// Update the dataset with new bounds
-					const FVector ProjectedPosition = GetProjectedCoordinate(CurrentPosition);
-
-					FGeographicCoordinates GeoCenter;
-					FVector SegmentSize;
-					const FVector2D PixelSize =
-						GetProjectedPixelSize(ProjectedPosition, GeoCenter, SegmentSize);
-					
-					
-					Segment->SetMetaData(ProjectedPosition, PixelSize, 3857);
-					Segment->BeginDownload(URL, FileName);
-				}
-				
-				CurrentPosition.X++;
-			}
-			CurrentPosition.X = TopLeft.X;
-			CurrentPosition.Y++;
+			break;
 		}
-		
-		SegmentNum = (FMath::Abs(TopLeft.X - BottomRight.X) + 1) * (FMath::Abs(TopLeft.Y - BottomRight.Y) + 1);
-
-		CheckComplete();
 	}
+
+	UE_LOG(LogGeoViewer, Log, TEXT("Loading Mapbox terrain at zoom %d for %.2f m between heights"), Zoom, TargetSpacing);
+	return Zoom;
 }
 
-void FMapBoxTerrain::OnSegmentCompleted(const FTileDownloader* TileDownloader)
+GDALDataset* FMapBoxTerrain::PrepareSegment(const FString& Key, const FDecodedTilePtr& Segment)
 {
-	if (TileDownloader->FinalDataset)
+	const FDecodedTilePtr Heights = ConvertFromRGB(*Segment);
+	if (!Heights.IsValid())
 	{
-		GDALDatasetRef MapBoxDataset(TileDownloader->FinalDataset);
+		return nullptr;
+	}
 
-		GDALDataset* DatasetToMerge = ConvertFromRGB(MapBoxDataset);
-		DatasetsToMerge.Add(DatasetToMerge);
+	StoreHeights(GetHeightKey(Key), Heights);
 
-		GDALClose(MapBoxDataset.Release());
-		
-		CheckComplete();
-	}
-	else
-	{
-		TriggerOnCompleted(nullptr);
-	}
+	// Pinned by the tile API so the heights outlive the merged dataset reading them
+	return OpenDecodedTile(Heights);
 }
 
-FString FMapBoxTerrain::GetTileURL(const FVector2D Coordinates) const
+GDALDataset* FMapBoxTerrain::OpenCachedSegment(const FString& Key)
 {
-	return
-		"https://api.mapbox.com/v4/mapbox.terrain-rgb/"
-		+ FString::FromInt(ZoomLevel)
-		+ "/"
-		+ FString::FromInt(Coordinates.X)
-		+ "/"
-		+ FString::FromInt(Coordinates.Y)
-		+ "@2.png?access_token="
-		+ APIKey;
+	// Heights decoded by an earlier import don't need the RGB segment at all
+	const FDecodedTilePtr Heights = FindCachedTile(GetHeightKey(Key));
+	if (Heights.IsValid() && Heights->DataType == GDT_Float32 && Heights->Bands == 1)
+	{
+		return OpenDecodedTile(Heights);
+	}
+
+	return FXYZTileAPI::OpenCachedSegment(Key);
 }
 
-FString FMapBoxTerrain::GetFileName(const FVector2D Coordinates)
+FDecodedTilePtr FMapBoxTerrain::ConvertFromRGB(const FDecodedTile& MapboxTile)
 {
-	return "MapboxTerrain" + FString::FromInt(Coordinates.X) + "," + FString::FromInt(Coordinates.Y);
+	if (MapboxTile.DataType != GDT_Byte || MapboxTile.Bands < 3 || MapboxTile.Pixels.Num() == 0)
+	{
+		return nullptr;
+	}
+
+	const int32 NumPixels = MapboxTile.XSize * MapboxTile.YSize;
+
+	// The heights are written straight into the buffer the new dataset reads from
+	const TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> HeightTile = MakeShared<FDecodedTile, ESPMode::ThreadSafe>();
+	HeightTile->XSize = MapboxTile.XSize;
+	HeightTile->YSize = MapboxTile.YSize;
+	HeightTile->Bands = 1;
+	HeightTile->DataType = GDT_Float32;
+	HeightTile->Pixels.SetNumUninitialized(NumPixels * sizeof(float));
+	FMemory::Memcpy(HeightTile->GeoTransform, MapboxTile.GeoTransform, sizeof(MapboxTile.GeoTransform));
+	HeightTile->ProjectionWKT = MapboxTile.ProjectionWKT;
+
+	DecodeHeights(
+		MapboxTile.Pixels.GetData(),
+		NumPixels,
+		MapboxTile.Bands,
+		reinterpret_cast<float*>(HeightTile->Pixels.GetData())
+		);
+
+	return HeightTile;
 }
 
-FGeographicCoordinates FMapBoxTerrain::GetGeographicCoordinates(const FVector2D Coordinates) const
+FString FMapBoxTerrain::GetHeightKey(const FString& SegmentKey) const
 {
-	// https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames#Implementations
-	const float TileNum = FMath::Pow(2.f, ZoomLevel);
-	FGeographicCoordinates Result;
-	Result.Longitude = Coordinates.X / TileNum * 360 - 180;
-	const float LatitudeRad = FMath::Atan(FMath::Sinh(PI * (1 - 2 * Coordinates.Y / TileNum)));
-	Result.Latitude = FMath::RadiansToDegrees(LatitudeRad);
-
-	return Result;
+	return HeightKeyPrefix + SegmentKey.RightChop(KeyPrefix.Len());
 }
 
-FVector FMapBoxTerrain::GetProjectedCoordinate(const FVector2D Coordinates) const
+void FMapBoxTerrain::StoreHeights(const FString& HeightKey, const FDecodedTilePtr& Heights)
 {
-	const FGeographicCoordinates GeoCoord = GetGeographicCoordinates(Coordinates);
+	FTileMemoryCache::Get().Add(HeightKey, Heights);
+
+	if (FTileCache::Get().Contains(HeightKey))
+	{
+		return;
+	}
 
-	FVector Result;
-	TileReferenceSystem->GeographicToProjectedWithEPSG(GeoCoord, Result, EPSG);
-	return Result;
+	// Compressing the heights takes a while so it's kept off the game thread
+	Async(EAsyncExecution::ThreadPool, [HeightKey, Heights]()
+	{
+		TArray<uint8> EncodedTile;
+		if (EncodeHeights(*Heights, EncodedTile))
+		{
+			FTileCache::Get().StoreTile(HeightKey, MoveTemp(EncodedTile));
+		}
+	});
 }
 
-FVector2D FMapBoxTerrain::GetSlippyMapCoordinates(const FGeographicCoordinates Coordinates) const
+bool FMapBoxTerrain::EncodeHeights(const FDecodedTile& Heights, TArray<uint8>& OutEncodedTile)
 {
-	// https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames#Implementations
-	const float TileNum = FMath::Pow(2.f, ZoomLevel);
-	const float LatitudeRad = FMath::DegreesToRadians(Coordinates.Latitude);
-
-	// https://mathworld.wolfram.com/InverseHyperbolicSine.html
-	auto ASinH = [](const float x){ return FMath::Loge(x + FMath::Sqrt(1 + FMath::Pow(x, 2))); };
-	
-	const float X = TileNum * ((Coordinates.Longitude + 180) / 360);
-	const float Y = (1.0 - ASinH(FMath::Tan(LatitudeRad)) / PI) / 2.0 * TileNum;
-
-	FVector2D Result;
-	Result.X = FMath::Floor(X);
-	Result.Y = FMath::Floor(Y);
-	
-	return Result;
+	char** CreationOptions = nullptr;
+	CreationOptions = CSLSetNameValue(CreationOptions, "TILED", "YES");
+	CreationOptions = CSLSetNameValue(CreationOptions, "COMPRESS", "DEFLATE");
+	CreationOptions = CSLSetNameValue(CreationOptions, "PREDICTOR", "3");
+
+	// Create the GTiff in memory
+	const FGuid DatasetGuid = FGuid::NewGuid();
+	const FString FilePath = "/vsimem/" + DatasetGuid.ToString() + ".tif";
+	GDALDriver* GTiffDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	check(GTiffDriver)
+
+	GDALDatasetRef HeightDataset(GTiffDriver->Create(
+		TCHAR_TO_UTF8(*FilePath),
+		Heights.XSize,
+		Heights.YSize,
+		1,
+		GDT_Float32,
+		CreationOptions
+		));
+	CSLDestroy(CreationOptions);
+
+	if (!HeightDataset.IsValid())
+	{
+		return false;
+	}
+
+	HeightDataset->SetGeoTransform(const_cast<double*>(Heights.GeoTransform));
+	HeightDataset->SetProjection(TCHAR_TO_UTF8(*Heights.ProjectionWKT));
+
+	const CPLErr Error = HeightDataset->GetRasterBand(1)->RasterIO(
+		GF_Write,
+		0,
+		0,
+		Heights.XSize,
+		Heights.YSize,
+		const_cast<uint8*>(Heights.Pixels.GetData()),
+		Heights.XSize,
+		Heights.YSize,
+		GDT_Float32,
+		0,
+		0
+		);
+
+	if (Error == CE_None)
+	{
+		// Write the GTiff headers so the in-memory file is complete, then copy it out
+		HeightDataset->FlushCache();
+		vsi_l_offset FileLength = 0;
+		const GByte* FileData = VSIGetMemFileBuffer(TCHAR_TO_UTF8(*FilePath), &FileLength, FALSE);
+		if (FileData && FileLength > 0)
+		{
+			OutEncodedTile = TArray<uint8>(FileData, static_cast<int32>(FileLength));
+		}
+	}
+
+	HeightDataset.Reset();
+	VSIUnlink(TCHAR_TO_UTF8(*FilePath));
+
+	return OutEncodedTile.Num() > 0;
 }
 
-GDALDataset* FMapBoxTerrain::ConvertFromRGB(GDALDatasetRef& MapboxDataset)
+void FMapBoxTerrain::DecodeHeights(const uint8* Pixels, const int32 NumPixels, const int32 Bands, float* OutHeights)
 {
-	// Read height data from dataset
-	TArray<uint8> HeightDataInt8;
-	FGDALWarp::GetRawImage(MapboxDataset, HeightDataInt8);
-
-	const int XSize = MapboxDataset->GetRasterXSize();
-	const int ChannelNum = MapboxDataset->GetRasterCount();
-		
-	TArray<float> HeightDataFloat;
-	HeightDataFloat.Init(0, HeightDataInt8.Num() / ChannelNum);
-	for (int i = 0; i < HeightDataInt8.Num(); i += ChannelNum)
+	// https://docs.mapbox.com/data/tilesets/reference/mapbox-terrain-rgb-v1/#elevation-data
+	constexpr float BaseHeight = -10000;
+	constexpr float HeightStep = 0.1;
+
+	const VectorRegister4Int ByteMask = VectorIntSet1(0xFF);
+	const VectorRegister4Int GreenMask = VectorIntSet1(0xFF00);
+	const VectorRegister4Float Step = VectorSetFloat1(HeightStep);
+	const VectorRegister4Float Base = VectorSetFloat1(BaseHeight);
+
+	// Each lane holds one pixel as a little endian RGBA uint32, the alpha is ignored
+	auto DecodeLanes = [&](const VectorRegister4Int RGBA, float* Out)
+	{
+		// R * 65536 + G * 256 + B
+		const VectorRegister4Int Red = VectorShiftLeftImm(VectorIntAnd(RGBA, ByteMask), 16);
+		const VectorRegister4Int Green = VectorIntAnd(RGBA, GreenMask);
+		const VectorRegister4Int Blue = VectorIntAnd(VectorShiftRightImmLogical(RGBA, 16), ByteMask);
+		const VectorRegister4Int Value = VectorIntOr(VectorIntOr(Red, Green), Blue);
+
+		VectorStore(VectorMultiplyAdd(VectorIntToFloat(Value), Step, Base), Out);
+	};
+
+	int32 Pixel = 0;
+
+	// Four RGBA pixels fit in one vector register
+	if (Bands == 4)
 	{
-		// Convert from 3 channels down to one
-		// https://docs.mapbox.com/data/tilesets/reference/mapbox-terrain-rgb-v1/#elevation-data
-		const uint8 R = HeightDataInt8[i];
-		const uint8 G = HeightDataInt8[i + 1];
-		const uint8 B = HeightDataInt8[i + 2];
-		HeightDataFloat[i / ChannelNum] = -10000 + ((R * 256 * 256 + (G * 256) + B) * 0.1);
+		for (; Pixel + 4 <= NumPixels; Pixel += 4)
+		{
+			DecodeLanes(VectorIntLoad(Pixels + Pixel * 4), OutHeights + Pixel);
+		}
 	}
+#if MAPBOX_HAS_RGB_LOAD
+	// RGB tiles such as cached segments are spread into the same lanes, the load reads one pixel past the four
+	else if (Bands == 3)
+	{
+		for (; Pixel + 6 <= NumPixels; Pixel += 4)
+		{
+			DecodeLanes(LoadRGBPixels(Pixels + Pixel * 3), OutHeights + Pixel);
+		}
+	}
+#endif
 
-	// Save converted height data to a new dataset
-	FString FileName;
-	GDALDataset* Result =
-		FGDALWarp::CreateGTiffDataset(HeightDataFloat, XSize, XSize, FileName, ERGBFormat::Gray).Release();
-
-	GTiffPaths.Add(FileName);
-	
-	// Copy GeoTransform to new dataset 
-	GDALSetProjection(Result, MapboxDataset->GetProjectionRef());
-	double GeoTransform[6];
-	MapboxDataset->GetGeoTransform(GeoTransform);
-	Result->SetGeoTransform(GeoTransform);
-	
-	return Result;
+	// Remaining pixels and any other layout
+	for (const uint8* Source = Pixels + Pixel * Bands; Pixel < NumPixels; Pixel++, Source += Bands)
+	{
+		OutHeights[Pixel] = BaseHeight + (Source[0] * 65536 + Source[1] * 256 + Source[2]) * HeightStep;
+	}
 }
@@ -1,11 +1,13 @@
 ﻿#include "TileAPIs/WebTileMapAPI.h"
 #include "GDALWarp.h"
+#include "TileDownloadScheduler.h"
 
 FWebMapTileAPI::FWebMapTileAPI(const TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
                                AWorldReferenceSystem* ReferencingSystem) :
 	FGeoTileAPI(InEdModeConfig, ReferencingSystem), ZoomLevel(0), TileResolution(0)
 {
 	SegmentNum = -1;
+	bAddAlphaOnMerge = true;
 }
 
 void FWebMapTileAPI::LoadTile(const FProjectedBounds InTileBounds)
@@ -16,111 +18,289 @@ void FWebMapTileAPI::LoadTile(const FProjectedBounds InTileBounds)
 	{
 		// Get the bounds in projected coordinates used by the data source
 		auto [TopLeft, BottomRight] = GetProjectedBounds();
+
+		if (EdModeConfigPtr.IsValid() && EdModeConfigPtr->bSnapToPixelGrid && EPSG == 3857)
+		{
+			LoadGridSegments(TopLeft, BottomRight);
+		}
+		else
+		{
+			LoadSegments(TopLeft, BottomRight);
+		}
+	}
+
+	CheckComplete();
+}
+
+void FWebMapTileAPI::LoadSegments(const FVector& TopLeft, const FVector& BottomRight)
+{
+	// Download all segments needed till the 'CurrentPosition' is beyond the bottom corner
+	FVector CurrentPosition = TopLeft;
+	
+	FVector2D PositionIndex = FVector2D(0, 0); // Position of a segment in relation to the other segments.
+	while (CurrentPosition.Y > BottomRight.Y)
+	{
+		PositionIndex.X = 0;
+		FVector ProjectedSegmentSize;
+		while (CurrentPosition.X < BottomRight.X)
+		{
+			FGeographicCoordinates SegmentCenterGeo;
+			const FVector2D PixelSize =
+				GetProjectedPixelSize(CurrentPosition, SegmentCenterGeo, ProjectedSegmentSize);
+
+			RequestSegment(GetFileName(SegmentCenterGeo), SegmentCenterGeo, CurrentPosition, PixelSize);
+			
+			// Move position along
+			CurrentPosition.X += ProjectedSegmentSize.X;
+			PositionIndex.X++;
+		}
 		
-		// Download all segments needed till the 'CurrentPosition' is beyond the bottom corner
-		FVector CurrentPosition = TopLeft;
+		// After each row reset X and increment Y
+		CurrentPosition.X = TopLeft.X;
+		CurrentPosition.Y -= ProjectedSegmentSize.Y;
 		
-		FVector2D PositionIndex = FVector2D(0, 0); // Position of a segment in relation to the other segments.
-		while (CurrentPosition.Y > BottomRight.Y)
+		PositionIndex.Y++;
+	}
+
+	SegmentNum = PositionIndex.X * PositionIndex.Y;
+}
+
+void FWebMapTileAPI::LoadGridSegments(const FVector& TopLeft, const FVector& BottomRight)
+{
+	const double PixelSize = GetWebMercatorPixelSize();
+	const double SegmentSize = PixelSize * TileResolution;
+	const FIntRect IndexRange = GetGridIndexRange(FVector2D(TopLeft), FVector2D(BottomRight));
+
+	for (int Row = IndexRange.Min.Y; Row <= IndexRange.Max.Y; Row++)
+	{
+		for (int Column = IndexRange.Min.X; Column <= IndexRange.Max.X; Column++)
 		{
-			PositionIndex.X = 0;
-			FVector ProjectedSegmentSize;
-			while (CurrentPosition.X < BottomRight.X)
-			{
-				FGeographicCoordinates SegmentCenterGeo;
-				const FVector2D PixelSize =
-					GetProjectedPixelSize(CurrentPosition, SegmentCenterGeo, ProjectedSegmentSize);
-
-				//Get URL and filename
-				const FString URL = GetTileURL(SegmentCenterGeo);
-				const FString FileName = GetFileName(SegmentCenterGeo);
-
-				const FString CacheFolder = GetCacheFolderPath();
-				const FString FilePath = CacheFolder + FileName + ".tif";
-
-				// Check if file is cached
-				if (FPaths::FileExists(FilePath))
-				{
-					GDALDataset* Dataset = (GDALDataset*)GDALOpen(TCHAR_TO_UTF8(*(FilePath)), GA_ReadOnly);
-					DatasetsToMerge.Add(Dataset);
-				} else
-				{
-					// Setup tile downloader
-					const TSharedRef<FTileDownloader> Segment = MakeShared<FTileDownloader>();
-					Segment->OnDownloaded.BindRaw(this, &FWebMapTileAPI::OnSegmentCompleted);
-					SegmentsDownloaders.Add(Segment);
-				
-					// Update the dataset with new bounds
-					Segment->SetMetaData(CurrentPosition, PixelSize, 3857);
-					Segment->BeginDownload(URL, FileName);
-				}
-				
-				
-				// Move position along
-				CurrentPosition.X += ProjectedSegmentSize.X;
-				PositionIndex.X++;
-			}
-			
-			// After each row reset X and increment Y
-			CurrentPosition.X = TopLeft.X;
-			CurrentPosition.Y -= ProjectedSegmentSize.Y;
-			
-			PositionIndex.Y++;
+			const FVector SegmentTopCorner = GetGridTopCorner(FIntPoint(Column, Row));
+
+			// Static maps are requested by their center so the segment lines up with the grid
+			const FVector SegmentCenter = SegmentTopCorner + FVector(SegmentSize / 2, -SegmentSize / 2, 0);
+			FGeographicCoordinates SegmentCenterGeo;
+			TileReferenceSystem->ProjectedToGeographicWithEPSG(SegmentCenter, SegmentCenterGeo, EPSG);
+
+			RequestSegment(
+				GetGridFileName(FIntPoint(Column, Row)),
+				SegmentCenterGeo,
+				SegmentTopCorner,
+				FVector2D(PixelSize, PixelSize)
+				);
 		}
+	}
+
+	SegmentNum = (IndexRange.Max.X - IndexRange.Min.X + 1) * (IndexRange.Max.Y - IndexRange.Min.Y + 1);
+}
+
+FIntRect FWebMapTileAPI::GetGridIndexRange(const FVector2D& TopLeft, const FVector2D& BottomRight) const
+{
+	const double SegmentSize = GetWebMercatorPixelSize() * TileResolution;
+
+	// Columns count right from the west edge and rows count down from the north edge, the
+	// same way the static map APIs count pixels.
+	FIntRect IndexRange;
+	IndexRange.Min = FIntPoint(
+		FMath::FloorToInt((TopLeft.X + WebMercatorHalfSize) / SegmentSize),
+		FMath::FloorToInt((WebMercatorHalfSize - TopLeft.Y) / SegmentSize)
+		);
+	IndexRange.Max = FIntPoint(
+		FMath::CeilToInt((BottomRight.X + WebMercatorHalfSize) / SegmentSize) - 1,
+		FMath::CeilToInt((WebMercatorHalfSize - BottomRight.Y) / SegmentSize) - 1
+		);
+
+	return IndexRange;
+}
+
+FVector FWebMapTileAPI::GetGridTopCorner(const FIntPoint GridIndex) const
+{
+	const double SegmentSize = GetWebMercatorPixelSize() * TileResolution;
 
-		SegmentNum = PositionIndex.X * PositionIndex.Y;
+	return FVector(
+		GridIndex.X * SegmentSize - WebMercatorHalfSize,
+		WebMercatorHalfSize - GridIndex.Y * SegmentSize,
+		0
+		);
+}
+
+void FWebMapTileAPI::GetSegmentsInBounds(const FGeoBounds& Bounds, TArray<FTileSegment>& OutSegments) const
+{
+	// Corners may be in any order so find the extent in Web Mercator
+	const FVector2D CornerA = GeographicToWebMercator(Bounds.TopLeft);
+	const FVector2D CornerB = GeographicToWebMercator(Bounds.BottomRight);
+	const FVector2D TopLeft(FMath::Min(CornerA.X, CornerB.X), FMath::Max(CornerA.Y, CornerB.Y));
+	const FVector2D BottomRight(FMath::Max(CornerA.X, CornerB.X), FMath::Min(CornerA.Y, CornerB.Y));
+
+	const double SegmentSize = GetWebMercatorPixelSize() * TileResolution;
+	const FIntRect IndexRange = GetGridIndexRange(TopLeft, BottomRight);
+	const ETileCacheEncoding Encoding = GetDefault<UGeoViewerSettings>()->CacheEncoding;
+
+	for (int Row = IndexRange.Min.Y; Row <= IndexRange.Max.Y; Row++)
+	{
+		for (int Column = IndexRange.Min.X; Column <= IndexRange.Max.X; Column++)
+		{
+			FTileSegment& Segment = OutSegments.AddDefaulted_GetRef();
+			Segment.TopCorner = GetGridTopCorner(FIntPoint(Column, Row));
+			Segment.Size = FVector2D(SegmentSize, SegmentSize);
+			Segment.Center = WebMercatorToGeographic(
+				FVector2D(Segment.TopCorner) + FVector2D(SegmentSize / 2, -SegmentSize / 2));
+			Segment.Key = GetGridFileName(FIntPoint(Column, Row));
+			Segment.URL = GetTileURL(Segment.Center);
+			Segment.Provider = GetProviderName();
+			Segment.Encoding = Encoding;
+		}
 	}
+}
 
-	CheckComplete();
+FVector2D FWebMapTileAPI::GeographicToWebMercator(const FGeographicCoordinates& Coordinates)
+{
+	const double LatitudeRad = FMath::DegreesToRadians(Coordinates.Latitude);
+
+	return FVector2D(
+		FMath::DegreesToRadians(Coordinates.Longitude) * WebMercatorRadius,
+		FMath::Loge(FMath::Tan(UE_DOUBLE_PI / 4 + LatitudeRad / 2)) * WebMercatorRadius
+		);
+}
+
+FGeographicCoordinates FWebMapTileAPI::WebMercatorToGeographic(const FVector2D& Coordinates)
+{
+	FGeographicCoordinates Result;
+	Result.Longitude = FMath::RadiansToDegrees(Coordinates.X / WebMercatorRadius);
+	Result.Latitude = FMath::RadiansToDegrees(2 * FMath::Atan(FMath::Exp(Coordinates.Y / WebMercatorRadius)) - UE_DOUBLE_PI / 2);
+
+	return Result;
+}
+
+void FWebMapTileAPI::RequestSegment(
+	const FString& FileName,
+	const FGeographicCoordinates& SegmentCenter,
+	const FVector TopCorner,
+	const FVector2D PixelSize
+	)
+{
+	RequestSegment(FileName, SegmentCenter, [this, &SegmentCenter, TopCorner, PixelSize](FTileDownloader& Segment)
+	{
+		// Update the dataset with new bounds
+		Segment.SetMetaData(TopCorner, PixelSize, EPSG);
+		return GetTileURL(SegmentCenter);
+	});
+}
+
+void FWebMapTileAPI::RequestSegment(
+	const FString& FileName,
+	const FGeographicCoordinates& SegmentCenter,
+	const TFunctionRef<FString(FTileDownloader& Segment)> SetupDownload
+	)
+{
+	// Check if the segment is cached
+	if (GDALDataset* Dataset = OpenCachedSegment(FileName))
+	{
+		DatasetsToMerge.Add(Dataset);
+		return;
+	}
+
+	// Wait for the segment if a neighbouring tile is already downloading it
+	TSharedPtr<FTileDownloader> Segment = FTileDownloadScheduler::Get().FindDownload(FileName);
+	if (!Segment.IsValid())
+	{
+		Segment = MakeShared<FTileDownloader>();
+
+		const FString URL = SetupDownload(*Segment);
+		Segment->SetSchedulingInfo(GetProviderName(), SegmentCenter);
+		Segment->SetPrefetch(bPrefetch);
+		Segment->BeginDownload(URL, FileName);
+	}
+	else if (!bPrefetch)
+	{
+		// The segment is needed now so stop treating it as a prefetch
+		Segment->SetPrefetch(false);
+	}
+
+	Segment->AddCancellationToken(CancellationToken);
+	Segment->OnDownloaded.AddSP(this, &FWebMapTileAPI::OnSegmentCompleted);
+	SegmentsDownloaders.Add(Segment.ToSharedRef());
+}
+
+GDALDataset* FWebMapTileAPI::OpenCachedSegment(const FString& Key)
+{
+	return OpenCachedTile(Key);
+}
+
+void FWebMapTileAPI::Cancel()
+{
+	FGeoTileAPI::Cancel();
+
+	// Requests shared with tiles that are still loading carry on
+	for (const TSharedRef<FTileDownloader>& Downloader : SegmentsDownloaders)
+	{
+		Downloader->OnTileCancelled();
+	}
+	SegmentsDownloaders.Empty();
 }
 
 void FWebMapTileAPI::CheckComplete()
 {
+	if (CancellationToken->IsCancelled())
+	{
+		return;
+	}
+
 	// See if all tiles have downloaded
 	if (SegmentNum > 0 && DatasetsToMerge.Num() == SegmentNum)
 	{
-		// As the download has complete none of the downloaders are needed
-		SegmentsDownloaders.Empty();
-		
-		// At this point all segments have been downloaded so the final dataset can be created.
-		GDALDataset* MergedDataset = MergeDatasets();
-		if (!MergedDataset)
+		// Prefetched segments are already in the caches so nothing else is needed
+		if (bPrefetch)
 		{
+			SegmentsDownloaders.Empty();
+			EmptyDatasetsToMerge();
 			TriggerOnCompleted(nullptr);
+			return;
 		}
+
+		// As the download has complete none of the downloaders are needed
+		SegmentsDownloaders.Empty();
 		
-		const int MergedDatasetIdx = CachedDatasets.Add(GDALDatasetRef(MergedDataset));
-		
-		GDALDataset* WarpedDataset = WarpDataset(MergedDatasetIdx);
-		CachedDatasets.Add(GDALDatasetRef(WarpedDataset));
-
-		// Crop the dataset down the the correct bounds.
-		FString CroppedDatasetPath;
-		GDALDataset* CroppedDataset = FGDALWarp::CropDataset(
-			WarpedDataset,
-			TileBounds.TopLeft,
-			TileBounds.BottomRight,
-			CroppedDatasetPath
-			).Release();
-		CachedDatasetPaths.Add(CroppedDatasetPath);
-		
-		TriggerOnCompleted(CroppedDataset);
+		// At this point all segments have been downloaded so the final dataset can be created.
+		CreateTileDataset(MergeDatasets());
 	}
 }
 
 void FWebMapTileAPI::OnSegmentCompleted(const FTileDownloader* TileDownloader)
 {
-	if (TileDownloader->FinalDataset)
+	// The download may be shared with a tile that is still loading
+	if (CancellationToken->IsCancelled())
 	{
-		DatasetsToMerge.Add(TileDownloader->FinalDataset);
+		return;
+	}
+
+	if (GDALDataset* Dataset = OpenDecodedTile(TileDownloader->DecodedTile))
+	{
+		DatasetsToMerge.Add(Dataset);
 		CheckComplete();
 	}
 	else
 	{
-		TriggerOnCompleted(nullptr);
+		OnSegmentFailed(TileDownloader);
 	}
 }
 
+void FWebMapTileAPI::OnSegmentFailed(const FTileDownloader* TileDownloader)
+{
+	// Releasing the downloads may drop the last reference to the one still reporting
+	const TSharedRef<const FTileDownloader> FailedDownloader = TileDownloader->AsShared();
+
+	// Cancelling stops the remaining segments reporting, so the completion is sent directly
+	Cancel();
+	OnComplete.ExecuteIfBound(nullptr);
+}
+
+double FWebMapTileAPI::GetWebMercatorPixelSize() const
+{
+	// The whole map is 256 pixels wide at zoom level 0 and doubles with each level
+	return 2 * WebMercatorHalfSize / (256.0 * FMath::Pow(2.0, ZoomLevel));
+}
+
 float FWebMapTileAPI::CalculateTileSize(double Latitude) const
 {
 	// https://docs.microsoft.com/en-us/bingmaps/articles/understanding-scale-and-resolution
@@ -0,0 +1,201 @@
+﻿#include "TileAPIs/XYZTileAPI.h"
+
+#include "GeoViewer.h"
+#include "PlatformHttp.h"
+#include "TileDownloader.h"
+
+FXYZTileAPI::FXYZTileAPI(TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
+                         AWorldReferenceSystem* ReferencingSystem) : FWebMapTileAPI(InEdModeConfig, ReferencingSystem)
+{
+	CacheEncoding = GetDefault<UGeoViewerSettings>()->CacheEncoding;
+	TileResolution = 256;
+
+	if (EdModeConfigPtr.IsValid())
+	{
+		URLTemplate = EdModeConfigPtr->XYZ.URLTemplate;
+		ZoomLevel = EdModeConfigPtr->XYZ.ZoomLevel;
+	}
+
+	// Tiles from different servers must not share keys
+	KeyPrefix = FString::Printf(TEXT("XYZ,%08x"), FCrc::StrCrc32(*URLTemplate));
+
+	const FString Domain = FPlatformHttp::GetUrlDomain(URLTemplate);
+	ProviderName = Domain.IsEmpty() ? FName(TEXT("XYZ")) : FName(*Domain);
+}
+
+void FXYZTileAPI::LoadTile(const FProjectedBounds InTileBounds)
+{
+	TileBounds = InTileBounds;
+
+	// The tile would otherwise never complete and couldn't be loaded again
+	if (!TileReferenceSystem || URLTemplate.IsEmpty())
+	{
+		UE_LOG(LogGeoViewer, Warning, TEXT("Can't load XYZ tile: %s"),
+			TileReferenceSystem ? TEXT("no URL template has been set") : TEXT("the world has no reference system"));
+		TriggerOnCompleted(nullptr);
+		return;
+	}
+
+	// Find the bounds in XY coordinates used by the tile server
+	const FIntRect TileRange = GetTileRange(InTileBounds.ConvertToGeoBounds(TileReferenceSystem));
+
+	for (int Y = TileRange.Min.Y; Y <= TileRange.Max.Y; Y++)
+	{
+		for (int X = TileRange.Min.X; X <= TileRange.Max.X; X++)
+		{
+			const FIntPoint Coordinates(X, Y);
+			RequestSegment(
+				GetFileName(Coordinates),
+				GetGeographicCoordinates(FVector2D(X + 0.5, Y + 0.5)),
+				[this, Coordinates](FTileDownloader& Segment)
+				{
+					// The pixel size is taken from the downloaded image as servers may send high DPI tiles
+					const FVector TopCorner = GetProjectedCoordinate(FVector2D(Coordinates));
+					const FVector BottomCorner = GetProjectedCoordinate(FVector2D(Coordinates + FIntPoint(1, 1)));
+					const FVector2D SegmentSize(BottomCorner.X - TopCorner.X, TopCorner.Y - BottomCorner.Y);
+
+					Segment.SetExtentMetaData(TopCorner, SegmentSize, EPSG);
+					Segment.SetCacheEncoding(CacheEncoding);
+					return GetTileURL(Coordinates);
+				});
+		}
+	}
+
+	SegmentNum = (TileRange.Max.X - TileRange.Min.X + 1) * (TileRange.Max.Y - TileRange.Min.Y + 1);
+
+	CheckComplete();
+}
+
+void FXYZTileAPI::GetSegmentsInBounds(const FGeoBounds& Bounds, TArray<FTileSegment>& OutSegments) const
+{
+	const FIntRect TileRange = GetTileRange(Bounds);
+	const double TileSize = 2 * WebMercatorHalfSize / FMath::Pow(2.0, ZoomLevel);
+
+	for (int Y = TileRange.Min.Y; Y <= TileRange.Max.Y; Y++)
+	{
+		for (int X = TileRange.Min.X; X <= TileRange.Max.X; X++)
+		{
+			FTileSegment& Segment = OutSegments.AddDefaulted_GetRef();
+			Segment.TopCorner = FVector(X * TileSize - WebMercatorHalfSize, WebMercatorHalfSize - Y * TileSize, 0);
+			Segment.Size = FVector2D(TileSize, TileSize);
+			Segment.Center = GetGeographicCoordinates(FVector2D(X + 0.5, Y + 0.5));
+			Segment.Key = GetFileName(FIntPoint(X, Y));
+			Segment.URL = GetTileURL(FIntPoint(X, Y));
+			Segment.Provider = ProviderName;
+			Segment.Encoding = CacheEncoding;
+		}
+	}
+}
+
+void FXYZTileAPI::OnSegmentCompleted(const FTileDownloader* TileDownloader)
+{
+	// The download may be shared with a tile that is still loading
+	if (CancellationToken->IsCancelled())
+	{
+		return;
+	}
+
+	GDALDataset* Segment = TileDownloader->DecodedTile.IsValid()
+		? PrepareSegment(TileDownloader->GetKey(), TileDownloader->DecodedTile)
+		: nullptr;
+	if (Segment)
+	{
+		DatasetsToMerge.Add(Segment);
+		CheckComplete();
+	}
+	else
+	{
+		OnSegmentFailed(TileDownloader);
+	}
+}
+
+GDALDataset* FXYZTileAPI::PrepareSegment(const FString& Key, const FDecodedTilePtr& Segment)
+{
+	return OpenDecodedTile(Segment);
+}
+
+GDALDataset* FXYZTileAPI::OpenCachedSegment(const FString& Key)
+{
+	const FDecodedTilePtr CachedSegment = FindCachedTile(Key);
+	return CachedSegment.IsValid() ? PrepareSegment(Key, CachedSegment) : nullptr;
+}
+
+FString FXYZTileAPI::GetTileURL(const FIntPoint Coordinates) const
+{
+	// TMS servers count rows from the bottom of the map
+	const int FlippedY = (1 << ZoomLevel) - 1 - Coordinates.Y;
+
+	return URLTemplate
+		.Replace(TEXT("{z}"), *FString::FromInt(ZoomLevel))
+		.Replace(TEXT("{x}"), *FString::FromInt(Coordinates.X))
+		.Replace(TEXT("{-y}"), *FString::FromInt(FlippedY))
+		.Replace(TEXT("{y}"), *FString::FromInt(Coordinates.Y));
+}
+
+FString FXYZTileAPI::GetFileName(const FIntPoint Coordinates) const
+{
+	return
+		KeyPrefix
+		+ ","
+		+ FString::FromInt(ZoomLevel)
+		+ ","
+		+ FString::FromInt(Coordinates.X)
+		+ ","
+		+ FString::FromInt(Coordinates.Y);
+}
+
+FGeographicCoordinates FXYZTileAPI::GetGeographicCoordinates(const FVector2D Coordinates) const
+{
+	// https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames#Implementations
+	const double TileNum = FMath::Pow(2.0, ZoomLevel);
+	FGeographicCoordinates Result;
+	Result.Longitude = Coordinates.X / TileNum * 360 - 180;
+	const double LatitudeRad = FMath::Atan(FMath::Sinh(UE_DOUBLE_PI * (1 - 2 * Coordinates.Y / TileNum)));
+	Result.Latitude = FMath::RadiansToDegrees(LatitudeRad);
+
+	return Result;
+}
+
+FVector FXYZTileAPI::GetProjectedCoordinate(const FVector2D Coordinates) const
+{
+	const FGeographicCoordinates GeoCoord = GetGeographicCoordinates(Coordinates);
+
+	FVector Result;
+	TileReferenceSystem->GeographicToProjectedWithEPSG(GeoCoord, Result, EPSG);
+	return Result;
+}
+
+FIntPoint FXYZTileAPI::GetSlippyMapCoordinates(const FGeographicCoordinates Coordinates) const
+{
+	// https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames#Implementations
+	const double TileNum = FMath::Pow(2.0, ZoomLevel);
+	const double LatitudeRad = FMath::DegreesToRadians(Coordinates.Latitude);
+
+	// https://mathworld.wolfram.com/InverseHyperbolicSine.html
+	auto ASinH = [](const double x){ return FMath::Loge(x + FMath::Sqrt(1 + x * x)); };
+	
+	const double X = TileNum * ((Coordinates.Longitude + 180) / 360);
+	const double Y = (1.0 - ASinH(FMath::Tan(LatitudeRad)) / UE_DOUBLE_PI) / 2.0 * TileNum;
+
+	return FIntPoint(FMath::FloorToInt(X), FMath::FloorToInt(Y));
+}
+
+FIntRect FXYZTileAPI::GetTileRange(const FGeoBounds& Bounds) const
+{
+	const FIntPoint CornerA = GetSlippyMapCoordinates(Bounds.BottomRight);
+	const FIntPoint CornerB = GetSlippyMapCoordinates(Bounds.TopLeft);
+
+	// Make sure both corners are the correct way round and on the map
+	const int MaxIndex = (1 << ZoomLevel) - 1;
+	FIntRect TileRange;
+	TileRange.Min = FIntPoint(
+		FMath::Clamp(FMath::Min(CornerA.X, CornerB.X), 0, MaxIndex),
+		FMath::Clamp(FMath::Min(CornerA.Y, CornerB.Y), 0, MaxIndex)
+		);
+	TileRange.Max = FIntPoint(
+		FMath::Clamp(FMath::Max(CornerA.X, CornerB.X), 0, MaxIndex),
+		FMath::Clamp(FMath::Max(CornerA.Y, CornerB.Y), 0, MaxIndex)
+		);
+
+	return TileRange;
+}
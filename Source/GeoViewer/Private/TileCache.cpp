@@ -0,0 +1,566 @@
+﻿#include "TileCache.h"
+#include "GeoViewer.h"
+#include "Async/Async.h"
+#include "HAL/IConsoleManager.h"
+#include "TileMemoryCache.h"
+#include "TileAPIs/GeoTileAPI.h"
+
+/** Name of the table holding the tiles and its fields */
+static const char* TilesLayerName = "tiles";
+static const char* KeyFieldName = "tile_key";
+static const char* DataFieldName = "tile_data";
+static const char* SizeFieldName = "tile_size";
+static const char* AccessFieldName = "last_access";
+
+/** Number of tiles waiting to be written before they are flushed to disk */
+static constexpr int FlushBatchSize = 32;
+
+/** Maximum time in seconds a tile waits before being written to disk */
+static constexpr double FlushInterval = 10.0;
+
+/** Eviction removes tiles until the cache is this fraction of the limit so it doesn't run after every new tile */
+static constexpr double EvictionTargetRatio = 0.9;
+
+/** Number of tiles removed before the lock is released so tiles can still be opened during eviction */
+static constexpr int EvictionBatchSize = 256;
+
+static FAutoConsoleCommand CacheStatsCommand(
+	TEXT("GeoViewer.CacheStats"),
+	TEXT("Prints the size and hit ratio of the GeoViewer tile cache."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FTileCacheStats Stats = FTileCache::Get().GetStats();
+		UE_LOG(LogGeoViewer, Display,
+			TEXT("Tile cache: %d tiles, %.1f MB of %.1f MB, %lld hits, %lld misses (%.1f%% hit ratio), %lld evicted"),
+			Stats.NumTiles,
+			Stats.SizeBytes / (1024.0 * 1024.0),
+			Stats.SizeLimitBytes / (1024.0 * 1024.0),
+			Stats.Hits,
+			Stats.Misses,
+			Stats.GetHitRatio() * 100,
+			Stats.Evictions);
+
+		const FTileMemoryCache& MemoryCache = FTileMemoryCache::Get();
+		UE_LOG(LogGeoViewer, Display,
+			TEXT("Memory cache: %d decoded segments, %.1f MB of %.1f MB"),
+			MemoryCache.GetNum(),
+			MemoryCache.GetSize() / (1024.0 * 1024.0),
+			MemoryCache.GetSizeLimit() / (1024.0 * 1024.0));
+	}));
+
+FTileCache::FTileCache(): TilesLayer(nullptr), LastFlushTime(0), TotalSize(0), SizeLimit(0), Hits(0), Misses(0), Evictions(0)
+{
+}
+
+FTileCache& FTileCache::Get()
+{
+	static FTileCache Cache;
+	return Cache;
+}
+
+void FTileCache::Initialize()
+{
+	FScopeLock Lock(&CacheLock);
+
+	if (Database.IsValid())
+	{
+		return;
+	}
+
+	const FString FilePath = GetCacheFilePath();
+	if (FPaths::FileExists(FilePath))
+	{
+		Database.Reset((GDALDataset*)GDALOpenEx(
+			TCHAR_TO_UTF8(*FilePath),
+			GDAL_OF_VECTOR | GDAL_OF_UPDATE,
+			nullptr,
+			nullptr,
+			nullptr
+			));
+	}
+	else if (GDALDriver* Driver = GetGDALDriverManager()->GetDriverByName("GPKG"))
+	{
+		Database.Reset(Driver->Create(TCHAR_TO_UTF8(*FilePath), 0, 0, 0, GDT_Unknown, nullptr));
+	}
+
+	if (!Database.IsValid())
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("Failed to open the tile cache at %s, tiles will not be cached."), *FilePath);
+		return;
+	}
+
+	TilesLayer = Database->GetLayerByName(TilesLayerName);
+	const bool bLayerReady = TilesLayer ? UpgradeTilesLayer() : CreateTilesLayer();
+	if (!bLayerReady)
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("Failed to create the tiles table in %s, tiles will not be cached."), *FilePath);
+		TilesLayer = nullptr;
+		Database.Reset();
+		return;
+	}
+
+	LoadIndex();
+	LastFlushTime = FPlatformTime::Seconds();
+
+	UE_LOG(LogGeoViewer, Log, TEXT("Opened tile cache containing %d tiles (%.1f MB)."), Index.Num(), TotalSize / (1024.0 * 1024.0));
+
+	StartEviction();
+}
+
+void FTileCache::Shutdown()
+{
+	TFuture<void> RunningEviction;
+	{
+		FScopeLock Lock(&CacheLock);
+
+		FlushPendingTiles();
+
+		TilesLayer = nullptr;
+		Database.Reset();
+		Index.Empty();
+		PendingTiles.Empty();
+		AccessedFeatures.Empty();
+		TotalSize = 0;
+
+		RunningEviction = MoveTemp(EvictionTask);
+	}
+
+	// Eviction stops at its next batch now the table is closed
+	if (RunningEviction.IsValid())
+	{
+		RunningEviction.Wait();
+	}
+}
+
+bool FTileCache::Contains(const FString& Key) const
+{
+	FScopeLock Lock(&CacheLock);
+	return Index.Contains(Key) || PendingTiles.Contains(Key);
+}
+
+GDALDataset* FTileCache::OpenTile(const FString& Key, FString& OutMemoryFilePath)
+{
+	// Copy the tile into a buffer owned by GDAL so the lock isn't held while the dataset is opened
+	GByte* Buffer = nullptr;
+	int BufferSize = 0;
+	{
+		FScopeLock Lock(&CacheLock);
+
+		if (const TArray<uint8>* PendingTile = PendingTiles.Find(Key))
+		{
+			BufferSize = PendingTile->Num();
+			Buffer = (GByte*)CPLMalloc(BufferSize);
+			FMemory::Memcpy(Buffer, PendingTile->GetData(), BufferSize);
+		}
+		else if (FCacheEntry* Entry = Index.Find(Key))
+		{
+			if (OGRFeature* Feature = TilesLayer->GetFeature(Entry->FeatureID))
+			{
+				const GByte* Data = Feature->GetFieldAsBinary(Feature->GetFieldIndex(DataFieldName), &BufferSize);
+				if (Data && BufferSize > 0)
+				{
+					Buffer = (GByte*)CPLMalloc(BufferSize);
+					FMemory::Memcpy(Buffer, Data, BufferSize);
+				}
+				OGRFeature::DestroyFeature(Feature);
+			}
+
+			// Keep recently viewed tiles from being evicted
+			Entry->LastAccess = FDateTime::UtcNow().ToUnixTimestamp();
+			AccessedFeatures.Add(Entry->FeatureID);
+		}
+
+		if (Buffer)
+		{
+			Hits++;
+		}
+		else
+		{
+			Misses++;
+		}
+	}
+
+	if (!Buffer)
+	{
+		return nullptr;
+	}
+
+	// Hand the buffer over to an in-memory file, it is freed when the file is deleted
+	const FGuid FileGuid = FGuid::NewGuid();
+	OutMemoryFilePath = "/vsimem/" + FileGuid.ToString() + ".tif";
+
+	VSILFILE* File = VSIFileFromMemBuffer(TCHAR_TO_UTF8(*OutMemoryFilePath), Buffer, BufferSize, TRUE);
+	if (!File)
+	{
+		CPLFree(Buffer);
+		return nullptr;
+	}
+	VSIFCloseL(File);
+
+	return (GDALDataset*)GDALOpen(TCHAR_TO_UTF8(*OutMemoryFilePath), GA_ReadOnly);
+}
+
+void FTileCache::StoreTile(const FString& Key, TArray<uint8>&& EncodedTile)
+{
+	FScopeLock Lock(&CacheLock);
+
+	if (!TilesLayer || Index.Contains(Key))
+	{
+		return;
+	}
+
+	PendingTiles.Add(Key, MoveTemp(EncodedTile));
+
+	if (PendingTiles.Num() >= FlushBatchSize || FPlatformTime::Seconds() - LastFlushTime > FlushInterval)
+	{
+		FlushPendingTiles();
+		StartEviction();
+	}
+}
+
+void FTileCache::Flush()
+{
+	FScopeLock Lock(&CacheLock);
+	FlushPendingTiles();
+}
+
+void FTileCache::RemoveTiles(const FString& KeyPrefix)
+{
+	FScopeLock Lock(&CacheLock);
+
+	for (auto It = PendingTiles.CreateIterator(); It; ++It)
+	{
+		if (It.Key().StartsWith(KeyPrefix, ESearchCase::CaseSensitive))
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	if (!TilesLayer)
+	{
+		return;
+	}
+
+	const bool bTransaction = Database->StartTransaction() == OGRERR_NONE;
+
+	// The index is only changed once the rows are really gone from the file
+	TArray<FString> DeletedKeys;
+	for (const TPair<FString, FCacheEntry>& Tile : Index)
+	{
+		if (Tile.Key.StartsWith(KeyPrefix, ESearchCase::CaseSensitive)
+			&& TilesLayer->DeleteFeature(Tile.Value.FeatureID) == OGRERR_NONE)
+		{
+			DeletedKeys.Add(Tile.Key);
+		}
+	}
+
+	if (bTransaction && Database->CommitTransaction() != OGRERR_NONE)
+	{
+		Database->RollbackTransaction();
+		UE_LOG(LogGeoViewer, Warning, TEXT("Failed to remove tiles starting with '%s' from the tile cache."), *KeyPrefix);
+		return;
+	}
+
+	for (const FString& Key : DeletedKeys)
+	{
+		const FCacheEntry Entry = Index.FindAndRemoveChecked(Key);
+		AccessedFeatures.Remove(Entry.FeatureID);
+		TotalSize -= Entry.Size;
+	}
+}
+
+void FTileCache::SetSizeLimit(const int64 InSizeLimit)
+{
+	FScopeLock Lock(&CacheLock);
+
+	SizeLimit = FMath::Max<int64>(InSizeLimit, 0);
+	StartEviction();
+}
+
+FTileCacheStats FTileCache::GetStats() const
+{
+	FScopeLock Lock(&CacheLock);
+
+	FTileCacheStats Stats;
+	Stats.NumTiles = Index.Num() + PendingTiles.Num();
+	Stats.SizeBytes = TotalSize;
+	for (const TPair<FString, TArray<uint8>>& Tile : PendingTiles)
+	{
+		Stats.SizeBytes += Tile.Value.Num();
+	}
+	Stats.SizeLimitBytes = SizeLimit;
+	Stats.Hits = Hits;
+	Stats.Misses = Misses;
+	Stats.Evictions = Evictions;
+
+	return Stats;
+}
+
+FString FTileCache::GetCacheFilePath()
+{
+	return FGeoTileAPI::GetCacheFolderPath() + TEXT("TileCache.gpkg");
+}
+
+bool FTileCache::CreateTilesLayer()
+{
+	// Attribute table without any geometry, the georeferencing is stored in each GTiff
+	char** Options = CSLSetNameValue(nullptr, "ASPATIAL_VARIANT", "GPKG_ATTRIBUTES");
+	TilesLayer = Database->CreateLayer(TilesLayerName, nullptr, wkbNone, Options);
+	CSLDestroy(Options);
+
+	if (!TilesLayer)
+	{
+		return false;
+	}
+
+	OGRFieldDefn KeyField(KeyFieldName, OFTString);
+	OGRFieldDefn DataField(DataFieldName, OFTBinary);
+
+	return
+		TilesLayer->CreateField(&KeyField) == OGRERR_NONE &&
+		TilesLayer->CreateField(&DataField) == OGRERR_NONE &&
+		UpgradeTilesLayer();
+}
+
+bool FTileCache::UpgradeTilesLayer()
+{
+	const OGRFeatureDefn* LayerDefn = TilesLayer->GetLayerDefn();
+	const FString Now = FString::Printf(TEXT("%lld"), FDateTime::UtcNow().ToUnixTimestamp());
+
+	// Caches created before tiles were evicted don't have a size or access time
+	if (LayerDefn->GetFieldIndex(SizeFieldName) < 0)
+	{
+		OGRFieldDefn SizeField(SizeFieldName, OFTInteger64);
+		if (TilesLayer->CreateField(&SizeField) != OGRERR_NONE)
+		{
+			return false;
+		}
+
+		const FString Query = FString::Printf(TEXT("UPDATE %s SET %s = length(%s)"),
+			ANSI_TO_TCHAR(TilesLayerName), ANSI_TO_TCHAR(SizeFieldName), ANSI_TO_TCHAR(DataFieldName));
+		Database->ExecuteSQL(TCHAR_TO_UTF8(*Query), nullptr, nullptr);
+	}
+
+	if (LayerDefn->GetFieldIndex(AccessFieldName) < 0)
+	{
+		OGRFieldDefn AccessField(AccessFieldName, OFTInteger64);
+		if (TilesLayer->CreateField(&AccessField) != OGRERR_NONE)
+		{
+			return false;
+		}
+
+		const FString Query = FString::Printf(TEXT("UPDATE %s SET %s = %s"),
+			ANSI_TO_TCHAR(TilesLayerName), ANSI_TO_TCHAR(AccessFieldName), *Now);
+		Database->ExecuteSQL(TCHAR_TO_UTF8(*Query), nullptr, nullptr);
+	}
+
+	return true;
+}
+
+void FTileCache::LoadIndex()
+{
+	Index.Empty();
+	TotalSize = 0;
+
+	// Only the keys are needed so skip reading the tile data
+	const char* IgnoredFields[] = { DataFieldName, nullptr };
+	TilesLayer->SetIgnoredFields(IgnoredFields);
+
+	const OGRFeatureDefn* LayerDefn = TilesLayer->GetLayerDefn();
+	const int KeyFieldIdx = LayerDefn->GetFieldIndex(KeyFieldName);
+	const int SizeFieldIdx = LayerDefn->GetFieldIndex(SizeFieldName);
+	const int AccessFieldIdx = LayerDefn->GetFieldIndex(AccessFieldName);
+	TilesLayer->ResetReading();
+
+	while (OGRFeature* Feature = TilesLayer->GetNextFeature())
+	{
+		FCacheEntry Entry;
+		Entry.FeatureID = Feature->GetFID();
+		Entry.Size = Feature->GetFieldAsInteger64(SizeFieldIdx);
+		Entry.LastAccess = Feature->GetFieldAsInteger64(AccessFieldIdx);
+
+		Index.Add(UTF8_TO_TCHAR(Feature->GetFieldAsString(KeyFieldIdx)), Entry);
+		TotalSize += Entry.Size;
+
+		OGRFeature::DestroyFeature(Feature);
+	}
+
+	TilesLayer->SetIgnoredFields(nullptr);
+}
+
+void FTileCache::FlushPendingTiles()
+{
+	if (!TilesLayer || (PendingTiles.Num() == 0 && AccessedFeatures.Num() == 0))
+	{
+		LastFlushTime = FPlatformTime::Seconds();
+		return;
+	}
+
+	// Writing every tile in one transaction is much faster than a commit per tile
+	const bool bTransaction = Database->StartTransaction() == OGRERR_NONE;
+
+	const int64 Now = FDateTime::UtcNow().ToUnixTimestamp();
+	OGRFeatureDefn* LayerDefn = TilesLayer->GetLayerDefn();
+	const int KeyFieldIdx = LayerDefn->GetFieldIndex(KeyFieldName);
+	const int DataFieldIdx = LayerDefn->GetFieldIndex(DataFieldName);
+	const int SizeFieldIdx = LayerDefn->GetFieldIndex(SizeFieldName);
+	const int AccessFieldIdx = LayerDefn->GetFieldIndex(AccessFieldName);
+
+	TArray<FString> AddedKeys;
+	for (TPair<FString, TArray<uint8>>& Tile : PendingTiles)
+	{
+		OGRFeature* Feature = OGRFeature::CreateFeature(LayerDefn);
+		Feature->SetField(KeyFieldIdx, TCHAR_TO_UTF8(*Tile.Key));
+		Feature->SetField(DataFieldIdx, Tile.Value.Num(), Tile.Value.GetData());
+		Feature->SetField(SizeFieldIdx, (GIntBig)Tile.Value.Num());
+		Feature->SetField(AccessFieldIdx, (GIntBig)Now);
+
+		if (TilesLayer->CreateFeature(Feature) == OGRERR_NONE)
+		{
+			FCacheEntry Entry;
+			Entry.FeatureID = Feature->GetFID();
+			Entry.Size = Tile.Value.Num();
+			Entry.LastAccess = Now;
+
+			Index.Add(Tile.Key, Entry);
+			TotalSize += Entry.Size;
+			AddedKeys.Add(Tile.Key);
+		}
+		OGRFeature::DestroyFeature(Feature);
+	}
+
+	// Update the access time without reading the tile data back
+	const char* FIDColumn = TilesLayer->GetFIDColumn();
+	for (const GIntBig FeatureID : AccessedFeatures)
+	{
+		const FString Query = FString::Printf(
+			TEXT("UPDATE %s SET %s = %lld WHERE %s = %lld"),
+			ANSI_TO_TCHAR(TilesLayerName),
+			ANSI_TO_TCHAR(AccessFieldName),
+			Now,
+			UTF8_TO_TCHAR(FIDColumn),
+			(int64)FeatureID
+			);
+		Database->ExecuteSQL(TCHAR_TO_UTF8(*Query), nullptr, nullptr);
+	}
+
+	if (bTransaction && Database->CommitTransaction() != OGRERR_NONE)
+	{
+		// A failed commit leaves the transaction open which would stop any later one from starting
+		Database->RollbackTransaction();
+		UE_LOG(LogGeoViewer, Warning, TEXT("Failed to write %d tiles to the tile cache, retrying on the next flush."), AddedKeys.Num());
+
+		// None of the tiles made it to disk so they stay pending until the next flush
+		for (const FString& Key : AddedKeys)
+		{
+			TotalSize -= Index[Key].Size;
+			Index.Remove(Key);
+		}
+
+		LastFlushTime = FPlatformTime::Seconds();
+		return;
+	}
+
+	PendingTiles.Empty();
+	AccessedFeatures.Empty();
+	LastFlushTime = FPlatformTime::Seconds();
+}
+
+void FTileCache::StartEviction()
+{
+	if (!TilesLayer || SizeLimit <= 0 || TotalSize <= SizeLimit)
+	{
+		return;
+	}
+
+	if (EvictionTask.IsValid() && !EvictionTask.IsReady())
+	{
+		return;
+	}
+
+	EvictionTask = Async(EAsyncExecution::ThreadPool, [this]()
+	{
+		EvictTiles();
+	});
+}
+
+void FTileCache::EvictTiles()
+{
+	// Order every tile by when it was last used
+	TArray<TPair<int64, FString>> Candidates;
+	int64 TargetSize;
+	{
+		FScopeLock Lock(&CacheLock);
+
+		if (!TilesLayer || SizeLimit <= 0)
+		{
+			return;
+		}
+
+		TargetSize = SizeLimit * EvictionTargetRatio;
+		Candidates.Reserve(Index.Num());
+		for (const TPair<FString, FCacheEntry>& Tile : Index)
+		{
+			Candidates.Emplace(Tile.Value.LastAccess, Tile.Key);
+		}
+	}
+
+	Candidates.Sort([](const TPair<int64, FString>& A, const TPair<int64, FString>& B)
+	{
+		return A.Key < B.Key;
+	});
+
+	int CandidateIdx = 0;
+	while (CandidateIdx < Candidates.Num())
+	{
+		FScopeLock Lock(&CacheLock);
+
+		// The cache may have been closed or the limit raised while the lock was released
+		if (!TilesLayer || SizeLimit <= 0 || TotalSize <= TargetSize)
+		{
+			break;
+		}
+
+		const bool bTransaction = Database->StartTransaction() == OGRERR_NONE;
+
+		// The index is only changed once the rows are really gone from the file
+		TArray<FString> DeletedKeys;
+		int64 DeletedSize = 0;
+		for (int i = 0; i < EvictionBatchSize && CandidateIdx < Candidates.Num() && TotalSize - DeletedSize > TargetSize; i++)
+		{
+			const TPair<int64, FString>& Candidate = Candidates[CandidateIdx++];
+
+			// Skip tiles that have been opened since the candidates were sorted
+			const FCacheEntry* Entry = Index.Find(Candidate.Value);
+			if (!Entry || Entry->LastAccess != Candidate.Key)
+			{
+				continue;
+			}
+
+			if (TilesLayer->DeleteFeature(Entry->FeatureID) == OGRERR_NONE)
+			{
+				DeletedKeys.Add(Candidate.Value);
+				DeletedSize += Entry->Size;
+			}
+		}
+
+		if (bTransaction && Database->CommitTransaction() != OGRERR_NONE)
+		{
+			Database->RollbackTransaction();
+			UE_LOG(LogGeoViewer, Warning, TEXT("Failed to remove old tiles from the tile cache."));
+			break;
+		}
+
+		for (const FString& Key : DeletedKeys)
+		{
+			const FCacheEntry Entry = Index.FindAndRemoveChecked(Key);
+			AccessedFeatures.Remove(Entry.FeatureID);
+			TotalSize -= Entry.Size;
+			Evictions++;
+		}
+	}
+
+	// The space used by removed tiles is reused by new tiles rather than shrinking the file
+	FScopeLock Lock(&CacheLock);
+	UE_LOG(LogGeoViewer, Log, TEXT("Tile cache reduced to %.1f MB, %lld tiles evicted in total."), TotalSize / (1024.0 * 1024.0), Evictions);
+}
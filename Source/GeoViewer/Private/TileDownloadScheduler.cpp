@@ -0,0 +1,229 @@
+﻿#include "TileDownloadScheduler.h"
+#include "Async/Async.h"
+#include "GeoViewerSettings.h"
+#include "TileDownloader.h"
+
+FTileDownloadScheduler::FTileDownloadScheduler(): bHasFocus(false)
+{
+}
+
+FTileDownloadScheduler& FTileDownloadScheduler::Get()
+{
+	static FTileDownloadScheduler Scheduler;
+	return Scheduler;
+}
+
+void FTileDownloadScheduler::QueueDownload(const TSharedRef<FTileDownloader>& Downloader)
+{
+	check(IsInGameThread());
+
+	Downloads.Add(Downloader->GetKey(), Downloader);
+
+	const FName Provider = Downloader->GetProvider();
+	GetProviderQueue(Provider).Pending.Add(Downloader);
+	ProcessQueue(Provider);
+}
+
+TSharedPtr<FTileDownloader> FTileDownloadScheduler::FindDownload(const FString& Key) const
+{
+	check(IsInGameThread());
+
+	const TWeakPtr<FTileDownloader>* Downloader = Downloads.Find(Key);
+	return Downloader ? Downloader->Pin() : nullptr;
+}
+
+void FTileDownloadScheduler::RemoveDownload(const FString& Key, const FTileDownloader* Downloader)
+{
+	// Only remove the entry if it hasn't been replaced by a newer download of the same segment
+	const TWeakPtr<FTileDownloader>* Existing = Downloads.Find(Key);
+	if (Existing && (!Existing->IsValid() || Existing->HasSameObject(Downloader)))
+	{
+		Downloads.Remove(Key);
+	}
+}
+
+void FTileDownloadScheduler::OnDownloadFinished(const FName Provider, const double Latency, const int32 ResponseCode)
+{
+	check(IsInGameThread());
+
+	FProviderQueue& Queue = GetProviderQueue(Provider);
+	Queue.InFlight = FMath::Max(Queue.InFlight - 1, 0);
+
+	const UGeoViewerSettings* Settings = GetDefault<UGeoViewerSettings>();
+	const float MaxLimit = GetMaxConcurrentDownloads(Provider);
+
+	if (Settings->bAdaptiveConcurrency)
+	{
+		if (ResponseCode == 429 || ResponseCode == 503)
+		{
+			// The server is rejecting requests so halve the number being sent
+			Queue.ConcurrencyLimit = FMath::Max(Queue.ConcurrencyLimit / 2, 1.f);
+		}
+		else if (Latency >= 0)
+		{
+			if (Queue.BaselineLatency <= 0)
+			{
+				Queue.BaselineLatency = Latency;
+				Queue.AverageLatency = Latency;
+			}
+
+			// Let the baseline drift up slowly so one fast response doesn't hold the limit down forever
+			Queue.BaselineLatency = FMath::Min(Latency, Queue.BaselineLatency + (Latency - Queue.BaselineLatency) * 0.01);
+			Queue.AverageLatency += (Latency - Queue.AverageLatency) * 0.2;
+
+			if (Queue.AverageLatency > Queue.BaselineLatency * 2)
+			{
+				// Requests are queuing up on the server, remove roughly one slot per window of requests
+				Queue.ConcurrencyLimit = FMath::Max(Queue.ConcurrencyLimit - 1 / Queue.ConcurrencyLimit, 1.f);
+			}
+			else
+			{
+				// Add roughly one slot per window of requests
+				Queue.ConcurrencyLimit = FMath::Min(Queue.ConcurrencyLimit + 1 / Queue.ConcurrencyLimit, MaxLimit);
+			}
+		}
+	}
+	else
+	{
+		Queue.ConcurrencyLimit = MaxLimit;
+	}
+
+	ProcessQueue(Provider);
+}
+
+void FTileDownloadScheduler::OnDownloadAbandoned(const FName Provider)
+{
+	FProviderQueue& Queue = GetProviderQueue(Provider);
+	Queue.InFlight = FMath::Max(Queue.InFlight - 1, 0);
+
+	ProcessQueue(Provider);
+}
+
+void FTileDownloadScheduler::SetFocus(const FGeographicCoordinates& InFocus)
+{
+	Focus = InFocus;
+	bHasFocus = true;
+}
+
+int32 FTileDownloadScheduler::GetNumInFlight(const FName Provider) const
+{
+	const FProviderQueue* Queue = Providers.Find(Provider);
+	return Queue ? Queue->InFlight : 0;
+}
+
+int32 FTileDownloadScheduler::GetNumPending(const FName Provider) const
+{
+	const FProviderQueue* Queue = Providers.Find(Provider);
+	return Queue ? Queue->Pending.Num() : 0;
+}
+
+void FTileDownloadScheduler::ProcessQueue(const FName Provider)
+{
+	FProviderQueue& Queue = GetProviderQueue(Provider);
+
+	while (Queue.InFlight < FMath::FloorToInt(Queue.ConcurrencyLimit) && Queue.Pending.Num() > 0)
+	{
+		const TSharedPtr<FTileDownloader> Downloader = PopNextDownloader(Queue);
+		if (!Downloader.IsValid())
+		{
+			// Only downloaders that have already been destroyed were left in the queue
+			break;
+		}
+
+		if (Downloader->StartRequest())
+		{
+			Queue.InFlight++;
+			continue;
+		}
+
+		// Tiles requesting the segment from now on start a new download instead of waiting on this one
+		RemoveDownload(Downloader->GetKey(), Downloader.Get());
+
+		// Listeners may queue more downloads, so tell them once the queue is no longer being processed
+		AsyncTask(ENamedThreads::GameThread, [Downloader]()
+		{
+			Downloader->DecodedTile.Reset();
+			Downloader->OnDownloaded.Broadcast(Downloader.Get());
+		});
+	}
+}
+
+TSharedPtr<FTileDownloader> FTileDownloadScheduler::PopNextDownloader(FProviderQueue& Queue) const
+{
+	int BestIdx = INDEX_NONE;
+	double BestPriority = 0;
+	TSharedPtr<FTileDownloader> BestDownloader;
+
+	for (int i = Queue.Pending.Num() - 1; i >= 0; i--)
+	{
+		const TSharedPtr<FTileDownloader> Downloader = Queue.Pending[i].Pin();
+
+		// Tile APIs that are no longer needed release or cancel their downloaders
+		if (!Downloader.IsValid() || Downloader->IsCancelled())
+		{
+			Queue.Pending.RemoveAt(i);
+			if (BestIdx != INDEX_NONE)
+			{
+				BestIdx--;
+			}
+			continue;
+		}
+
+		const double Priority = GetPriority(*Downloader);
+		if (BestIdx == INDEX_NONE || Priority <= BestPriority)
+		{
+			BestIdx = i;
+			BestPriority = Priority;
+			BestDownloader = Downloader;
+		}
+	}
+
+	if (BestIdx != INDEX_NONE)
+	{
+		Queue.Pending.RemoveAt(BestIdx);
+	}
+
+	return BestDownloader;
+}
+
+double FTileDownloadScheduler::GetPriority(const FTileDownloader& Downloader) const
+{
+	// Larger than any distance so prefetches always wait for segments that are needed now
+	const double PrefetchBias = Downloader.IsPrefetch() ? 1e6 : 0;
+
+	if (!bHasFocus)
+	{
+		return PrefetchBias;
+	}
+
+	// Squared distance in degrees, good enough for ordering nearby segments
+	const FGeographicCoordinates& Location = Downloader.GetLocation();
+	const double DeltaLat = Location.Latitude - Focus.Latitude;
+	const double DeltaLon = (Location.Longitude - Focus.Longitude) * FMath::Cos(FMath::DegreesToRadians(Focus.Latitude));
+
+	return PrefetchBias + DeltaLat * DeltaLat + DeltaLon * DeltaLon;
+}
+
+FTileDownloadScheduler::FProviderQueue& FTileDownloadScheduler::GetProviderQueue(const FName Provider)
+{
+	if (FProviderQueue* Queue = Providers.Find(Provider))
+	{
+		return *Queue;
+	}
+
+	FProviderQueue& NewQueue = Providers.Add(Provider);
+	NewQueue.ConcurrencyLimit = GetMaxConcurrentDownloads(Provider);
+	return NewQueue;
+}
+
+int32 FTileDownloadScheduler::GetMaxConcurrentDownloads(const FName Provider)
+{
+	const UGeoViewerSettings* Settings = GetDefault<UGeoViewerSettings>();
+
+	if (const int32* ProviderLimit = Settings->ProviderDownloadLimits.Find(Provider))
+	{
+		return FMath::Max(*ProviderLimit, 1);
+	}
+
+	return FMath::Max(Settings->MaxConcurrentDownloads, 1);
+}
@@ -1,17 +1,81 @@
 #include "TileDownloader.h"
 #include "GDALWarp.h"
+#include "Engine/Engine.h"
 #include "HttpModule.h"
+#include "HAL/FileManager.h"
+#include "Async/Async.h"
 #include "IImageWrapper.h"
 #include "IImageWrapperModule.h"
 #include "Interfaces/IHttpResponse.h"
-#include "TileAPIS/GeoTileAPI.h"
+#include "Misc/FileHelper.h"
+#include "TileCache.h"
+#include "TileDownloadScheduler.h"
 
-FTileDownloader::FTileDownloader(): FinalDataset(nullptr), EPSG(0)
+/** Number of times a request is sent again when the server responds with 429 or 503 */
+static constexpr int MaxRetries = 3;
+
+FTileDownloader::FTileDownloader(): SegmentSize(FVector2D::ZeroVector), EPSG(0), Provider(NAME_None), bPrefetch(false), RequestStartTime(0), RetryCount(0), DownloadedBytes(0)
 {
+	CacheEncoding = GetDefault<UGeoViewerSettings>()->CacheEncoding;
 }
 
 FTileDownloader::~FTileDownloader()
 {
+	FTileDownloadScheduler::Get().RemoveDownload(FileName, this);
+
+	// Stop the request from using a slot now nothing is waiting for it
+	AbortRequest();
+}
+
+void FTileDownloader::AbortRequest()
+{
+	if (PendingRequest.IsValid())
+	{
+		PendingRequest->OnProcessRequestComplete().Unbind();
+		PendingRequest->CancelRequest();
+		PendingRequest.Reset();
+
+		FTileDownloadScheduler::Get().OnDownloadAbandoned(Provider);
+	}
+}
+
+void FTileDownloader::AddCancellationToken(const FTileCancellationTokenRef& Token)
+{
+	CancellationTokens.AddUnique(Token);
+}
+
+bool FTileDownloader::IsCancelled() const
+{
+	return AreAllCancelled(CancellationTokens);
+}
+
+bool FTileDownloader::AreAllCancelled(const TArray<FTileCancellationTokenRef>& Tokens)
+{
+	if (Tokens.Num() == 0)
+	{
+		return false;
+	}
+
+	for (const FTileCancellationTokenRef& Token : Tokens)
+	{
+		if (!Token->IsCancelled())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void FTileDownloader::OnTileCancelled()
+{
+	if (IsCancelled())
+	{
+		// Tiles requesting the segment from now on start a new download, a queued
+		// request is dropped by the scheduler when it reaches the front.
+		FTileDownloadScheduler::Get().RemoveDownload(FileName, this);
+		AbortRequest();
+	}
 }
 
 void FTileDownloader::SetMetaData(FVector InTopCorner, FVector2D InPixelSize, uint16 InEPSG)
@@ -21,19 +85,56 @@ void FTileDownloader::SetMetaData(FVector InTopCorner, FVector2D InPixelSize, ui
 	EPSG = InEPSG;
 }
 
-//Based on FWebImage
+void FTileDownloader::SetExtentMetaData(const FVector InTopCorner, const FVector2D InSegmentSize, const uint16 InEPSG)
+{
+	TopCorner = InTopCorner;
+	SegmentSize = InSegmentSize;
+	EPSG = InEPSG;
+}
+
+void FTileDownloader::SetSchedulingInfo(const FName InProvider, const FGeographicCoordinates& InLocation)
+{
+	Provider = InProvider;
+	Location = InLocation;
+}
+
+void FTileDownloader::SetCacheEncoding(const ETileCacheEncoding InCacheEncoding)
+{
+	CacheEncoding = InCacheEncoding;
+}
+
 bool FTileDownloader::BeginDownload(FString InURL, FString InFileName)
 {
 	FileName = InFileName;
+	URL = InURL;
 	
-	if (InURL.IsEmpty())
+	if (URL.IsEmpty())
 	{
 		return false;
 	}
 
+	// Files on disk don't need a request slot so are read straight away
+	if (IsLocalFile(URL))
+	{
+		StartDecoding(nullptr);
+		return true;
+	}
+
+	FTileDownloadScheduler::Get().QueueDownload(AsShared());
+	return true;
+}
+
+bool FTileDownloader::IsLocalFile(const FString& InURL)
+{
+	return !InURL.StartsWith(TEXT("http://")) && !InURL.StartsWith(TEXT("https://"));
+}
+
+//Based on FWebImage
+bool FTileDownloader::StartRequest()
+{
 	const TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest = FHttpModule::Get().CreateRequest();
 	HttpRequest->SetVerb(TEXT("GET"));
-	HttpRequest->SetURL(InURL);
+	HttpRequest->SetURL(URL);
 	HttpRequest->SetHeader(TEXT("Accept"), TEXT("image/png, image/x-png, image/jpeg; q=0.8, image/vnd.microsoft.icon, image/x-icon, image/bmp, image/*; q=0.5, image/webp; q=0.0"));
 	HttpRequest->OnProcessRequestComplete().BindSP(this, &FTileDownloader::DownloadFinished);
 
@@ -42,6 +143,7 @@ bool FTileDownloader::BeginDownload(FString InURL, FString InFileName)
 		return false;
 	}
 
+	RequestStartTime = FPlatformTime::Seconds();
 	PendingRequest = HttpRequest;
 	return true;
 }
@@ -58,11 +160,120 @@ void FTileDownloader::DownloadFinished(FHttpRequestPtr HttpRequest, FHttpRespons
 		HttpRequest->OnProcessRequestComplete().Unbind();
 	}
 
-	// build an image wrapper for this type
+	// Let the scheduler know the provider has a free slot
+	const int32 ResponseCode = HttpResponse.IsValid() ? HttpResponse->GetResponseCode() : 0;
+	const double Latency = bSucceeded ? FPlatformTime::Seconds() - RequestStartTime : -1;
+	FTileDownloadScheduler& Scheduler = FTileDownloadScheduler::Get();
+	Scheduler.OnDownloadFinished(Provider, Latency, ResponseCode);
+
+	// The server is too busy, try again once the scheduler has backed off
+	if ((ResponseCode == 429 || ResponseCode == 503) && RetryCount < MaxRetries)
+	{
+		RetryCount++;
+		Scheduler.QueueDownload(AsShared());
+		return;
+	}
+
+	if (!bSucceeded || !HttpResponse.IsValid())
+	{
+		GEngine->AddOnScreenDebugMessage(1, 5.f, FColor::Red, "Geo Viewer: Failed to download tile");
+		Scheduler.RemoveDownload(FileName, this);
+		OnDownloaded.Broadcast(this);
+		return;
+	}
+
+	DownloadedBytes = HttpResponse->GetContent().Num();
+	StartDecoding(HttpResponse);
+}
+
+void FTileDownloader::StartDecoding(FHttpResponsePtr HttpResponse)
+{
+	// The image wrapper module must be loaded on the game thread
 	static const FName MODULE_IMAGE_WRAPPER("ImageWrapper");
-	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(MODULE_IMAGE_WRAPPER);
-	
-	const TArray<uint8>& Content = HttpResponse->GetContent();
+	IImageWrapperModule* ImageWrapperModule = &FModuleManager::LoadModuleChecked<IImageWrapperModule>(MODULE_IMAGE_WRAPPER);
+
+	// Decoding and encoding the GTiff takes too long for the game thread, only the
+	// decoded tile is passed back once the work is done.
+	const int32 JPEGQuality = GetDefault<UGeoViewerSettings>()->CacheJPEGQuality;
+	const FString FilePath = URL.StartsWith(TEXT("file://")) ? URL.RightChop(7) : URL;
+	if (!HttpResponse.IsValid())
+	{
+		DownloadedBytes = FMath::Max<int64>(IFileManager::Get().FileSize(*FilePath), 0);
+	}
+
+	const TWeakPtr<FTileDownloader> WeakThis = AsShared();
+	Async(EAsyncExecution::ThreadPool,
+		[WeakThis, ImageWrapperModule, HttpResponse, FilePath, CacheKey = FileName, TopCorner = TopCorner,
+		 PixelSize = PixelSize, SegmentSize = SegmentSize, EPSG = EPSG, Encoding = CacheEncoding, JPEGQuality,
+		 Tokens = CancellationTokens]()
+	{
+		// Skip decoding if every tile waiting for the segment was cancelled during the download
+		FDecodedTilePtr Tile;
+		const bool bSkipped = AreAllCancelled(Tokens);
+		if (!bSkipped)
+		{
+			if (HttpResponse.IsValid())
+			{
+				Tile = DecodeTile(*ImageWrapperModule, HttpResponse->GetContent(), CacheKey,
+					TopCorner, PixelSize, SegmentSize, EPSG, Encoding, JPEGQuality);
+			}
+			else
+			{
+				TArray<uint8> Content;
+				if (FFileHelper::LoadFileToArray(Content, *FilePath))
+				{
+					Tile = DecodeTile(*ImageWrapperModule, Content, CacheKey,
+						TopCorner, PixelSize, SegmentSize, EPSG, Encoding, JPEGQuality);
+				}
+			}
+		}
+
+		// If the downloader is gone the tile is still kept in the caches
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Tile, bSkipped, HttpResponse]()
+		{
+			if (const TSharedPtr<FTileDownloader> Downloader = WeakThis.Pin())
+			{
+				// The tokens were copied when decoding started, a tile may have
+				// started waiting for the segment since then so decode it after all
+				if (bSkipped && !Downloader->IsCancelled())
+				{
+					Downloader->StartDecoding(HttpResponse);
+					return;
+				}
+
+				Downloader->OnTileDecoded(Tile);
+			}
+		});
+	});
+}
+
+void FTileDownloader::OnTileDecoded(const FDecodedTilePtr& Tile)
+{
+	DecodedTile = Tile;
+
+	if (!DecodedTile.IsValid() && !IsCancelled())
+	{
+		GEngine->AddOnScreenDebugMessage(1, 5.f, FColor::Red, "Geo Viewer: Failed to download tile");
+	}
+
+	// Tiles requesting the segment from now on will find it in the memory cache
+	FTileDownloadScheduler::Get().RemoveDownload(FileName, this);
+	OnDownloaded.Broadcast(this);
+}
+
+FDecodedTilePtr FTileDownloader::DecodeTile(
+	IImageWrapperModule& ImageWrapperModule,
+	const TArray<uint8>& Content,
+	const FString& CacheKey,
+	const FVector InTopCorner,
+	const FVector2D InPixelSize,
+	const FVector2D InSegmentSize,
+	const uint16 InEPSG,
+	const ETileCacheEncoding Encoding,
+	const int32 JPEGQuality
+	)
+{
+	// build an image wrapper for this type
 	const EImageFormat ImageFormat = ImageWrapperModule.DetectImageFormat(Content.GetData(), Content.Num());
 
 	const TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(ImageFormat);
@@ -70,9 +281,7 @@ void FTileDownloader::DownloadFinished(FHttpRequestPtr HttpRequest, FHttpRespons
 	// Parse the content
 	if (!ImageWrapper || !ImageWrapper->SetCompressed(Content.GetData(), Content.Num()))
 	{
-		GEngine->AddOnScreenDebugMessage(1, 5.f, FColor::Red, "Geo Viewer: Failed to download tile");
-		OnDownloaded.Execute(this);
-		return;
+		return nullptr;
 	}
 
 	// Get raw image data from ImageWrapper
@@ -82,44 +291,100 @@ void FTileDownloader::DownloadFinished(FHttpRequestPtr HttpRequest, FHttpRespons
 	const int XSize = ImageWrapper->GetWidth();
 	const int YSize = ImageWrapper->GetHeight();
 
-	GDALAllRegister();
-	
-	// Create and store dataset
+	// Web tiles are always opaque so the alpha channel is only kept when uncompressed,
+	// the tile APIs add an alpha band back when the segments are merged.
+	int BandNum = 3;
+	char** CreationOptions = nullptr;
+	switch (Encoding)
+	{
+	case ETileCacheEncoding::JPEG:
+		CreationOptions = CSLSetNameValue(CreationOptions, "TILED", "YES");
+		CreationOptions = CSLSetNameValue(CreationOptions, "COMPRESS", "JPEG");
+		CreationOptions = CSLSetNameValue(CreationOptions, "PHOTOMETRIC", "YCBCR");
+		CreationOptions = CSLSetNameValue(CreationOptions, "JPEG_QUALITY", TCHAR_TO_UTF8(*FString::FromInt(JPEGQuality)));
+		break;
+	case ETileCacheEncoding::Deflate:
+		CreationOptions = CSLSetNameValue(CreationOptions, "TILED", "YES");
+		CreationOptions = CSLSetNameValue(CreationOptions, "COMPRESS", "DEFLATE");
+		CreationOptions = CSLSetNameValue(CreationOptions, "PREDICTOR", "2");
+		break;
+	case ETileCacheEncoding::Uncompressed:
+		BandNum = 4;
+		break;
+	}
+
+	// Create the GTiff in memory
+	const FGuid DatasetGuid = FGuid::NewGuid();
+	const FString FilePath = "/vsimem/" + DatasetGuid.ToString() + ".tif";
 	const char* DriverName = "GTiff";
 	GDALDriver* GTiffDriver = GetGDALDriverManager()->GetDriverByName(DriverName);
 	check(GTiffDriver)
 
 	GDALDataType GdalType = mergetiff::DatatypeConversion::primitiveToGdal<uint8>();
-	const FString CacheFolder = FGeoTileAPI::GetCacheFolderPath();
-	const FString FilePath = CacheFolder + FileName + TEXT(".tif");
 	GDALDataset* SavedDataset = GTiffDriver->Create(
 		TCHAR_TO_UTF8(*FilePath),
 		XSize,
 		YSize,
-		4,
+		BandNum,
 		GdalType,
-		nullptr
+		CreationOptions
 		);
+	CSLDestroy(CreationOptions);
 
 	GDALDatasetRef DownloadedDataset(SavedDataset);
-
-	FGDALWarp::SetDatasetMetaData(DownloadedDataset, TopCorner, PixelSize, EPSG);
-	
-	const mergetiff::RasterData<uint8> RasterData(
-			RawImageData.GetData(),
-			4,
-			YSize,
-			XSize,
-			true
-			);
-	
-	if (mergetiff::RasterIO::writeDataset(DownloadedDataset, RasterData))
+	if (!DownloadedDataset.IsValid())
 	{
-		// Close the asset to ensure it's saved then reopen it in read only mode
-		//GDALDataset* OldDataset = DownloadedDataset.Release();
-		//GDALClose(OldDataset);
+		return nullptr;
+	}
+
+	// Servers may send a larger image than requested so the pixel size comes from the actual size
+	const FVector2D DatasetPixelSize = InSegmentSize.IsZero() ? InPixelSize : InSegmentSize / FVector2D(XSize, YSize);
+	FGDALWarp::SetDatasetMetaData(DownloadedDataset, InTopCorner, DatasetPixelSize, InEPSG);
 
-		FinalDataset = DownloadedDataset.Release();
-		OnDownloaded.Execute(this);
+	// Write the first 'BandNum' channels straight from the interleaved RGBA image
+	constexpr int PixelSpace = 4;
+	const CPLErr Error = DownloadedDataset->RasterIO(
+		GF_Write,
+		0,
+		0,
+		XSize,
+		YSize,
+		RawImageData.GetData(),
+		XSize,
+		YSize,
+		GdalType,
+		BandNum,
+		nullptr,
+		PixelSpace,
+		PixelSpace * XSize,
+		1
+		);
+
+	if (Error == CE_None)
+	{
+		// Write the GTiff headers so the in-memory file is complete, then copy it to the cache
+		DownloadedDataset->FlushCache();
+		vsi_l_offset FileLength = 0;
+		const GByte* FileData = VSIGetMemFileBuffer(TCHAR_TO_UTF8(*FilePath), &FileLength, FALSE);
+		if (FileData && FileLength > 0)
+		{
+			TArray<uint8> EncodedTile(FileData, static_cast<int32>(FileLength));
+			FTileCache::Get().StoreTile(CacheKey, MoveTemp(EncodedTile));
+		}
 	}
+
+	// The decoded RGBA image is kept in memory rather than reading the GTiff back
+	const TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> Tile = MakeShared<FDecodedTile, ESPMode::ThreadSafe>();
+	DownloadedDataset->GetGeoTransform(Tile->GeoTransform);
+	Tile->ProjectionWKT = UTF8_TO_TCHAR(DownloadedDataset->GetProjectionRef());
+	Tile->XSize = XSize;
+	Tile->YSize = YSize;
+	Tile->Bands = 4;
+	Tile->Pixels = MoveTemp(RawImageData);
+
+	DownloadedDataset.Reset();
+	VSIUnlink(TCHAR_TO_UTF8(*FilePath));
+
+	FTileMemoryCache::Get().Add(CacheKey, Tile);
+	return Tile;
 }
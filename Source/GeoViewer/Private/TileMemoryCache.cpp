@@ -0,0 +1,160 @@
+﻿#include "TileMemoryCache.h"
+#include "GDALWarp.h"
+
+/** Upper limit on the number of segments, the size limit is normally reached first */
+static constexpr int32 MaxTiles = 4096;
+
+/////////////////////////////////////////////////////
+// FDecodedTile
+
+GDALDataset* FDecodedTile::CreateDataset() const
+{
+	if (Pixels.Num() == 0)
+	{
+		return nullptr;
+	}
+
+	// The MEM driver can open existing memory by name, which also lets GDALBuildVRT reopen it
+	GDALDataset* Dataset = FGDALWarp::OpenMemoryDataset(Pixels.GetData(), DataType, XSize, YSize, Bands);
+	if (Dataset)
+	{
+		Dataset->SetGeoTransform(const_cast<double*>(GeoTransform));
+		Dataset->SetProjection(TCHAR_TO_UTF8(*ProjectionWKT));
+	}
+
+	return Dataset;
+}
+
+TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> FDecodedTile::CreateFromDataset(GDALDataset* Dataset)
+{
+	if (!Dataset || Dataset->GetRasterCount() == 0)
+	{
+		return nullptr;
+	}
+
+	const TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> Tile = MakeShared<FDecodedTile, ESPMode::ThreadSafe>();
+	Tile->XSize = Dataset->GetRasterXSize();
+	Tile->YSize = Dataset->GetRasterYSize();
+	Tile->Bands = Dataset->GetRasterCount();
+	Tile->DataType = Dataset->GetRasterBand(1)->GetRasterDataType();
+
+	const int ValueSize = GDALGetDataTypeSizeBytes(Tile->DataType);
+	Tile->Pixels.SetNumUninitialized(Tile->XSize * Tile->YSize * Tile->Bands * ValueSize);
+
+	const CPLErr Error = Dataset->RasterIO(
+		GF_Read,
+		0,
+		0,
+		Tile->XSize,
+		Tile->YSize,
+		Tile->Pixels.GetData(),
+		Tile->XSize,
+		Tile->YSize,
+		Tile->DataType,
+		Tile->Bands,
+		nullptr,
+		ValueSize * Tile->Bands,
+		(GSpacing)ValueSize * Tile->XSize * Tile->Bands,
+		ValueSize
+		);
+
+	if (Error != CE_None)
+	{
+		return nullptr;
+	}
+
+	Dataset->GetGeoTransform(Tile->GeoTransform);
+	Tile->ProjectionWKT = UTF8_TO_TCHAR(Dataset->GetProjectionRef());
+
+	return Tile;
+}
+
+/////////////////////////////////////////////////////
+// FTileMemoryCache
+
+FTileMemoryCache::FTileMemoryCache(): Tiles(MaxTiles), TotalSize(0), SizeLimit(0)
+{
+}
+
+FTileMemoryCache& FTileMemoryCache::Get()
+{
+	static FTileMemoryCache Cache;
+	return Cache;
+}
+
+FDecodedTilePtr FTileMemoryCache::Find(const FString& Key)
+{
+	FScopeLock Lock(&CacheLock);
+
+	if (const FDecodedTilePtr* Tile = Tiles.FindAndTouch(Key))
+	{
+		return *Tile;
+	}
+
+	return nullptr;
+}
+
+void FTileMemoryCache::Add(const FString& Key, const FDecodedTilePtr& Tile)
+{
+	FScopeLock Lock(&CacheLock);
+
+	if (!Tile.IsValid() || Tile->GetSize() > SizeLimit)
+	{
+		return;
+	}
+
+	if (const FDecodedTilePtr* ExistingTile = Tiles.Find(Key))
+	{
+		TotalSize -= (*ExistingTile)->GetSize();
+		Tiles.Remove(Key);
+	}
+
+	Trim(Tile->GetSize());
+
+	Tiles.Add(Key, Tile);
+	TotalSize += Tile->GetSize();
+}
+
+void FTileMemoryCache::Empty()
+{
+	FScopeLock Lock(&CacheLock);
+
+	Tiles.Empty(MaxTiles);
+	TotalSize = 0;
+}
+
+void FTileMemoryCache::SetSizeLimit(const int64 InSizeLimit)
+{
+	FScopeLock Lock(&CacheLock);
+
+	SizeLimit = FMath::Max<int64>(InSizeLimit, 0);
+	Trim(0);
+}
+
+int32 FTileMemoryCache::GetNum() const
+{
+	FScopeLock Lock(&CacheLock);
+	return Tiles.Num();
+}
+
+int64 FTileMemoryCache::GetSize() const
+{
+	FScopeLock Lock(&CacheLock);
+	return TotalSize;
+}
+
+int64 FTileMemoryCache::GetSizeLimit() const
+{
+	FScopeLock Lock(&CacheLock);
+	return SizeLimit;
+}
+
+void FTileMemoryCache::Trim(const int64 ExtraSize)
+{
+	const int32 ExtraTiles = ExtraSize > 0 ? 1 : 0;
+	while (Tiles.Num() > 0 && (TotalSize + ExtraSize > SizeLimit || Tiles.Num() + ExtraTiles > Tiles.Max()))
+	{
+		const FDecodedTilePtr RemovedTile = Tiles.RemoveLeastRecent();
+		TotalSize -= RemovedTile->GetSize();
+	}
+}
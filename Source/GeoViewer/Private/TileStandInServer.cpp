@@ -0,0 +1,190 @@
+﻿#include "TileStandInServer.h"
+
+#include "GeoViewer.h"
+#include "HttpPath.h"
+#include "HttpServerModule.h"
+#include "HttpServerResponse.h"
+#include "IHttpRouter.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+
+FTileStandInServer::FTileStandInServer(): Random(0), NumRequests(0)
+{
+}
+
+FTileStandInServer::~FTileStandInServer()
+{
+	Stop();
+}
+
+bool FTileStandInServer::Start(const FTileStandInSettings& InSettings)
+{
+	Stop();
+	Settings = InSettings;
+	NumRequests = 0;
+
+	for (const ETileStandInFormat Format : {ETileStandInFormat::PNG, ETileStandInFormat::JPEG, ETileStandInFormat::TerrainRGB})
+	{
+		TArray<uint8> Tile = CreateTile(Format, Settings.TileResolution);
+		if (Tile.Num() == 0)
+		{
+			UE_LOG(LogGeoViewer, Error, TEXT("Tile stand-in server failed to encode the synthetic tiles"));
+			return false;
+		}
+		Tiles.Add(Format, MoveTemp(Tile));
+	}
+
+	FHttpServerModule& HttpServerModule = FHttpServerModule::Get();
+	Router = HttpServerModule.GetHttpRouter(Settings.Port);
+	if (!Router.IsValid())
+	{
+		UE_LOG(LogGeoViewer, Error, TEXT("Tile stand-in server could not listen on port %u"), Settings.Port);
+		return false;
+	}
+
+	auto BindFormat = [this](const TCHAR* Path, const ETileStandInFormat Format)
+	{
+		// Routes match every path below them so the tile coordinates are ignored
+		RouteHandles.Add(Router->BindRoute(FHttpPath(Path), EHttpServerRequestVerbs::VERB_GET,
+			[this, Format](const FHttpServerRequest& Request, const FHttpResultCallback& OnComplete)
+			{
+				QueueResponse(Format, OnComplete);
+				return true;
+			}));
+	};
+	BindFormat(TEXT("/png"), ETileStandInFormat::PNG);
+	BindFormat(TEXT("/jpg"), ETileStandInFormat::JPEG);
+	BindFormat(TEXT("/terrain"), ETileStandInFormat::TerrainRGB);
+
+	HttpServerModule.StartAllListeners();
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FTileStandInServer::Tick));
+
+	return true;
+}
+
+void FTileStandInServer::Stop()
+{
+	if (TickerHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+
+	// Listeners are shared with every other server in the editor so only our routes are removed,
+	// requests to them are answered with a 404 from now on
+	if (Router.IsValid())
+	{
+		for (const FHttpRouteHandle& Handle : RouteHandles)
+		{
+			Router->UnbindRoute(Handle);
+		}
+	}
+
+	RouteHandles.Empty();
+	Router.Reset();
+	PendingResponses.Empty();
+	Tiles.Empty();
+}
+
+FString FTileStandInServer::GetURLTemplate(const ETileStandInFormat Format) const
+{
+	const TCHAR* Path = Format == ETileStandInFormat::PNG ? TEXT("png") : Format == ETileStandInFormat::JPEG ? TEXT("jpg") : TEXT("terrain");
+	return FString::Printf(TEXT("http://127.0.0.1:%u/%s/{z}/{x}/{y}"), Settings.Port, Path);
+}
+
+void FTileStandInServer::QueueResponse(const ETileStandInFormat Format, const FHttpResultCallback& OnComplete)
+{
+	NumRequests++;
+
+	// Responses are slower the larger the tile is when the bandwidth is limited
+	double Delay = Settings.Latency + Random.FRandRange(-Settings.Jitter, Settings.Jitter);
+	if (Settings.Bandwidth > 0)
+	{
+		Delay += Tiles[Format].Num() / Settings.Bandwidth;
+	}
+
+	FPendingResponse& Response = PendingResponses.AddDefaulted_GetRef();
+	Response.SendTime = FPlatformTime::Seconds() + FMath::Max(Delay, 0.0);
+	Response.Format = Format;
+	Response.bFailed = Random.FRand() < Settings.ErrorRate;
+	Response.OnComplete = OnComplete;
+}
+
+bool FTileStandInServer::Tick(float DeltaTime)
+{
+	const double CurrentTime = FPlatformTime::Seconds();
+
+	for (int i = PendingResponses.Num() - 1; i >= 0; i--)
+	{
+		const FPendingResponse& Pending = PendingResponses[i];
+		if (Pending.SendTime > CurrentTime)
+		{
+			continue;
+		}
+
+		TUniquePtr<FHttpServerResponse> Response;
+		if (Pending.bFailed)
+		{
+			Response = FHttpServerResponse::Error(EHttpServerResponseCodes::ServiceUnavail);
+		}
+		else
+		{
+			Response = MakeUnique<FHttpServerResponse>();
+			Response->Code = EHttpServerResponseCodes::Ok;
+			Response->Headers.Add(TEXT("Content-Type"), {Pending.Format == ETileStandInFormat::JPEG ? TEXT("image/jpeg") : TEXT("image/png")});
+			Response->Body = Tiles[Pending.Format];
+		}
+
+		Pending.OnComplete(MoveTemp(Response));
+		PendingResponses.RemoveAtSwap(i);
+	}
+
+	return true;
+}
+
+TArray<uint8> FTileStandInServer::CreateTile(const ETileStandInFormat Format, const int32 Resolution)
+{
+	FRandomStream TileRandom(Resolution);
+	TArray<uint8> RawImage;
+	RawImage.SetNumUninitialized(Resolution * Resolution * 4);
+
+	for (int Y = 0; Y < Resolution; Y++)
+	{
+		for (int X = 0; X < Resolution; X++)
+		{
+			uint8* Pixel = &RawImage[(Y * Resolution + X) * 4];
+
+			if (Format == ETileStandInFormat::TerrainRGB)
+			{
+				// Rolling hills between 0 and 500 meters encoded as (height + 10000) * 10
+				const double Height = 250 + 250 * FMath::Sin(X * 0.05) * FMath::Cos(Y * 0.05) + TileRandom.FRand();
+				const uint32 Encoded = static_cast<uint32>((Height + 10000) * 10);
+				Pixel[0] = (Encoded >> 16) & 0xFF;
+				Pixel[1] = (Encoded >> 8) & 0xFF;
+				Pixel[2] = Encoded & 0xFF;
+			}
+			else
+			{
+				// Gradient with noise, roughly as hard to compress as aerial imagery
+				const int Noise = TileRandom.RandRange(-24, 24);
+				Pixel[0] = FMath::Clamp(X * 255 / Resolution + Noise, 0, 255);
+				Pixel[1] = FMath::Clamp(Y * 255 / Resolution + Noise, 0, 255);
+				Pixel[2] = FMath::Clamp(128 + Noise, 0, 255);
+			}
+			Pixel[3] = 255;
+		}
+	}
+
+	static const FName MODULE_IMAGE_WRAPPER("ImageWrapper");
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(MODULE_IMAGE_WRAPPER);
+	const TSharedPtr<IImageWrapper> ImageWrapper =
+		ImageWrapperModule.CreateImageWrapper(Format == ETileStandInFormat::JPEG ? EImageFormat::JPEG : EImageFormat::PNG);
+
+	if (!ImageWrapper.IsValid() || !ImageWrapper->SetRaw(RawImage.GetData(), RawImage.Num(), Resolution, Resolution, ERGBFormat::RGBA, 8))
+	{
+		return TArray<uint8>();
+	}
+
+	const TArray64<uint8> Compressed = ImageWrapper->GetCompressed(Format == ETileStandInFormat::JPEG ? 85 : 0);
+	return TArray<uint8>(Compressed.GetData(), static_cast<int32>(Compressed.Num()));
+}
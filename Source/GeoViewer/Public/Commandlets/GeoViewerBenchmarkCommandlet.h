@@ -0,0 +1,67 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "GeoViewerBenchmarkCommandlet.generated.h"
+
+class UGeoViewerEdModeConfig;
+class FTileStandInServer;
+
+/**
+ * Measures the tile download path against a local FTileStandInServer, so no API key or network
+ * is needed. Segments are downloaded with FTileDownloader then whole tiles are loaded through
+ * FXYZTileAPI, reporting the p50/p95/p99 latency, tiles per second and game thread time per tile.
+ * Segment latency is measured from when the scheduler sends the request, the time spent waiting
+ * for a free request slot is reported separately so the limits don't depend on '-segments'.
+ * Returns a non zero exit code if a limit is given and not met, or if any tile fails to load
+ * while '-errorrate' is 0, so it can be run in CI.
+ *
+ * Usage: UnrealEditor-Cmd.exe Project.uproject -run=GeoViewerBenchmark [-segments=500] [-tiles=16]
+ *        [-format=png|jpg|terrain] [-latency=50] [-jitter=20] [-errorrate=0] [-bandwidth=0]
+ *        [-port=8085] [-maxp95=ms] [-mintilespersecond=N] [-maxtilep95=ms]
+ */
+UCLASS()
+class UGeoViewerBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UGeoViewerBenchmarkCommandlet();
+
+	// UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	// End UCommandlet Interface
+
+private:
+	/** Results of one part of the benchmark */
+	struct FBenchmarkResult
+	{
+		/** Seconds from the request until each tile completed */
+		TArray<double> Latencies;
+
+		/** Seconds each request waited in the scheduler before being sent, empty if not measured */
+		TArray<double> QueueWaits;
+
+		int32 Failures = 0;
+		double Duration = 0;
+
+		/** Seconds spent on the game thread */
+		double GameThreadTime = 0;
+
+		/** Logs the results and returns the p95 latency in seconds. */
+		double Report(const TCHAR* Name);
+	};
+
+	/** Downloads segments directly with FTileDownloader. */
+	FBenchmarkResult RunDownloaderBenchmark(const FString& URLTemplate, int32 NumSegments) const;
+
+	/** Loads whole overlay tiles through FXYZTileAPI::LoadTile, which also merges and warps the segments. */
+	FBenchmarkResult RunLoadTileBenchmark(UGeoViewerEdModeConfig* Config, int32 NumTiles) const;
+
+	/**
+	 * Ticks the HTTP client, the stand-in server and game thread tasks as nothing else does in a commandlet.
+	 * @param LastTickTime Time of the previous tick, updated to the current time.
+	 * @return Seconds spent on the game thread.
+	 */
+	static double PumpGameThread(double& LastTickTime);
+};
@@ -0,0 +1,32 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "GeoViewerSeedCommandlet.generated.h"
+
+/**
+ * Downloads every segment covering an area into the tile cache so it can be used offline.
+ * Segments already in the cache are skipped, so an interrupted run can be started again.
+ *
+ * Usage: UnrealEditor-Cmd.exe Project.uproject -run=GeoViewerSeed -bbox=MinLon,MinLat,MaxLon,MaxLat
+ *        -zooms=15-19 [-provider=Google|Bing|XYZ|Mapbox] [-url=Template] [-parallel=64]
+ */
+UCLASS()
+class UGeoViewerSeedCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UGeoViewerSeedCommandlet();
+
+	// UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	// End UCommandlet Interface
+
+private:
+	/**
+	 * Downloads the segments that aren't cached yet, keeping up to 'MaxParallel' downloads waiting at once.
+	 * @return The number of segments that failed to download.
+	 */
+	int32 DownloadSegments(const TArray<struct FTileSegment>& Segments, int32 MaxParallel) const;
+};
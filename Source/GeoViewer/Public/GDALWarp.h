@@ -2,6 +2,7 @@
 #include "IImageWrapper.h"
 #include "GDALSmartPointers.h"
 #include "GeoViewerEdModeConfig.h"
+#include "TileCancellationToken.h"
 
 /**
  * Class containing static functions used to help warp an image between
@@ -11,27 +12,29 @@ class FGDALWarp
 {
 public:
 	/**
-	 * Creates a warped version of a dataset in a different projection.
-	 * @param Dataset Dataset to be warped.
-	 * @param CurrentCRS Current CRS of the dataset.
-	 * @param FinalCRS CRS used by the returned dataset.
-	 * @return Dataset reprojected to the new CRS.
-	 */
-	static GDALDatasetRef WarpDataset(const GDALDatasetRef& Dataset, FString CurrentCRS, FString FinalCRS);
-
-	/**
-	 * Crops a dataset down to the provided bounds.
-	 * @param SrcDataset Dataset that needs cropping.
-	 * @param TopLeft Position to crop top corner to in the projected CRS used by the dataset.
-	 * @param BottomRight Position to crop bottom corner to in the projected CRS used by the dataset.
-	 * @param OutFileName Path to the cropped dataset that gets created.
-	 * @return Cropped dataset.
+	 * Warps, crops and resizes a dataset in a single pass into a MEM dataset. The reprojection comes
+	 * from the FSpatialReferenceCache and the kernel runs on the CPU cores not used by other warps.
+	 * The result is computed straight away and only at the output resolution, so this should be run
+	 * on a worker thread.
+	 * @param SrcDataset Dataset to be warped.
+	 * @param SrcCRS Current CRS of the dataset.
+	 * @param DstCRS CRS used by the returned dataset.
+	 * @param TopLeft Top corner of the returned dataset in the destination CRS.
+	 * @param BottomRight Bottom corner of the returned dataset in the destination CRS.
+	 * @param Size Dimensions of the returned dataset, zero to keep the resolution of the source.
+	 * @param Algorithm Resampling algorithm.
+	 * @param CancellationToken Optional token that stops the warp part way through.
+	 * @return The warped dataset or nullptr if the warp failed or was cancelled.
 	 */
-	static GDALDatasetRef CropDataset(
+	static GDALDatasetRef WarpToBounds(
 		GDALDataset* SrcDataset,
+		const FString& SrcCRS,
+		const FString& DstCRS,
 		FVector TopLeft,
 		FVector BottomRight,
-		FString& OutFileName
+		FIntVector2 Size = FIntVector2(0, 0),
+		ESamplingAlgorithm Algorithm = ESamplingAlgorithm::Lanczos,
+		const FTileCancellationToken* CancellationToken = nullptr
 		);
 
 	/**
@@ -43,10 +46,12 @@ public:
 	/**
 	 * Forms one new dataset containing one or more existing datasets.
 	 * @param Datasets The datasets to be merged.
+	 * @param bAddAlpha Merges only the RGB bands and adds an alpha band that is opaque where
+	 * there is data, used for imagery segments that are cached without an alpha band.
 	 * @return A dataset with many small datasets joined together.
 	 */
-	static GDALDatasetRef MergeDatasets(TArray<GDALDatasetRef>& Datasets);
-	static GDALDatasetRef MergeDatasets(TArray<GDALDataset*>& Datasets);
+	static GDALDatasetRef MergeDatasets(TArray<GDALDatasetRef>& Datasets, bool bAddAlpha = false);
+	static GDALDatasetRef MergeDatasets(TArray<GDALDataset*>& Datasets, bool bAddAlpha = false);
 	
 	/**
 	 * Changes the resolution of a dataset.
@@ -64,34 +69,28 @@ public:
 	);
 	
 	/**
-	 * Creates a new MEM dataset containing raster bands created from the RawData parameter.
-	 * @param RawData Raw image data to add to the dataset.
+	 * Creates a MEM dataset that reads directly from the RawData parameter instead of copying it.
+	 * @param RawData Pixel interleaved image, must not be freed or resized until the dataset is closed.
 	 * @param XSize Number of rows in the image.
 	 * @param YSize Number of columns in the image.
 	 * @param Format Pixel format used by the image.
-	 * @return Dataset containing the 'RawData'.
+	 * @return Dataset reading from the 'RawData'.
 	 */
 	template<typename T>
-	static GDALDatasetRef CreateDataset(TArray<T>& RawData, int XSize, int YSize, ERGBFormat Format = ERGBFormat::RGBA);
+	static GDALDatasetRef WrapRawImage(const TArray<T>& RawData, int XSize, int YSize, ERGBFormat Format = ERGBFormat::RGBA);
 
 	/**
-	 * Creates a new GTiff dataset containing raster bands created from the RawData parameter.
-	 * @param RawData Raw image data to add to the dataset.
+	 * Opens existing memory as a MEM dataset using the DATAPOINTER syntax, nothing is copied.
+	 * The dataset can be reopened by name so it can also be used as a source of VRT datasets.
+	 * @param Data Pixel interleaved image, must outlive the dataset and anything created from it.
+	 * @param DataType Type of each value in the image.
 	 * @param XSize Number of rows in the image.
 	 * @param YSize Number of columns in the image.
-	 * @param Format Pixel format used by the image.
-	 * @param OutFileName The path of the GTiff file.
-	 * @return Dataset containing the 'RawData'.
+	 * @param Bands Number of values in each pixel.
+	 * @return A read only dataset or nullptr if it could not be opened.
 	 */
-	template<typename T>
-	static GDALDatasetRef CreateGTiffDataset(
-		TArray<T>& RawData,
-		int XSize,
-		int YSize,
-		FString& OutFileName,
-		ERGBFormat Format = ERGBFormat::RGBA
-		);
-	
+	static GDALDataset* OpenMemoryDataset(const void* Data, GDALDataType DataType, int XSize, int YSize, int Bands);
+
 	/**
 	 * Sets the geo transform and projection on a dataset.
 	 * @param Dataset Dataset to set the metadata on.
@@ -140,9 +139,19 @@ public:
 	template<typename T>
 	static void GetRawImage(GDALDatasetRef& Dataset, TArray<T>& OutImage);
 
+	/**
+	 * Converts a dataset to array of pixel data, checking the token while reading so
+	 * generating a large virtual dataset can be stopped part way through.
+	 * @param Dataset The dataset to extract the image from.
+	 * @param OutImage The resulting raw image.
+	 * @param CancellationToken Reading stops once this is cancelled.
+	 * @return False if the image could not be read or reading was cancelled.
+	 */
+	template<typename T>
+	static bool GetRawImage(GDALDatasetRef& Dataset, TArray<T>& OutImage, const FTileCancellationToken& CancellationToken);
 
 private:
-	/** Converts to a WKT if in a valid EPSG code */
+	/** Converts to a WKT if in a valid EPSG code, the result is cached by FSpatialReferenceCache */
 	static FString ConvertToWKT(FString CRS);
 	static FString ConvertToWKT(uint16 EPSGInt);
 
@@ -158,81 +167,73 @@ private:
 		FString& OutFileName
 		);
 
+	/**
+	 * Creates the options for warping every band of a dataset, alpha and no data values are carried
+	 * over to the destination. The transformer is left for the caller to set.
+	 */
+	static GDALWarpOptions* CreateWarpOptions(GDALDataset* SrcDataset, GDALDataset* DstDataset, ESamplingAlgorithm Algorithm);
+
+	/** Returns the sampling algorithm used by the warp kernel */
+	static GDALResampleAlg GetResampleAlg(ESamplingAlgorithm Algorithm);
+
 	/** Returns the sampling algorithm as a string */
 	static FString GetSamplingParameter(ESamplingAlgorithm Algorithm);
+
+	/**
+	 * Reads the bands of a dataset into a pixel interleaved buffer with a single RasterIO call per strip.
+	 * Large datasets are split into strips read at the same time, each thread using its own handle to the
+	 * dataset as GDAL datasets aren't thread safe. This lets warped and merged VRTs be generated on several cores.
+	 * @param Dataset The dataset to read.
+	 * @param OutData Buffer large enough for every pixel of every band read.
+	 * @param DataType Type of each value in the buffer.
+	 * @param Channels Number of bands to read starting from the first.
+	 * @param CancellationToken Optional, reading stops once this is cancelled.
+	 * @return False if the image could not be read or reading was cancelled.
+	 */
+	static bool ReadRaster(GDALDataset* Dataset, void* OutData, GDALDataType DataType, int Channels, const FTileCancellationToken* CancellationToken);
+
+	/**
+	 * Opens a second handle to a dataset that can be read on another thread.
+	 * @return The new handle, or an invalid ref if the dataset can't be opened again such as MEM datasets.
+	 */
+	static GDALDatasetRef OpenReadHandle(GDALDataset* Dataset);
 	
 	static FString ConvertToFString(char* Text);
 };
 
 template <typename T>
-GDALDatasetRef FGDALWarp::CreateDataset(TArray<T>& RawData, int XSize, int YSize, ERGBFormat Format)
+GDALDatasetRef FGDALWarp::WrapRawImage(const TArray<T>& RawData, int XSize, int YSize, ERGBFormat Format)
 {
-	int ChannelNum = 4;
-	if (Format == ERGBFormat::Gray)
+	const int ChannelNum = Format == ERGBFormat::Gray ? 1 : 4;
+	if (RawData.Num() < XSize * YSize * ChannelNum)
 	{
-		ChannelNum = 1;
+		return GDALDatasetRef();
 	}
-	
-	const mergetiff::RasterData<T> RasterData(
+
+	return GDALDatasetRef(OpenMemoryDataset(
 		RawData.GetData(),
-		ChannelNum,
-		YSize,
+		mergetiff::DatatypeConversion::primitiveToGdal<T>(),
 		XSize,
-		true
-		);
-	
-	return mergetiff::DatasetManagement::datasetFromRaster(RasterData);
+		YSize,
+		ChannelNum
+		));
 }
 
+
 template <typename T>
-GDALDatasetRef FGDALWarp::CreateGTiffDataset(TArray<T>& RawData, int XSize, int YSize, FString& OutFileName,
-	ERGBFormat Format)
+void FGDALWarp::GetRawImage(GDALDatasetRef& Dataset, TArray<T>& OutImage, int XSize, int YSize, int Channels)
 {
-	const FGuid DatasetGuid = FGuid::NewGuid();
-	OutFileName += "/vsimem/" + DatasetGuid.ToString() + ".tif";
-	
-	int ChannelNum = 4;
-	if (Format == ERGBFormat::Gray)
+	// Fast path, the pixels are read straight into their interleaved position without resampling
+	if (XSize == Dataset->GetRasterXSize() && YSize == Dataset->GetRasterYSize() && Channels <= Dataset->GetRasterCount())
 	{
-		ChannelNum = 1;
+		OutImage.SetNumUninitialized(XSize * YSize * Channels);
+		if (!ReadRaster(Dataset.Get(), OutImage.GetData(), mergetiff::DatatypeConversion::primitiveToGdal<T>(), Channels, nullptr))
+		{
+			FMemory::Memzero(OutImage.GetData(), OutImage.Num() * sizeof(T));
+		}
+		return;
 	}
 
-	GDALDataType GdalType = mergetiff::DatatypeConversion::primitiveToGdal<T>();
-
-	// Get GTiff Driver
-	const char* DriverName = "GTiff";
-	GDALDriver* GTiffDriver = GetGDALDriverManager()->GetDriverByName(DriverName);
-	check(GTiffDriver)
-
-	// Create dataset
-	GDALDataset* SavedDataset = GTiffDriver->Create(
-		TCHAR_TO_UTF8(*OutFileName),
-		XSize,
-		YSize,
-		ChannelNum,
-		GdalType,
-		nullptr
-		);
-
-	// Copy data over to dataset
-	const mergetiff::RasterData<T> RasterData(
-		RawData.GetData(),
-		ChannelNum,
-		YSize,
-		XSize,
-		true
-		);
-
-	GDALDatasetRef SavedDatasetRef(SavedDataset);
-	
-	mergetiff::RasterIO::writeDataset(SavedDatasetRef, RasterData);
-	
-	return SavedDatasetRef;
-}
-
-template <typename T>
-void FGDALWarp::GetRawImage(GDALDatasetRef& Dataset, TArray<T>& OutImage, int XSize, int YSize, int Channels)
-{
 	constexpr T Element{};
 	OutImage.Init(Element, XSize * YSize * Channels);
 	mergetiff::RasterData RasterData(OutImage.GetData(), Channels, YSize, XSize, true);
@@ -248,3 +249,21 @@ void FGDALWarp::GetRawImage(GDALDatasetRef& Dataset, TArray<T>& OutImage)
 
 	GetRawImage(Dataset, OutImage, XSize, YSize, Channels);
 }
+
+template <typename T>
+bool FGDALWarp::GetRawImage(GDALDatasetRef& Dataset, TArray<T>& OutImage, const FTileCancellationToken& CancellationToken)
+{
+	const int XSize = Dataset->GetRasterXSize();
+	const int YSize = Dataset->GetRasterYSize();
+	const int Channels = Dataset->GetRasterCount();
+
+	// Every value is written by the read so there's no need to clear the image first
+	OutImage.SetNumUninitialized(XSize * YSize * Channels);
+	if (!ReadRaster(Dataset.Get(), OutImage.GetData(), mergetiff::DatatypeConversion::primitiveToGdal<T>(), Channels, &CancellationToken))
+	{
+		FMemory::Memzero(OutImage.GetData(), OutImage.Num() * sizeof(T));
+		return false;
+	}
+
+	return true;
+}
@@ -58,18 +58,51 @@ struct FBingMapsOverlayConfig
 	EBingMapType Type = EBingMapType::Aerial;
 };
 
+USTRUCT()
+struct FXYZOverlayConfig
+{
+	GENERATED_BODY()
+
+	/**
+	 * URL of a tile on a slippy map tile server, with {z}, {x} and {y} in place of the tile coordinates.
+	 * Use {-y} for TMS servers, the URL may also be a path to a folder of tiles on disk.
+	 */
+	UPROPERTY(EditAnywhere, NonTransactional)
+	FString URLTemplate;
+
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, meta = (UIMin=0, UIMax=22))
+	int ZoomLevel = 17;
+};
+
+USTRUCT()
+struct FGeoTIFFOverlayConfig
+{
+	GENERATED_BODY()
+
+	/** GeoTIFF or Cloud Optimized GeoTIFF containing 8 bit RGB or RGBA imagery */
+	UPROPERTY(EditAnywhere, NonTransactional, meta = (FilePathFilter = "GeoTIFF (*.tif;*.tiff)|*.tif;*.tiff"))
+	FFilePath File;
+
+	/** Pixel size of each tile, the overview of the file closest to this is read */
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, meta = (UIMin=256, UIMax=8192))
+	int TileResolution = 2048;
+};
+
 UENUM()
 enum class EOverlayMapSystem : uint8
 {
 	GoogleMaps,
-	BingMaps
+	BingMaps,
+	XYZ UMETA(DisplayName = "XYZ Tile Server"),
+	GeoTIFF UMETA(DisplayName = "Local GeoTIFF")
 };
 
 UENUM()
 enum class ELandscapeFormat : uint8
 {
 	STRM UMETA(DisplayName = "STRM HGT Format"),
-	Mapbox
+	Mapbox,
+	GeoTIFF UMETA(DisplayName = "Local GeoTIFF")
 };
 
 /** Resampling algorithms available with GDAL. */
@@ -112,6 +145,29 @@ public:
 	/** The API to get the imagery from */
 	UPROPERTY(EditAnywhere, NonTransactional, Category = "Overlay")
 	EOverlayMapSystem OverlaySystem;
+
+	/**
+	 * Requests static map segments on a fixed pixel grid in Web Mercator at the configured zoom level.
+	 * Neighbouring tiles then share the exact same segments so they are always found in the cache.
+	 */
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, Category = "Overlay")
+	bool bSnapToPixelGrid = false;
+
+	/** Number of tiles ahead of the cursor downloaded in the background while it is moving */
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, Category = "Overlay", meta = (UIMin=0, UIMax=10))
+	int PrefetchDistance = 3;
+
+	/** Also downloads the tiles surrounding the one under the cursor ahead of time */
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, Category = "Overlay")
+	bool bPrefetchNeighbours = true;
+
+	/** Tiles still loading further than this many tiles from the cursor are cancelled, 0 never cancels */
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, Category = "Overlay", meta = (UIMin=0, UIMax=20))
+	int CancelDistance = 4;
+
+	/** Shows a low resolution preview of each tile as soon as it's downloaded, then replaces it once the full quality tile is ready */
+	UPROPERTY(EditAnywhere, AdvancedDisplay, NonTransactional, Category = "Overlay")
+	bool bProgressiveLoading = true;
 	
 	UPROPERTY(EditAnywhere, NonTransactional , Category = "Bing API Config", meta = (ShowOnlyInnerProperties))
 	FBingMapsOverlayConfig BingMaps;
@@ -119,9 +175,19 @@ public:
 	UPROPERTY(EditAnywhere, NonTransactional, Category = "Google API Config", meta = (ShowOnlyInnerProperties))
 	FGoogleMapsOverlayConfig GoogleMaps;
 
+	UPROPERTY(EditAnywhere, NonTransactional, Category = "XYZ Tile Server Config", meta = (ShowOnlyInnerProperties))
+	FXYZOverlayConfig XYZ;
+
+	UPROPERTY(EditAnywhere, NonTransactional, Category = "GeoTIFF Config", meta = (ShowOnlyInnerProperties))
+	FGeoTIFFOverlayConfig GeoTIFF;
+
 	UPROPERTY(EditAnywhere, NonTransactional, Category = "Landscape")
 	ELandscapeFormat LandscapeFormat;
 
+	/** Elevation GeoTIFF or Cloud Optimized GeoTIFF in meters, used by the Local GeoTIFF format */
+	UPROPERTY(EditAnywhere, NonTransactional, Category = "Landscape", meta = (FilePathFilter = "GeoTIFF (*.tif;*.tiff)|*.tif;*.tiff"))
+	FFilePath LandscapeGeoTIFF;
+
 	UPROPERTY(EditAnywhere, NonTransactional, Category = "Landscape")
 	ESamplingAlgorithm LandscapeResamplingAlgorithm = ESamplingAlgorithm::Lanczos;
 
@@ -3,6 +3,18 @@
 #include "CoreMinimal.h"
 #include "GeoViewerSettings.generated.h"
 
+/** Format used to store tiles in the tile cache */
+UENUM()
+enum class ETileCacheEncoding : uint8
+{
+	/** Tiled GTiff compressed with JPEG in YCbCr, smallest files but lossy */
+	JPEG,
+	/** Tiled GTiff compressed with DEFLATE and a horizontal predictor, lossless */
+	Deflate,
+	/** Uncompressed 4 band GTiff */
+	Uncompressed
+};
+
 /**
  * Configuration settings for the GeoViewer plugin.
  */
@@ -20,4 +32,42 @@ public:
 
 	UPROPERTY(Config, EditAnywhere, Category="API Keys", DisplayName="Mapbox API Key")
 	FString MapboxAPIKey;
+
+	/** Maximum number of tile requests sent to one provider at the same time */
+	UPROPERTY(Config, EditAnywhere, Category="Downloads", meta=(ClampMin=1, UIMax=64))
+	int32 MaxConcurrentDownloads = 8;
+
+	/** Overrides the maximum number of requests for specific providers (Bing, Google or Mapbox) */
+	UPROPERTY(Config, EditAnywhere, Category="Downloads")
+	TMap<FName, int32> ProviderDownloadLimits;
+
+	/** Sends fewer requests at once when a provider slows down or responds with 429/503 */
+	UPROPERTY(Config, EditAnywhere, Category="Downloads")
+	bool bAdaptiveConcurrency = true;
+
+	/** How cached imagery is stored on disk, terrain tiles are always stored losslessly */
+	UPROPERTY(Config, EditAnywhere, Category="Cache")
+	ETileCacheEncoding CacheEncoding = ETileCacheEncoding::JPEG;
+
+	/** Quality used when the cache encoding is JPEG */
+	UPROPERTY(Config, EditAnywhere, Category="Cache", meta=(ClampMin=10, ClampMax=100, EditCondition="CacheEncoding==ETileCacheEncoding::JPEG"))
+	int32 CacheJPEGQuality = 85;
+
+	/** Maximum size of the tile cache, the least recently used tiles are removed once it is full. 0 for no limit */
+	UPROPERTY(Config, EditAnywhere, Category="Cache", DisplayName="Cache Size Limit (MB)", meta=(ClampMin=0))
+	int32 CacheSizeLimitMB = 4096;
+
+	/** Returns the cache size limit in bytes */
+	int64 GetCacheSizeLimit() const { return (int64)CacheSizeLimitMB * 1024 * 1024; }
+
+	/** Memory used to keep recently loaded segments decoded so nearby tiles don't load them from disk again */
+	UPROPERTY(Config, EditAnywhere, Category="Cache", DisplayName="Memory Cache Size Limit (MB)", meta=(ClampMin=0))
+	int32 MemoryCacheSizeMB = 512;
+
+	/** Returns the memory cache size limit in bytes */
+	int64 GetMemoryCacheSizeLimit() const { return (int64)MemoryCacheSizeMB * 1024 * 1024; }
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
 };
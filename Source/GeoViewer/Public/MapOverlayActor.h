@@ -3,7 +3,9 @@
 #include "CoreMinimal.h"
 #include "GeoViewerEdModeConfig.h"
 #include "OverlayTileComponent.h"
+#include "OverlayPrefetcher.h"
 #include "OverlayTileGenerator.h"
+#include "RasterReadPool.h"
 #include "GameFramework/Actor.h"
 #include "ReferenceSystems/WorldReferenceSystem.h"
 #include "MapOverlayActor.generated.h"
@@ -53,9 +55,15 @@ public:
 	/** Adds a new decal to the world based on the dataset */
 	void AddOverlayTile(GDALDataset* Dataset, FString Key);
 
+	/** Shows a low resolution preview of a tile that is still loading, replaced once AddOverlayTile is called */
+	void AddOverlayPreview(GDALDataset* Dataset, FString Key);
+
 	/** Updates all materials with the opacity from the EdModeConfig. */
 	void UpdateOpacity();
 
+	/** Queue the FRasterReadPool adds the images read for the decals to, emptied every tick. */
+	FRasterReadQueueRef GetCompletedReads() const { return CompletedReads.ToSharedRef(); }
+
 	/** The default material used by decals */
 	UPROPERTY(EditAnywhere)
 	UMaterial* LoadingMaterial;
@@ -64,6 +72,22 @@ private:
 	/** Loads a tile and adds decal at the position */
 	TSharedRef<FOverlayTileGenerator> LoadNewTile(const FVector Corner1, const FVector Corner2, FString Key);
 
+	/**
+	 * Displays the dataset on the next free decal component.
+	 * @param Dataset The dataset to display, the component takes ownership of it.
+	 * @param Key Key of the tile the dataset belongs to.
+	 * @param TileGenerator The generator that created the dataset.
+	 * @param bIsPreview True if the dataset will be replaced by a full quality version later.
+	 * @return False if every component is still loading, the dataset is not used.
+	 */
+	bool ShowDataset(GDALDataset* Dataset, const FString& Key, TSharedPtr<FOverlayTileGenerator> TileGenerator, bool bIsPreview);
+
+	/**
+	 * Cancels tiles that are still loading and are further than the cancel distance from the cursor.
+	 * @param CurrentTile Index of the tile under the cursor.
+	 */
+	void CancelDistantTiles(FIntPoint CurrentTile);
+
 	/** Returns the reference system or create a new one if not in the world. */
 	AWorldReferenceSystem* GetWorldReferenceSystem();
 
@@ -82,6 +106,12 @@ private:
 
 	TMap<FString, TSharedPtr<FOverlayTileGenerator>> Tiles;
 
+	/** Images read for the decals waiting to be turned into textures */
+	TSharedPtr<FRasterReadQueue, ESPMode::ThreadSafe> CompletedReads;
+
+	/** Downloads the tiles the cursor is moving towards */
+	FOverlayPrefetcher Prefetcher;
+
 	TWeakObjectPtr<UGeoViewerEdModeConfig> EdModeConfig;
 
 	/** Prevents needing to search for the reference system every time it's needed. */
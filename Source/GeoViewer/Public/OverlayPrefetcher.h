@@ -0,0 +1,88 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "GeoViewerEdModeConfig.h"
+#include "TileAPIs/GeoTileAPI.h"
+
+/**
+ * Downloads the segments of overlay tiles before they are needed. The velocity of the
+ * cursor is tracked so the tiles it is moving towards, along with the tiles surrounding
+ * the one under the cursor, are queued with a low priority. Tiles that are no longer
+ * ahead of the cursor are cancelled whenever the direction of movement changes.
+ */
+class FOverlayPrefetcher
+{
+public:
+	FOverlayPrefetcher();
+	~FOverlayPrefetcher();
+
+	/** Sets the config with the overlay system and prefetch settings. */
+	void SetConfig(TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig);
+
+	/**
+	 * Updates the cursor velocity and starts or cancels prefetches if the predicted path has changed.
+	 * @param CursorPosition Position of the cursor in the UE world.
+	 * @param DeltaTime Time since the last update in seconds.
+	 * @param ReferencingSystem Used to convert the tile corners to the projected CRS.
+	 * @param IsTileLoaded Returns true if the overlay already has or is loading the tile with the key.
+	 */
+	void Update(
+		const FVector& CursorPosition,
+		float DeltaTime,
+		AWorldReferenceSystem* ReferencingSystem,
+		TFunctionRef<bool(const FString&)> IsTileLoaded
+		);
+
+	/** Cancels all prefetches and forgets the cursor movement. */
+	void Reset();
+
+	/** Returns the key used by the overlay for the tile at an index. */
+	static FString GetTileKey(FIntPoint TileIndex);
+
+	/** Converts a key from 'GetTileKey' back to the tile index, returns false if the key isn't valid. */
+	static bool ParseTileKey(const FString& Key, FIntPoint& OutTileIndex);
+
+private:
+	/** A tile being prefetched */
+	struct FPrefetchTile
+	{
+		/** Downloads the segments of the tile, released once complete */
+		TSharedPtr<FGeoTileAPI> TileAPI;
+
+		bool bComplete = false;
+	};
+
+	/**
+	 * Works out which tiles should be prefetched, cancels any that are no longer needed and starts the rest.
+	 * @param CurrentTile Index of the tile under the cursor.
+	 * @param Direction Normalized direction the cursor is moving, zero if it's still.
+	 */
+	void PlanPrefetches(
+		FIntPoint CurrentTile,
+		const FVector2D& Direction,
+		AWorldReferenceSystem* ReferencingSystem,
+		TFunctionRef<bool(const FString&)> IsTileLoaded
+		);
+
+	/** Starts downloading the segments of a tile in the background. */
+	void StartPrefetch(FIntPoint TileIndex, AWorldReferenceSystem* ReferencingSystem);
+
+	/** Called by the tile API once all segments are cached. */
+	void OnPrefetchComplete(GDALDataset* Dataset, FString Key);
+
+	TWeakObjectPtr<UGeoViewerEdModeConfig> EdModeConfig;
+
+	/** Tiles being or already prefetched by key */
+	TMap<FString, FPrefetchTile> PrefetchTiles;
+
+	/** Smoothed velocity of the cursor in UE units per second */
+	FVector2D Velocity;
+
+	FVector LastPosition;
+	bool bHasLastPosition;
+
+	/** Cursor tile and direction the current prefetches were planned for */
+	FIntPoint PlannedTile;
+	FVector2D PlannedDirection;
+	bool bHasPlan;
+};
@@ -1,8 +1,8 @@
 ﻿#pragma once
 
 #include "CoreMinimal.h"
-#include "GDALRasterReaderWorker.h"
 #include "OverlayTileGenerator.h"
+#include "RasterReadPool.h"
 #include "GDALSmartPointers.h"
 #include "Components/DecalComponent.h"
 #include "OverlayTileComponent.generated.h"
@@ -20,7 +20,6 @@ public:
 
 	// UDecalComponent Interface
 	virtual void BeginDestroy() override;
-	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 	// End UDecalComponent Interface
 
 	/**
@@ -28,30 +27,64 @@ public:
 	 * @param Dataset The GDALDataset to display.
 	 * @param InTileGenerator The generator used to create the dataset.
 	 * @param InParentMaterial Optional material to replace the existing decal material.
+	 * @param bInIsPreview True if the dataset is a low resolution preview that RefineDataset will replace.
 	 */
 	void SetDataset(
 		GDALDataset* Dataset,
 		TSharedPtr<FOverlayTileGenerator> InTileGenerator,
-		UMaterialInterface* InParentMaterial = nullptr
+		UMaterialInterface* InParentMaterial = nullptr,
+		bool bInIsPreview = false
 		);
 
-	/** True when the image is being extracted from the GDALDataset */
+	/**
+	 * Replaces the preview with the full quality dataset, the preview stays visible until the new image is read.
+	 * @param Dataset The full quality dataset covering the same bounds, nullptr keeps the preview.
+	 * @param InTileGenerator The generator used to create the dataset.
+	 */
+	void RefineDataset(GDALDataset* Dataset, TSharedPtr<FOverlayTileGenerator> InTileGenerator);
+
+	/** True when the image is being extracted from the GDALDataset or only the preview is shown */
 	bool IsLoadingTile() const;
 
+	/** True while the full quality version of the tile hasn't been given to the component */
+	bool IsShowingPreview() const { return bIsPreview; }
+
+	/** Stops extracting the image and hides the decal so the component can be reused. */
+	void CancelLoading();
+
 	/** Changes the opacity of the decal material. */
 	void SetOpacity(float Opacity) const;
 
+	/**
+	 * Creates the texture once the FRasterReadPool has read the dataset, called by the overlay actor.
+	 * @param Result A completed read, the raw image is moved out of it if it belongs to this component.
+	 * @return False if the read was started by a different component.
+	 */
+	bool FinishReading(FRasterReadResult& Result);
+
 	/** Used to link this component to a tile generator. */
 	FString Key;
 private:
 	/** Sets the texture parameter on the decal material to 'Texture'. */
 	void SetTextureMaterial() const;
+
+	/** Queues the dataset to be read into a texture on the FRasterReadPool. */
+	void StartReading(GDALDataset* Dataset);
+
+	/** Cancels the pending read, any result that still arrives is ignored. */
+	void StopReading();
 	
 	UPROPERTY()
 	UTexture2D* Texture;
 
-	TArray<uint8> RawImage;
-	FGDALRasterReaderWorker* TextureWorker;
+	/** ID of the read in the FRasterReadPool, 0 if the dataset isn't being read */
+	uint64 PendingReadID;
+
+	/** Stops the pending read, this is the token of the tile unless a preview is being read */
+	FTileCancellationTokenPtr ReadCancellationToken;
+
+	/** True if the texture is a low resolution preview */
+	bool bIsPreview;
 
 	TSharedPtr<FOverlayTileGenerator> TileGenerator;
 };
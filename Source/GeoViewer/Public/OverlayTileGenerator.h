@@ -25,13 +25,30 @@ public:
 		FProjectedBounds TileBounds
 		);
 
+	/** Stops loading the tile, the parent actor won't be given a dataset. */
+	void Cancel() const;
+
+	/** Returns the token shared by every step of loading the tile. */
+	FTileCancellationTokenPtr GetCancellationToken() const;
+
+	/** Creates the tile API for the overlay system selected in the config. */
+	static TSharedRef<FGeoTileAPI> CreateTileAPI(
+		TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
+		AWorldReferenceSystem* ReferencingSystem
+		);
+
 	/** Used to identify the tile being loaded */
 	FString Key;
 	
 private:
 	/** Called when the tile has finished downloading and can be added to the parent actor */
 	void OnTileFinishedLoading(GDALDataset* Dataset) const;
+
+	/** Called when a low resolution preview of the tile is ready to be shown */
+	void OnPreviewLoaded(GDALDataset* Dataset) const;
 	
 	TSharedPtr<FGeoTileAPI> TileLoader;
-	AMapOverlayActor* ParentActor;
+
+	/** Weak as the actor may be destroyed while the tile is still being warped */
+	TWeakObjectPtr<AMapOverlayActor> ParentActor;
 };
@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "GDALSmartPointers.h"
+#include "TileCancellationToken.h"
+#include "Containers/Queue.h"
+#include "HAL/ThreadSafeCounter64.h"
+
+/** Raw image read from a dataset by the FRasterReadPool */
+struct FRasterReadResult
+{
+	/** Identifies the read, matches the ID returned when it was queued */
+	uint64 ReadID = 0;
+
+	/** Pixel interleaved image data */
+	TArray<uint8> RawImage;
+
+	int SizeX = 0;
+	int SizeY = 0;
+
+	/** True if reading was stopped before the whole image was read */
+	bool bCancelled = false;
+};
+
+/** Completed reads, filled by any number of pool threads and emptied by a single consumer */
+typedef TQueue<FRasterReadResult, EQueueMode::Mpsc> FRasterReadQueue;
+typedef TSharedRef<FRasterReadQueue, ESPMode::ThreadSafe> FRasterReadQueueRef;
+
+/**
+ * Fixed number of threads shared by every overlay tile to read datasets into raw images.
+ * Reads can take a while as GDAL may need to warp the image, so they are kept off the game
+ * thread without creating a new thread for every tile. Results are added to a lock free
+ * queue given by the caller, which is emptied once per frame on the game thread.
+ */
+class FRasterReadPool
+{
+public:
+	/** Returns the pool shared by all overlay tiles. */
+	static FRasterReadPool& Get();
+
+	/** Creates the threads used by the pool. */
+	void Initialize();
+
+	/** Stops the threads, reads that haven't started are added to their queue as cancelled. */
+	void Shutdown();
+
+	/**
+	 * Queues a dataset to be read on one of the pool threads.
+	 * @param Dataset The dataset to read, the pool takes ownership of it.
+	 * @param CompletedReads Queue the result is added to once the read finishes or is cancelled.
+	 * @param CancellationToken Reading stops early once cancelled.
+	 * @return ID used to match the result to the read, never 0.
+	 */
+	uint64 Read(GDALDataset* Dataset, const FRasterReadQueueRef& CompletedReads, const FTileCancellationTokenRef& CancellationToken);
+
+private:
+	FRasterReadPool();
+
+	/** Threads reading the datasets, nullptr until initialized */
+	TUniquePtr<FQueuedThreadPool> ThreadPool;
+
+	/** Last ID given to a read */
+	FThreadSafeCounter64 LastReadID;
+};
@@ -0,0 +1,77 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "GDALSmartPointers.h"
+
+/**
+ * Caches WKT definitions of coordinate reference systems and the GDAL reprojection transformers
+ * between them, so looking up an EPSG code in the projection database and setting up the
+ * transformation happens once per CRS pair per session instead of for every segment and tile.
+ * Reprojection transformers can't be used by two threads at once so each pair keeps a pool,
+ * a warp takes one for as long as it runs. GDAL clones the transformer for each thread of a
+ * multithreaded warp by serializing it, the clones also take their reprojection from the pool.
+ * All functions are thread safe.
+ */
+class FSpatialReferenceCache
+{
+public:
+	/** Returns the cache shared by every warp. */
+	static FSpatialReferenceCache& Get();
+
+	/** Lets GDAL clone cached transformers for warp threads, called once GDAL is registered. */
+	void Initialize();
+
+	/** Frees every cached transformer and stops GDAL from creating more. */
+	void Shutdown();
+
+	/** Returns the WKT of an EPSG code, empty if the code is unknown. */
+	FString GetWKT(uint16 EPSG);
+
+	/**
+	 * Returns the WKT of a CRS.
+	 * @param CRS EPSG code with the 'EPSG:' prefix, anything else is assumed to already be a WKT.
+	 */
+	FString GetWKT(const FString& CRS);
+
+	/**
+	 * Creates a transformer from the pixels of a dataset to the pixels of a warped dataset, like
+	 * GDALCreateGenImgProjTransformer3 but with a cached reprojection. The destination geo transform
+	 * starts the same as the source and is changed with 'SetDstGeoTransform'.
+	 * @param SrcWKT CRS of the source dataset.
+	 * @param SrcGeoTransform Geo transform of the source dataset.
+	 * @param DstWKT CRS of the warped dataset.
+	 * @return Transformer used with 'Transform', destroyed with GDALDestroyTransformer. nullptr if the CRS can't be transformed.
+	 */
+	void* CreateImageTransformer(const FString& SrcWKT, const double* SrcGeoTransform, const FString& DstWKT);
+
+	/** Sets the geo transform of the destination on a transformer created by 'CreateImageTransformer'. */
+	static void SetDstGeoTransform(void* TransformerArg, const double* DstGeoTransform);
+
+	/** GDALTransformerFunc for transformers created by 'CreateImageTransformer'. */
+	static int Transform(void* TransformerArg, int bDstToSrc, int PointCount, double* X, double* Y, double* Z, int* Success);
+
+	/** Frees every cached transformer not in use. */
+	void Empty();
+
+private:
+	FSpatialReferenceCache(): Deserializer(nullptr) {}
+
+	/** Takes a reprojection transformer from the pool or creates one if all are in use. */
+	void* AcquireReprojection(const FString& SrcWKT, const FString& DstWKT);
+
+	/** Returns a reprojection transformer to the pool once a warp is done with it. */
+	void ReleaseReprojection(const FString& SrcWKT, const FString& DstWKT, void* Reprojection);
+
+	friend struct FCachedImageTransformer;
+
+	FCriticalSection CacheLock;
+
+	/** Handle of the deserializer registered with GDAL */
+	void* Deserializer;
+
+	/** WKT of each EPSG code */
+	TMap<uint16, FString> EPSGDefinitions;
+
+	/** Reprojection transformers not in use, keyed by source and destination WKT */
+	TMap<TTuple<FString, FString>, TArray<void*>> FreeReprojections;
+};
@@ -15,7 +15,9 @@ public:
 protected:
 	// FWebMapTileAPI Interface
 	virtual FString GetFileName(FGeographicCoordinates Coordinates) const override;
+	virtual FString GetGridFileName(FIntPoint GridIndex) const override;
 	virtual FString GetTileURL(FGeographicCoordinates Coordinates) const override;
+	virtual FName GetProviderName() const override { return TEXT("Bing"); }
 	// End FWebMapTileAPI Interface
 
 private:
@@ -0,0 +1,113 @@
+﻿#pragma once
+#include "GeoTileAPI.h"
+
+/**
+ * Class for loading tiles from a local GeoTIFF or Cloud Optimized GeoTIFF, used for both
+ * terrain and imagery. The file is opened once and shared by every tile. Each tile only
+ * reads the blocks of the window it covers, from the overview closest to the output size,
+ * so loading time depends on the size of the tile rather than the size of the file.
+ */
+class FGeoTIFFTileAPI : public FGeoTileAPI
+{
+public:
+	/**
+	 * @param InFilePath Path to the GeoTIFF on disk, it must have a CRS with an EPSG code.
+	 */
+	FGeoTIFFTileAPI(
+		TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
+		AWorldReferenceSystem* ReferencingSystem,
+		const FString& InFilePath
+		);
+
+	virtual void LoadTile(FProjectedBounds InTileBounds) override;
+
+	/** Closes every shared file, called when the module shuts down. */
+	static void CloseSourceFiles();
+private:
+	/** A GeoTIFF opened once and shared by all tiles reading from it */
+	struct FSourceFile
+	{
+		GDALDatasetRef Dataset;
+
+		/** Full path the dataset was opened from */
+		FString Path;
+
+		/**
+		 * Each overview opened as a dataset of its own the first time it's read, so all of its
+		 * bands are read in one call. Index 0 is the first overview, level 1.
+		 */
+		TArray<GDALDatasetRef> OverviewDatasets;
+
+		/** GDAL datasets can't be read by several threads at once */
+		FCriticalSection ReadLock;
+
+		double GeoTransform[6];
+		FString ProjectionWKT;
+		uint16 EPSG = 0;
+
+		bool bHasNoData = false;
+		double NoData = 0;
+
+		/**
+		 * Size and block size of the full resolution image followed by each overview, read
+		 * when the file is opened so tiles can plan their reads without taking the lock.
+		 */
+		TArray<FIntPoint> LevelSizes;
+		TArray<FIntPoint> LevelBlockSizes;
+	};
+
+	typedef TSharedPtr<FSourceFile, ESPMode::ThreadSafe> FSourceFilePtr;
+
+	/**
+	 * Returns the shared file for a path, opening it the first time it's used.
+	 * @return nullptr if the file can't be opened or has no usable CRS.
+	 */
+	static FSourceFilePtr OpenSourceFile(const FString& Path);
+
+	/**
+	 * Finds the smallest level that still has at least as many pixels as the output needs.
+	 * @param InSource The file being read.
+	 * @param Window Pixels covered by the tile at full resolution.
+	 * @param InOutputSize Size of the completed tile, zero to keep the full resolution.
+	 * @return Index into 'LevelSizes', 0 for the full resolution.
+	 */
+	static int32 SelectLevel(const FSourceFile& InSource, const FIntRect& Window, FIntVector2 InOutputSize);
+
+	/**
+	 * Converts a window at full resolution to the blocks of a level that cover it.
+	 * @return The window in pixels of the level, aligned to its blocks and clipped to its size.
+	 */
+	static FIntRect GetLevelWindow(const FSourceFile& InSource, int32 Level, const FIntRect& Window);
+
+	/**
+	 * Reads the window from the file into a decoded tile on a worker thread.
+	 * @param InSource The shared file.
+	 * @param Level Level to read from, 0 for the full resolution.
+	 * @param Window Pixels to read within the level.
+	 * @param Token Stops the read once the tile is cancelled.
+	 * @return The decoded window or nullptr if it couldn't be read.
+	 */
+	static FDecodedTilePtr ReadWindow(
+		const FSourceFilePtr& InSource,
+		int32 Level,
+		const FIntRect& Window,
+		const FTileCancellationTokenRef& Token
+		);
+
+	/** Called on the game thread once the window has been read. */
+	void OnWindowRead(const FDecodedTilePtr& Tile);
+
+	/** Returns the key the window is kept with in the FTileMemoryCache. */
+	FString GetWindowKey(int32 Level, const FIntRect& Window) const;
+
+	/** Path to the GeoTIFF on disk */
+	FString FilePath;
+
+	/** The file being read by this tile */
+	FSourceFilePtr Source;
+
+	static FCriticalSection SourceFilesLock;
+
+	/** Files opened so far, by full path */
+	static TMap<FString, FSourceFilePtr> SourceFiles;
+};
@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include "GeographicCoordinates.h"
 #include "GDALSmartPointers.h"
+#include "TileCancellationToken.h"
+#include "TileMemoryCache.h"
 #include "ReferenceSystems/WorldReferenceSystem.h"
 
 /** Holds the corner coordinates in lon, lat for a tile */
@@ -47,18 +49,54 @@ public:
 
 	/** Returns the path to the folder containing cached images */
 	static FString GetCacheFolderPath();
+
+	/**
+	 * Only downloads the segments into the cache without creating the final dataset,
+	 * OnComplete is called with nullptr once done. Segments are downloaded with a low priority.
+	 */
+	void SetPrefetch(const bool bInPrefetch) { bPrefetch = bInPrefetch; }
+
+	/** Stops loading the tile and releases any downloads only this tile needs, OnComplete won't be called. */
+	virtual void Cancel();
+
+	/** Returns the token shared with everything loading this tile. */
+	FTileCancellationTokenRef GetCancellationToken() const { return CancellationToken; }
+
+	/**
+	 * Sets the resolution of the completed dataset, by default the resolution of the source data is kept.
+	 * @param InSize Dimensions of the completed dataset.
+	 * @param InAlgorithm Resampling algorithm used to reach the size.
+	 */
+	void SetOutputSize(const FIntVector2 InSize, const ESamplingAlgorithm InAlgorithm)
+	{
+		OutputSize = InSize;
+		OutputAlgorithm = InAlgorithm;
+	}
 	
 	/** Delegate to functions to be called once complete. */
 	FOnComplete OnComplete;
+
+	/**
+	 * Called with a low resolution, nearest neighbour version of the tile before the full quality
+	 * warp starts. The preview is only created when this is bound, the listener takes ownership.
+	 */
+	FOnComplete OnPreview;
 protected:
 	/** Calls the on complete delegate for when the dataset has been loaded */
 	void TriggerOnCompleted(GDALDataset* Dataset) const;
 
+	/** Calls the on preview delegate, the dataset is closed if the tile was cancelled in the meantime */
+	void TriggerOnPreview(GDALDataset* Dataset) const;
+
+	/** Returns the size of the preview for the bounds, keeping their aspect ratio */
+	static FIntVector2 GetPreviewSize(const FProjectedBounds& Bounds);
+
 	/**
-	 * Warps a dataset to the CRS used by the world.
-	 * @param CachedDatasetIdx Index of dataset in 'CachedDatasets' array.
+	 * Warps the merged segments to the CRS used by the world and crops them to the tile bounds in
+	 * one pass on a worker thread, then calls the on complete delegate on the game thread.
+	 * @param MergedDataset Segments merged in the CRS of the source data, this object takes ownership.
 	 */
-	GDALDataset* WarpDataset(int CachedDatasetIdx);
+	void CreateTileDataset(GDALDataset* MergedDataset);
 	
 	/** Merges all datasets into one */
 	GDALDataset* MergeDatasets();
@@ -66,6 +104,27 @@ protected:
 	/** Closes all items in the array DatasetsToMerge then empties the array */
 	void EmptyDatasetsToMerge();
 
+	/**
+	 * Opens a cached tile from the FTileMemoryCache, or from the FTileCache on disk if it
+	 * isn't in memory. The decoded tile is kept alive until this object is destroyed.
+	 * @param Key The key the tile was cached with.
+	 * @return The cached dataset or nullptr if the tile isn't cached.
+	 */
+	GDALDataset* OpenCachedTile(const FString& Key);
+
+	/**
+	 * Finds a cached tile in the FTileMemoryCache, decoding it from the FTileCache on disk if it isn't in memory.
+	 * @param Key The key the tile was cached with.
+	 * @return The decoded tile or nullptr if the tile isn't cached.
+	 */
+	static FDecodedTilePtr FindCachedTile(const FString& Key);
+
+	/**
+	 * Creates a dataset reading from a decoded segment, the segment is kept alive until this object is destroyed.
+	 * @return The dataset or nullptr if the segment is invalid.
+	 */
+	GDALDataset* OpenDecodedTile(const FDecodedTilePtr& Tile);
+
 	/**
 	 * Calculates the projected bounds in the CRS of the source data.
 	 * As the CRS being used may be rotated in comparison to the UE world,
@@ -85,6 +144,9 @@ protected:
 
 	/** Paths of vrt datasets that should be deleted when this object is destroyed */
 	TArray<FString> CachedDatasetPaths;
+
+	/** Decoded segments read by the datasets of this tile */
+	TArray<FDecodedTilePtr> PinnedTiles;
 	
 	/** All the segments needed to form one big dataset */
 	TArray<GDALDataset*> DatasetsToMerge;
@@ -97,4 +159,20 @@ protected:
 	
 	/** CRS used by dataset */
 	uint16 EPSG = 3857;
+
+	/** Merge only the RGB bands of each segment and add an alpha band, used by imagery cached without alpha */
+	bool bAddAlphaOnMerge = false;
+
+	/** True if the segments are only being downloaded ahead of time */
+	bool bPrefetch = false;
+
+	/** Dimensions of the completed dataset, zero to keep the resolution of the source data */
+	FIntVector2 OutputSize = FIntVector2(0, 0);
+	ESamplingAlgorithm OutputAlgorithm = ESamplingAlgorithm::Lanczos;
+
+	/** Number of pixels along the longest side of a preview */
+	static constexpr int PreviewResolution = 128;
+
+	/** Cancelled once the tile is no longer needed */
+	FTileCancellationTokenRef CancellationToken;
 };
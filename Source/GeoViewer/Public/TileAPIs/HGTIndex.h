@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+/** Location of one 1 degree SRTM cell on disk */
+struct FHGTCell
+{
+	/** Path of the .hgt file, or of the .hgt.zip archive containing it */
+	FString Path;
+
+	/** True if the cell is read from inside a zip archive through /vsizip */
+	bool bZipped = false;
+};
+
+/**
+ * Index of the HGT files in the terrain folder, built when the plugin starts so imports
+ * don't need to check the disk for every cell. Files are found by their original SRTM
+ * name e.g. N00W000.hgt, optionally compressed as N00W000.hgt.zip.
+ * Should only be used on the game thread.
+ */
+class FHGTIndex
+{
+public:
+	/** Returns the index shared by all HGT tile APIs. */
+	static FHGTIndex& Get();
+
+	/** Scans the terrain folder again, picks up files added since the last scan. */
+	void Refresh();
+
+	/**
+	 * Finds the file containing a cell.
+	 * @param Cell Whole degrees east and north of the south west corner of the cell.
+	 * @return The cell or nullptr if there is no file for it.
+	 */
+	const FHGTCell* Find(FIntPoint Cell) const;
+
+	/** Returns the SRTM file name of a cell, e.g. N00W000.hgt */
+	static FString GetCellName(FIntPoint Cell);
+
+	/** Returns path to folder containing .hgt files. */
+	static FString GetTerrainFolder();
+
+private:
+	FHGTIndex();
+
+	/**
+	 * Reads the cell from an SRTM file name.
+	 * @return False if the name isn't a HGT file.
+	 */
+	static bool ParseCellName(const FString& FileName, FIntPoint& OutCell);
+
+	TMap<FIntPoint, FHGTCell> Cells;
+};
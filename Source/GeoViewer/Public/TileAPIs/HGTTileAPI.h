@@ -1,8 +1,12 @@
 ﻿#pragma once
 #include "GeoTileAPI.h"
 
+struct FHGTCell;
+
 /**
- * Class for loading STRM tiles in the HGT format.
+ * Class for loading STRM tiles in the HGT format. Only the part of each 1 degree
+ * cell covered by the tile is read, plain .hgt files are memory mapped and zipped
+ * .hgt.zip files are streamed through /vsizip.
  */
 class FHGTTileAPI : public FGeoTileAPI
 {
@@ -15,29 +19,39 @@ public:
 	virtual void LoadTile(FProjectedBounds TileBounds) override;
 private:
 	/**
-	 * Opens a HGT file if one exists, returns -1 if the file
-	 * does not exist.
-	 * @return Index of the dataset in the DatasetsToMerge array.
+	 * Reads the part of a cell covered by the tile and adds it to DatasetsToMerge.
+	 * @param CellIndex Whole degrees east and north of the south west corner of the cell.
+	 * @param Cell The file containing the cell.
+	 * @param MinCorner Smallest longitude and latitude covered by the tile.
+	 * @param MaxCorner Largest longitude and latitude covered by the tile.
+	 * @return False if the file could not be read.
+	 */
+	bool ReadCell(FIntPoint CellIndex, const FHGTCell& Cell, const FVector2D& MinCorner, const FVector2D& MaxCorner);
+
+	/**
+	 * Reads a window of big endian samples from a HGT file into native int16 values.
+	 * @param Cell The file containing the cell.
+	 * @param Samples Number of samples along each side of the cell.
+	 * @param Window Columns and rows to read, inclusive of 'Min' and exclusive of 'Max'. Rows start at the north edge.
+	 * @param OutHeights Receives the heights one row after another.
+	 * @return False if the file could not be read.
 	 */
-	int OpenDataset(FGeographicCoordinates PositionWithinTile);
-	
+	static bool ReadWindow(const FHGTCell& Cell, int32 Samples, const FIntRect& Window, int16* OutHeights);
+
 	/**
-	 * Gets the filename of a HGT file for a specific area.
-	 * @param Coordinates A position inside the HGT file.
-	 * @return Filename of HGT file.
+	 * Returns the number of samples along each side of a cell, 1201 for SRTM3 or 3601 for SRTM1.
+	 * @return 0 if the file size doesn't match a square grid of 16 bit samples.
 	 */
-	FString GetFileName(FGeographicCoordinates Coordinates) const;
+	static int32 GetSampleCount(const FHGTCell& Cell);
+
+	/** Returns the path GDAL should use to read the .hgt file of a cell. */
+	static FString GetReadPath(const FHGTCell& Cell);
 
-	/** Returns path to folder containing .hgt files. */
-	static FString GetTerrainFolder();
-	
 	/**
-	 * Adds 0s to the start of a string to ensure a number
-	 * presented as a string has the correct number of digits.
-	 * @param Number Integer to be converted to a string.
-	 * @param NumOfDigits Number of digits the string should contain.
-	 * @return String containing the number.
+	 * Converts 16 bit values between big and little endian.
+	 * @param Source Values to convert.
+	 * @param Dest Receives the converted values, may be the same as 'Source'.
+	 * @param Num Number of 16 bit values.
 	 */
-	static FString ConvertIntToString(int Number, int NumOfDigits);
-	
+	static void SwapInt16(const uint8* Source, uint8* Dest, int32 Num);
 };
@@ -1,11 +1,10 @@
 ﻿#pragma once
-#include "TileDownloader.h"
-#include "WebTileMapAPI.h"
+#include "XYZTileAPI.h"
 
 /**
  * Class for downloading DEM data from MapBox using the Terrain-RGB tile set.
  */
-class FMapBoxTerrain : public FWebMapTileAPI
+class FMapBoxTerrain : public FXYZTileAPI
 {
 public:
 	FMapBoxTerrain(
@@ -13,42 +12,59 @@ public:
 		AWorldReferenceSystem* ReferencingSystem
 		);
 
-	virtual ~FMapBoxTerrain() override;
-
 	// FGeoTileAPI Interface
+	/** Picks the zoom level matching the output size before loading the tile. */
 	virtual void LoadTile(FProjectedBounds InTileBounds) override;
 	// End FGeoTileAPI Interface
 
 protected:
-	// FWebMapTileAPI Interface
-	/** Not in use as replaced by functions with FVector2D parameter. */
-	virtual FString GetTileURL(FGeographicCoordinates Coordinates) const override { return FString(); };
-	virtual FString GetFileName(FGeographicCoordinates Coordinates) const override { return FString(); };
-	
-	virtual void OnSegmentCompleted(const FTileDownloader* TileDownloader) override;
-	// End FWebMapTileAPI Interface
-private:
-	/** Returns URL to tile at specific slippy map coordinates. */ 
-	FString GetTileURL(const FVector2D Coordinates) const;
+	// FXYZTileAPI Interface
+	/** Converts the RGB encoded heights of each segment before merging and caches the result. */
+	virtual GDALDataset* PrepareSegment(const FString& Key, const FDecodedTilePtr& Segment) override;
 
-	/** Returns filename for cached tile at specific slippy map coordinates. */
-	static FString GetFileName(const FVector2D Coordinates);
+	/** Opens the cached heights of the segment if they have been decoded before, otherwise the cached RGB segment. */
+	virtual GDALDataset* OpenCachedSegment(const FString& Key) override;
+	// End FXYZTileAPI Interface
 
-	/** Converts slippy map coordinates to geographic. */
-	FGeographicCoordinates GetGeographicCoordinates(const FVector2D Coordinates) const;
+private:
+	/**
+	 * Transforms an RGB segment to one with one float channel containing height data in meters.
+	 * @return The heights or nullptr if the segment isn't an 8 bit RGB image.
+	 */
+	static FDecodedTilePtr ConvertFromRGB(const FDecodedTile& MapboxTile);
 
-	/** Converts slippy map coordinate to EPSG:3857 coordinate. */
-	FVector GetProjectedCoordinate(const FVector2D Coordinates) const;
+	/**
+	 * Finds the coarsest zoom level with pixels no larger than the spacing of the output.
+	 * @param InTileBounds Bounds of the tile in the CRS used by the world.
+	 * @return The zoom level, or the default zoom level if no output size has been set.
+	 */
+	int GetZoomForOutputSize(const FProjectedBounds& InTileBounds) const;
 
-	/** Converts geographic coordinates to slippy map coordinates. */
-	FVector2D GetSlippyMapCoordinates(const FGeographicCoordinates Coordinates) const;
+	/** Returns the key the decoded heights of a segment are cached with. */
+	FString GetHeightKey(const FString& SegmentKey) const;
 
-	/** Transforms an RGB dataset to one with one channel containing height data in meters. */
-	GDALDataset* ConvertFromRGB(GDALDatasetRef& MapboxDataset);
+	/**
+	 * Adds decoded heights to the memory cache and compresses them into the tile cache in the background.
+	 * @param HeightKey Key returned by 'GetHeightKey'.
+	 * @param Heights The decoded heights.
+	 */
+	static void StoreHeights(const FString& HeightKey, const FDecodedTilePtr& Heights);
 
-	/** Mapbox API key */
-	FString APIKey;
+	/**
+	 * Encodes heights as a GTiff using DEFLATE with the floating point predictor, which is lossless
+	 * and smaller than the RGB segment.
+	 * @param Heights The decoded heights.
+	 * @param OutEncodedTile Contents of the GTiff file.
+	 * @return False if the GTiff could not be created.
+	 */
+	static bool EncodeHeights(const FDecodedTile& Heights, TArray<uint8>& OutEncodedTile);
 
-	/** Paths of temporary GTiff files that get deleted when this object is deleted. */ 
-	TArray<FString> GTiffPaths;
+	/**
+	 * Decodes Terrain-RGB pixels to heights in meters, four pixels at a time for RGB and RGBA images.
+	 * @param Pixels Pixel interleaved 8 bit image with the red, green and blue bands first.
+	 * @param NumPixels Number of pixels in the image.
+	 * @param Bands Number of bands in each pixel, at least 3.
+	 * @param OutHeights Buffer receiving one height per pixel.
+	 */
+	static void DecodeHeights(const uint8* Pixels, int32 NumPixels, int32 Bands, float* OutHeights);
 };
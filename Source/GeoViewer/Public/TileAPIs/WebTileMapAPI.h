@@ -1,7 +1,30 @@
 ﻿#pragma once
 #include "GeoTileAPI.h"
+#include "GeoViewerEdModeConfig.h"
 #include "TileDownloader.h"
 
+/** A segment that can be downloaded on its own, used to fill the cache without loading a tile */
+struct FTileSegment
+{
+	/** Key of the segment in the tile cache */
+	FString Key;
+
+	FString URL;
+
+	/** Name of the service the segment is downloaded from */
+	FName Provider;
+
+	/** Geographic center of the segment */
+	FGeographicCoordinates Center;
+
+	/** Top corner and size of the segment in Web Mercator */
+	FVector TopCorner;
+	FVector2D Size;
+
+	/** Format the segment is stored in within the cache */
+	ETileCacheEncoding Encoding;
+};
+
 /**
  * Abstract class for downloading tiles from popular static map APIs
  * such as google and bing that use a very similar format.
@@ -15,6 +38,24 @@ public:
 		);
 	
 	virtual void LoadTile(FProjectedBounds InTileBounds) override;
+	virtual void Cancel() override;
+
+	/**
+	 * Lists every segment covering an area, using the pixel grid for static maps. This doesn't
+	 * need a world so can be used to fill the cache ahead of time.
+	 * @param Bounds Geographic corners of the area.
+	 * @param OutSegments Array the segments are added to.
+	 */
+	virtual void GetSegmentsInBounds(const FGeoBounds& Bounds, TArray<FTileSegment>& OutSegments) const;
+
+	/** Sets the scale of the segments, where 0 is the entire earth and buildings are at 20. */
+	void SetZoomLevel(const int InZoomLevel) { ZoomLevel = InZoomLevel; }
+
+	/** Converts geographic coordinates to EPSG:3857 without needing a reference system. */
+	static FVector2D GeographicToWebMercator(const FGeographicCoordinates& Coordinates);
+
+	/** Converts EPSG:3857 coordinates to geographic without needing a reference system. */
+	static FGeographicCoordinates WebMercatorToGeographic(const FVector2D& Coordinates);
 
 protected:
 	/** 
@@ -23,6 +64,13 @@ protected:
 	 * @return The filename for the image at specified coordinates.
 	 */
 	virtual FString GetFileName(FGeographicCoordinates Coordinates) const = 0;
+
+	/**
+	 * Generates a unique filename for a segment snapped to the pixel grid.
+	 * @param GridIndex Column and row of the segment on the Web Mercator pixel grid at the current zoom level.
+	 * @return The filename for the segment.
+	 */
+	virtual FString GetGridFileName(FIntPoint GridIndex) const = 0;
 	
 	/**
 	 * Generates the url for the tile based on config and coordinates.
@@ -31,6 +79,9 @@ protected:
 	 */
 	virtual FString GetTileURL(FGeographicCoordinates Coordinates) const = 0;
 
+	/** Name of the service tiles are downloaded from, used to limit requests per provider. */
+	virtual FName GetProviderName() const = 0;
+
 	/**
 	 * Once a segment has been downloaded and converted to a Dataset this method is called.
 	 * It adds the completed dataset to the array of datasets to merge and checks if all datasets are added.
@@ -38,6 +89,78 @@ protected:
 	 */
 	virtual void OnSegmentCompleted(const FTileDownloader* TileDownloader);
 
+	/**
+	 * Fails the whole tile when one of its segments can't be loaded. The other downloads are released
+	 * so OnComplete is only called once, however many segments fail.
+	 * @param TileDownloader The download that failed.
+	 */
+	void OnSegmentFailed(const FTileDownloader* TileDownloader);
+
+	/**
+	 * Requests every segment covering the bounds by stepping one segment at a time from the top corner.
+	 * @param TopLeft Top corner of the bounds in the projected CRS of the source data.
+	 * @param BottomRight Bottom corner of the bounds in the projected CRS of the source data.
+	 */
+	void LoadSegments(const FVector& TopLeft, const FVector& BottomRight);
+
+	/**
+	 * Requests every segment covering the bounds with segments snapped to a fixed pixel grid in
+	 * Web Mercator, so the same segments are requested no matter where the tile starts.
+	 * @param TopLeft Top corner of the bounds in Web Mercator.
+	 * @param BottomRight Bottom corner of the bounds in Web Mercator.
+	 */
+	void LoadGridSegments(const FVector& TopLeft, const FVector& BottomRight);
+
+	/**
+	 * Opens a segment from the cache or starts downloading it.
+	 * @param FileName Key of the segment in the cache.
+	 * @param SegmentCenter The geographic center position of the segment.
+	 * @param TopCorner The top corner of the segment in projected crs.
+	 * @param PixelSize Size of one pixel in projected units.
+	 */
+	void RequestSegment(const FString& FileName, const FGeographicCoordinates& SegmentCenter, FVector TopCorner, FVector2D PixelSize);
+
+	/**
+	 * Opens a segment from the cache or starts downloading it, joining a download of the same segment
+	 * started by another tile.
+	 * @param FileName Key of the segment in the cache.
+	 * @param SegmentCenter The geographic center position of the segment, used to order downloads.
+	 * @param SetupDownload Only called when a new download is needed, sets the geographic information
+	 * and cache encoding of the segment and returns the URL to download it from.
+	 */
+	void RequestSegment(
+		const FString& FileName,
+		const FGeographicCoordinates& SegmentCenter,
+		TFunctionRef<FString(FTileDownloader& Segment)> SetupDownload
+		);
+
+	/**
+	 * Opens a segment that has already been cached so it doesn't need to be downloaded.
+	 * @param Key The key the segment is cached with.
+	 * @return The dataset to merge or nullptr if the segment isn't cached.
+	 */
+	virtual GDALDataset* OpenCachedSegment(const FString& Key);
+
+	/** Returns the size of one pixel in Web Mercator units at the current zoom level. */
+	double GetWebMercatorPixelSize() const;
+
+	/**
+	 * Finds the first and last column and row of the pixel grid covering an area.
+	 * @param TopLeft Top corner of the area in Web Mercator.
+	 * @param BottomRight Bottom corner of the area in Web Mercator.
+	 * @return The range of grid indices, the max index is included.
+	 */
+	FIntRect GetGridIndexRange(const FVector2D& TopLeft, const FVector2D& BottomRight) const;
+
+	/** Returns the top corner in Web Mercator of a segment on the pixel grid. */
+	FVector GetGridTopCorner(FIntPoint GridIndex) const;
+
+	/** Radius of the sphere used by Web Mercator */
+	static constexpr double WebMercatorRadius = 6378137.0;
+
+	/** Distance from the center to the edge of the Web Mercator map */
+	static constexpr double WebMercatorHalfSize = UE_DOUBLE_PI * WebMercatorRadius;
+
 	/**
 	 * Calculates the side length for an image based on latitude, zoom level and resolution.
 	 * @param Latitude The latitude position of the image.
@@ -0,0 +1,78 @@
+﻿#pragma once
+#include "WebTileMapAPI.h"
+
+/**
+ * Class for downloading fixed size tiles from any slippy map tile server using a URL
+ * template such as "https://tiles.example.com/{z}/{x}/{y}.png". "{-y}" can be used in
+ * place of "{y}" for TMS servers that count rows up from the south. The template may
+ * also be a path on disk to read tiles from a local folder. Segments are cached by
+ * their exact zoom, column and row.
+ */
+class FXYZTileAPI : public FWebMapTileAPI
+{
+public:
+	FXYZTileAPI(
+		TWeakObjectPtr<UGeoViewerEdModeConfig> InEdModeConfig,
+		AWorldReferenceSystem* ReferencingSystem
+		);
+
+	// FGeoTileAPI Interface
+	virtual void LoadTile(FProjectedBounds InTileBounds) override;
+	// End FGeoTileAPI Interface
+
+	// FWebMapTileAPI Interface
+	virtual void GetSegmentsInBounds(const FGeoBounds& Bounds, TArray<FTileSegment>& OutSegments) const override;
+	// End FWebMapTileAPI Interface
+
+protected:
+	// FWebMapTileAPI Interface
+	/** Not in use as replaced by functions with FIntPoint parameter. */
+	virtual FString GetTileURL(FGeographicCoordinates Coordinates) const override { return FString(); }
+	virtual FString GetFileName(FGeographicCoordinates Coordinates) const override { return FString(); }
+	virtual FString GetGridFileName(FIntPoint GridIndex) const override { return GetFileName(GridIndex); }
+	virtual FName GetProviderName() const override { return ProviderName; }
+
+	virtual void OnSegmentCompleted(const FTileDownloader* TileDownloader) override;
+
+	/** Cached segments are converted by 'PrepareSegment' the same as downloaded ones. */
+	virtual GDALDataset* OpenCachedSegment(const FString& Key) override;
+	// End FWebMapTileAPI Interface
+
+	/** Returns URL to tile at specific slippy map coordinates. */
+	virtual FString GetTileURL(FIntPoint Coordinates) const;
+
+	/** Returns key for the cached tile at specific slippy map coordinates. */
+	virtual FString GetFileName(FIntPoint Coordinates) const;
+
+	/**
+	 * Converts a decoded segment to the dataset that gets merged.
+	 * @param Key The key the segment is cached with.
+	 * @param Segment The decoded segment.
+	 * @return The dataset to merge, by default one reading the segment directly. nullptr if the segment can't be used.
+	 */
+	virtual GDALDataset* PrepareSegment(const FString& Key, const FDecodedTilePtr& Segment);
+
+	/** Converts slippy map coordinates to geographic. */
+	FGeographicCoordinates GetGeographicCoordinates(const FVector2D Coordinates) const;
+
+	/** Converts slippy map coordinate to a coordinate in the CRS of the tiles. */
+	FVector GetProjectedCoordinate(const FVector2D Coordinates) const;
+
+	/** Converts geographic coordinates to slippy map coordinates. */
+	FIntPoint GetSlippyMapCoordinates(const FGeographicCoordinates Coordinates) const;
+
+	/** Returns the first and last slippy map coordinates covering the bounds, the max coordinate is included. */
+	FIntRect GetTileRange(const FGeoBounds& Bounds) const;
+
+	/** URL of a tile with {z}, {x} and {y} or {-y} in place of the tile coordinates */
+	FString URLTemplate;
+
+	/** Prefix of the cache keys, identifies the tile set */
+	FString KeyPrefix;
+
+	/** Used to limit requests to the server */
+	FName ProviderName;
+
+	/** Format the segments are stored in within the cache */
+	ETileCacheEncoding CacheEncoding;
+};
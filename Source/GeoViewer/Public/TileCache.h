@@ -0,0 +1,156 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "GDALSmartPointers.h"
+#include "Async/Future.h"
+
+/** Usage statistics for the tile cache */
+struct FTileCacheStats
+{
+	/** Number of tiles in the cache */
+	int32 NumTiles = 0;
+
+	/** Total size of all cached tiles in bytes */
+	int64 SizeBytes = 0;
+
+	/** Maximum size of the cache in bytes, 0 if there is no limit */
+	int64 SizeLimitBytes = 0;
+
+	/** Number of tiles found in the cache since the editor started */
+	int64 Hits = 0;
+
+	/** Number of tiles that had to be downloaded since the editor started */
+	int64 Misses = 0;
+
+	/** Number of tiles removed to keep the cache under its size limit */
+	int64 Evictions = 0;
+
+	/** Fraction of lookups that were found in the cache */
+	double GetHitRatio() const { return Hits + Misses > 0 ? (double)Hits / (Hits + Misses) : 0; }
+};
+
+/**
+ * Stores downloaded tiles in a single GeoPackage file instead of one GTiff per segment.
+ * Each tile is kept as an encoded GTiff in an attribute table. The keys of every cached
+ * tile are loaded into memory when the cache is opened so checking if a tile exists
+ * doesn't touch the disk, and new tiles are written in batches inside one transaction.
+ * Once the cache grows past its size limit the least recently used tiles are removed
+ * on a background thread. All functions are thread safe.
+ */
+class FTileCache
+{
+public:
+	/** Returns the cache shared by all tile APIs. */
+	static FTileCache& Get();
+
+	/** Opens or creates the cache file and loads the index of cached tiles. */
+	void Initialize();
+
+	/** Writes any pending tiles and closes the cache file. */
+	void Shutdown();
+
+	/** True if a tile with the key has been cached. */
+	bool Contains(const FString& Key) const;
+
+	/**
+	 * Opens a cached tile as a read only dataset.
+	 * @param Key The key the tile was stored with.
+	 * @param OutMemoryFilePath Path of the in-memory file backing the dataset, this
+	 * must be deleted with VSIUnlink once the dataset is closed.
+	 * @return The dataset or nullptr if the tile is not cached.
+	 */
+	GDALDataset* OpenTile(const FString& Key, FString& OutMemoryFilePath);
+
+	/**
+	 * Adds a tile to the cache. The tile can be opened straight away but is only
+	 * written to disk once enough tiles are waiting or Flush is called.
+	 * @param Key Unique key for the tile.
+	 * @param EncodedTile Contents of a GTiff file containing the tile.
+	 */
+	void StoreTile(const FString& Key, TArray<uint8>&& EncodedTile);
+
+	/** Writes all pending tiles and access times to disk in one transaction. */
+	void Flush();
+
+	/**
+	 * Removes every tile whose key starts with the prefix, such as tiles only stored for a test.
+	 * @param KeyPrefix Start of the keys to remove.
+	 */
+	void RemoveTiles(const FString& KeyPrefix);
+
+	/**
+	 * Sets the maximum size of the cache, tiles are removed in the background if it is already larger.
+	 * @param InSizeLimit Maximum size in bytes, 0 for no limit.
+	 */
+	void SetSizeLimit(int64 InSizeLimit);
+
+	/** Returns the current size and hit ratio of the cache. */
+	FTileCacheStats GetStats() const;
+
+	/** Returns the path to the cache file. */
+	static FString GetCacheFilePath();
+
+private:
+	FTileCache();
+
+	/** Details of a tile stored on disk */
+	struct FCacheEntry
+	{
+		GIntBig FeatureID;
+		int64 Size;
+
+		/** Unix time the tile was last stored or opened */
+		int64 LastAccess;
+	};
+
+	/** Creates the tiles table, expects the lock to be held. */
+	bool CreateTilesLayer();
+
+	/** Adds fields missing from tables created by older versions, expects the lock to be held. */
+	bool UpgradeTilesLayer();
+
+	/** Reads the key of every cached tile into the index, expects the lock to be held. */
+	void LoadIndex();
+
+	/** Writes pending tiles and access times, expects the lock to be held. */
+	void FlushPendingTiles();
+
+	/** Starts removing tiles in the background if the cache is too big, expects the lock to be held. */
+	void StartEviction();
+
+	/** Removes the least recently used tiles until the cache is under its size limit. */
+	void EvictTiles();
+
+	mutable FCriticalSection CacheLock;
+
+	/** GeoPackage containing the tiles table. */
+	GDALDatasetRef Database;
+
+	/** Table of cached tiles owned by 'Database'. */
+	OGRLayer* TilesLayer;
+
+	/** Maps the key of each tile on disk to its feature. */
+	TMap<FString, FCacheEntry> Index;
+
+	/** Tiles waiting to be written to disk. */
+	TMap<FString, TArray<uint8>> PendingTiles;
+
+	/** Features opened since the access times were last written. */
+	TSet<GIntBig> AccessedFeatures;
+
+	/** Time the pending tiles were last written. */
+	double LastFlushTime;
+
+	/** Total size of the tiles in 'Index'. */
+	int64 TotalSize;
+
+	/** Maximum size of the cache in bytes, 0 for no limit. */
+	int64 SizeLimit;
+
+	/** Background task removing old tiles. */
+	TFuture<void> EvictionTask;
+
+	int64 Hits;
+	int64 Misses;
+	int64 Evictions;
+};
@@ -0,0 +1,22 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Flag shared by every step of loading a tile so the work can be stopped once the tile
+ * is no longer needed. It's safe to check from any thread.
+ */
+class FTileCancellationToken
+{
+public:
+	/** Stops any work using this token, can't be undone. */
+	void Cancel() { bCancelled = true; }
+
+	bool IsCancelled() const { return bCancelled; }
+
+private:
+	FThreadSafeBool bCancelled;
+};
+
+typedef TSharedRef<FTileCancellationToken, ESPMode::ThreadSafe> FTileCancellationTokenRef;
+typedef TSharedPtr<FTileCancellationToken, ESPMode::ThreadSafe> FTileCancellationTokenPtr;
@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "GeographicCoordinates.h"
+
+class FTileDownloader;
+
+/**
+ * Queue shared by all tile APIs for downloading segments. Limits the number of
+ * requests in flight for each provider and always starts the segment closest to
+ * the viewport cursor next, prefetched segments are only started once nothing
+ * else is waiting. The limit for each provider is lowered when the
+ * server slows down or rejects requests and slowly raised again once it recovers.
+ */
+class FTileDownloadScheduler
+{
+public:
+	/** Returns the scheduler shared by all tile APIs. */
+	static FTileDownloadScheduler& Get();
+
+	/**
+	 * Adds a downloader to the queue of its provider, the request is sent once
+	 * the provider has a free slot. The downloader can be found with FindDownload
+	 * until its segment has been decoded.
+	 * @param Downloader The downloader with the URL and scheduling info set.
+	 */
+	void QueueDownload(const TSharedRef<FTileDownloader>& Downloader);
+
+	/**
+	 * Finds a download already in progress for a segment, so tiles sharing the
+	 * segment can wait for the same request instead of sending another.
+	 * @param Key The cache key of the segment.
+	 * @return The downloader or nullptr if the segment isn't being downloaded.
+	 */
+	TSharedPtr<FTileDownloader> FindDownload(const FString& Key) const;
+
+	/** Stops a downloader from being found once it has finished or been destroyed. */
+	void RemoveDownload(const FString& Key, const FTileDownloader* Downloader);
+
+	/**
+	 * Frees the slot used by a request and updates the concurrency limit of the provider.
+	 * @param Provider The provider the request was sent to.
+	 * @param Latency Time in seconds between sending the request and receiving the response.
+	 * @param ResponseCode HTTP response code, 0 if no response was received.
+	 */
+	void OnDownloadFinished(FName Provider, double Latency, int32 ResponseCode);
+
+	/** Frees the slot used by a request that was destroyed before it finished. */
+	void OnDownloadAbandoned(FName Provider);
+
+	/** Sets the geographic position that queued segments are prioritised around. */
+	void SetFocus(const FGeographicCoordinates& InFocus);
+
+	/** Returns the number of requests currently being processed by a provider. */
+	int32 GetNumInFlight(FName Provider) const;
+
+	/** Returns the number of requests waiting for a free slot for a provider. */
+	int32 GetNumPending(FName Provider) const;
+
+private:
+	FTileDownloadScheduler();
+
+	/** State of the requests sent to one provider. */
+	struct FProviderQueue
+	{
+		/** Downloaders waiting for a free slot. */
+		TArray<TWeakPtr<FTileDownloader>> Pending;
+
+		/** Number of requests that have been sent and not finished. */
+		int32 InFlight = 0;
+
+		/** Current number of requests allowed in flight, changes with the server response. */
+		float ConcurrencyLimit = 0;
+
+		/** Lowest latency seen, used to detect when the server is slowing down. */
+		double BaselineLatency = 0;
+
+		/** Moving average of recent latencies. */
+		double AverageLatency = 0;
+	};
+
+	/** Sends requests from the pending queue until the provider has no free slots. */
+	void ProcessQueue(FName Provider);
+
+	/** Removes and returns the pending downloader closest to the focus. */
+	TSharedPtr<FTileDownloader> PopNextDownloader(FProviderQueue& Queue) const;
+
+	/** Lower values are downloaded first. */
+	double GetPriority(const FTileDownloader& Downloader) const;
+
+	/** Returns the queue for a provider or creates a new one. */
+	FProviderQueue& GetProviderQueue(FName Provider);
+
+	/** Maximum number of requests allowed in flight from the plugin settings. */
+	static int32 GetMaxConcurrentDownloads(FName Provider);
+
+	TMap<FName, FProviderQueue> Providers;
+
+	/** Downloaders that have been queued and not finished, by segment key */
+	TMap<FString, TWeakPtr<FTileDownloader>> Downloads;
+
+	/** Position the user is looking at. */
+	FGeographicCoordinates Focus;
+	bool bHasFocus;
+};
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "GeoViewerEdModeConfig.h"
+#include "GeoViewerSettings.h"
 #include "GDALSmartPointers.h"
+#include "GeographicCoordinates.h"
 #include "Interfaces/IHttpRequest.h"
+#include "TileCancellationToken.h"
+#include "TileMemoryCache.h"
 
 /**
  * This class is based on FWebImage and is used to handle downloading
@@ -12,37 +15,162 @@
 class FTileDownloader : public TSharedFromThis<FTileDownloader>
 {
 public:
-	DECLARE_DELEGATE_OneParam(FOnDownloaded, const FTileDownloader*);
+	DECLARE_MULTICAST_DELEGATE_OneParam(FOnDownloaded, const FTileDownloader*);
 	
 	FTileDownloader();
 	~FTileDownloader();
 
-	/** Starts downloading the image from the URL provided */
+	/**
+	 * Queues the image at the URL provided to be downloaded by the FTileDownloadScheduler.
+	 * URLs without a http or https scheme are read from the local file system instead.
+	 * @return False if the URL is empty.
+	 */
 	bool BeginDownload(FString InURL, FString InFileName);
 
+	/**
+	 * Sets the details used by the scheduler to order requests.
+	 * @param InProvider Name of the API the request is sent to, each provider has its own request limit.
+	 * @param InLocation Geographic center of the segment being downloaded.
+	 */
+	void SetSchedulingInfo(FName InProvider, const FGeographicCoordinates& InLocation);
+
+	FName GetProvider() const { return Provider; }
+	const FString& GetKey() const { return FileName; }
+	const FGeographicCoordinates& GetLocation() const { return Location; }
+
+	/** Prefetched segments are only downloaded once no segment needed now is waiting. */
+	void SetPrefetch(const bool bInPrefetch) { bPrefetch = bInPrefetch; }
+	bool IsPrefetch() const { return bPrefetch; }
+
+	/** Time the scheduler last sent the request, 0 until it has been sent. */
+	double GetRequestStartTime() const { return RequestStartTime; }
+
+	/** Size of the downloaded or loaded image in bytes, 0 until the download has finished. */
+	int64 GetDownloadedBytes() const { return DownloadedBytes; }
+
 	/** Sets the geographic information ready for the dataset */
 	void SetMetaData(
 		const FVector InTopCorner,
 		const FVector2D InPixelSize,
 		const uint16 InEPSG
 		);
+
+	/**
+	 * Sets the geographic information from the area covered by the segment, the pixel size is
+	 * then calculated from the size of the downloaded image. Used when the server may return
+	 * images larger than requested such as high DPI tiles.
+	 * @param InTopCorner Projected coordinates for the top corner of the segment.
+	 * @param InSegmentSize Width and height of the segment in the projected CRS.
+	 * @param InEPSG Projected CRS used by the segment.
+	 */
+	void SetExtentMetaData(const FVector InTopCorner, const FVector2D InSegmentSize, const uint16 InEPSG);
 	
+	/**
+	 * Sets how the tile is stored in the cache, defaults to the encoding in the plugin settings.
+	 * Tiles that can't lose any detail such as terrain should use a lossless encoding.
+	 */
+	void SetCacheEncoding(ETileCacheEncoding InCacheEncoding);
+
+	/** Adds the token of a tile waiting for the segment, the download stops once every token is cancelled. */
+	void AddCancellationToken(const FTileCancellationTokenRef& Token);
+
+	/** True if every tile waiting for the segment has been cancelled. */
+	bool IsCancelled() const;
+
+	/** Called when a tile waiting for the segment is cancelled, aborts the request if no other tile needs it. */
+	void OnTileCancelled();
+
+	/** Called once the segment is decoded or fails, the downloader may be shared by several tiles. */
 	FOnDownloaded OnDownloaded;
 
-	GDALDataset* FinalDataset;
+	/** The decoded segment, each listener creates its own dataset from it. nullptr if the download failed. */
+	FDecodedTilePtr DecodedTile;
 private:
+	friend class FTileDownloadScheduler;
+
+	/** Sends the request, called by the scheduler once the provider has a free slot. */
+	bool StartRequest();
+
+	/** Cancels the request in flight and frees its slot in the scheduler. */
+	void AbortRequest();
+
+	/** True if the list has tokens and all of them are cancelled. */
+	static bool AreAllCancelled(const TArray<FTileCancellationTokenRef>& Tokens);
+
+	/**
+	 * Called on the game thread once the request completes, hands the response
+	 * off to a worker thread to be decoded and saved.
+	 */
 	void DownloadFinished(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
 
+	/**
+	 * Decodes the segment on a worker thread.
+	 * @param HttpResponse The completed response, or nullptr to read the file at 'URL' instead.
+	 */
+	void StartDecoding(FHttpResponsePtr HttpResponse);
+
+	/** True if the URL points to a file on disk rather than a web server. */
+	static bool IsLocalFile(const FString& InURL);
+
+	/** Called on the game thread once the downloaded image has been decoded. */
+	void OnTileDecoded(const FDecodedTilePtr& Tile);
+
+	/**
+	 * Decodes a downloaded image, adds it to the FTileMemoryCache and encodes it as a
+	 * GTiff for the FTileCache. This is run on a worker thread so must not use any
+	 * members of the downloader.
+	 * @param ImageWrapperModule Module used to decode the image, must already be loaded.
+	 * @param Content The downloaded image.
+	 * @param CacheKey Key the tile is stored with in both caches.
+	 * @param InTopCorner Projected coordinates for the top corner of the image.
+	 * @param InPixelSize Size of one pixel in the projected CRS.
+	 * @param InSegmentSize Size of the whole image in the projected CRS, overrides 'InPixelSize' if not zero.
+	 * @param InEPSG Projected CRS used by the image.
+	 * @param Encoding Compression used for the GTiff.
+	 * @param JPEGQuality Quality used when the encoding is JPEG.
+	 * @return The decoded tile or nullptr if the image could not be decoded.
+	 */
+	static FDecodedTilePtr DecodeTile(
+		class IImageWrapperModule& ImageWrapperModule,
+		const TArray<uint8>& Content,
+		const FString& CacheKey,
+		FVector InTopCorner,
+		FVector2D InPixelSize,
+		FVector2D InSegmentSize,
+		uint16 InEPSG,
+		ETileCacheEncoding Encoding,
+		int32 JPEGQuality
+		);
+
+	/** Tokens of the tiles waiting for the segment */
+	TArray<FTileCancellationTokenRef> CancellationTokens;
+
 	/** Any pending request */
 	TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> PendingRequest;
 
-	/** Details of the tile */
-	TWeakObjectPtr<UGeoViewerEdModeConfig> EdModeConfig;
-
 	/** Metadata to be added to the dataset */
 	FVector TopCorner;
 	FVector2D PixelSize;
+	FVector2D SegmentSize;
 	uint16 EPSG;
 
+	/** Format the tile is stored in within the cache */
+	ETileCacheEncoding CacheEncoding;
+
 	FString FileName;
+	FString URL;
+
+	/** Used by the scheduler to order and limit requests */
+	FName Provider;
+	FGeographicCoordinates Location;
+	bool bPrefetch;
+
+	/** Time the current request was sent */
+	double RequestStartTime;
+
+	/** Number of times the request has been sent again after the server was too busy */
+	int RetryCount;
+
+	/** Size of the image that was received */
+	int64 DownloadedBytes;
 };
@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "GDALSmartPointers.h"
+#include "Containers/LruCache.h"
+
+/** Pixels and georeferencing of a decoded segment, shared by every tile using the segment */
+struct FDecodedTile
+{
+	/** Pixel interleaved image data */
+	TArray<uint8> Pixels;
+
+	int XSize = 0;
+	int YSize = 0;
+	int Bands = 0;
+
+	/** Type of each value in 'Pixels', segments converted after decoding such as terrain may not be bytes */
+	GDALDataType DataType = GDT_Byte;
+
+	double GeoTransform[6] = { 0, 1, 0, 0, 0, 1 };
+	FString ProjectionWKT;
+
+	/** Size of the tile in memory in bytes */
+	int64 GetSize() const { return Pixels.Num() + sizeof(FDecodedTile); }
+
+	/**
+	 * Creates a dataset that reads directly from 'Pixels' without copying them.
+	 * The dataset can be reopened by name so it can be used as a source of merged VRT datasets.
+	 * The tile must not be destroyed before the dataset and anything created from it are closed.
+	 * @return A read only MEM dataset or nullptr if it could not be created.
+	 */
+	GDALDataset* CreateDataset() const;
+
+	/**
+	 * Reads every band of a dataset into a new decoded tile, using the data type of the first band.
+	 * @param Dataset The dataset to read.
+	 * @return The decoded tile or nullptr if the dataset could not be read.
+	 */
+	static TSharedPtr<FDecodedTile, ESPMode::ThreadSafe> CreateFromDataset(GDALDataset* Dataset);
+};
+
+typedef TSharedPtr<const FDecodedTile, ESPMode::ThreadSafe> FDecodedTilePtr;
+
+/**
+ * Least recently used cache of decoded segments shared by all tile APIs, so
+ * segments loaded by neighbouring overlay tiles are read from memory instead
+ * of being loaded and decoded again. The total size is limited in bytes,
+ * tiles removed from the cache stay alive while a tile API is still using them.
+ * All functions are thread safe.
+ */
+class FTileMemoryCache
+{
+public:
+	/** Returns the cache shared by all tile APIs. */
+	static FTileMemoryCache& Get();
+
+	/**
+	 * Finds a decoded segment and marks it as recently used.
+	 * @param Key The key used by the tile cache for the segment.
+	 * @return The segment or nullptr if it isn't in memory.
+	 */
+	FDecodedTilePtr Find(const FString& Key);
+
+	/** Adds a decoded segment, removing the least recently used segments if the cache is full. */
+	void Add(const FString& Key, const FDecodedTilePtr& Tile);
+
+	/** Removes every segment. */
+	void Empty();
+
+	/**
+	 * Sets the maximum size of all decoded segments.
+	 * @param InSizeLimit Maximum size in bytes, 0 disables the cache.
+	 */
+	void SetSizeLimit(int64 InSizeLimit);
+
+	int32 GetNum() const;
+	int64 GetSize() const;
+	int64 GetSizeLimit() const;
+
+private:
+	FTileMemoryCache();
+
+	/** Removes segments until the cache is within its limit, expects the lock to be held. */
+	void Trim(int64 ExtraSize);
+
+	mutable FCriticalSection CacheLock;
+
+	TLruCache<FString, FDecodedTilePtr> Tiles;
+
+	/** Total size of the tiles in bytes */
+	int64 TotalSize;
+
+	/** Maximum size of the cache in bytes */
+	int64 SizeLimit;
+};
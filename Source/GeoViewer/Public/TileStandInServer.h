@@ -0,0 +1,99 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "HttpResultCallback.h"
+#include "HttpRouteHandle.h"
+
+class IHttpRouter;
+
+/** Format of the synthetic tiles served by the FTileStandInServer */
+enum class ETileStandInFormat : uint8
+{
+	PNG,
+	JPEG,
+	/** Mapbox Terrain-RGB encoded heights */
+	TerrainRGB
+};
+
+/** How the FTileStandInServer responds to requests */
+struct FTileStandInSettings
+{
+	/** Port the server listens on */
+	uint32 Port = 8085;
+
+	/** Side length of the served tiles in pixels */
+	int32 TileResolution = 256;
+
+	/** Average time in seconds before a response is sent */
+	double Latency = 0.05;
+
+	/** Maximum random change in seconds to the latency */
+	double Jitter = 0.02;
+
+	/** Fraction of requests that fail with a 503 error */
+	float ErrorRate = 0;
+
+	/** Bytes per second each response is sent at, 0 for no limit */
+	double Bandwidth = 0;
+};
+
+/**
+ * Local HTTP server that stands in for a tile provider, used to measure the download path
+ * without an API key or network. Every request under /png, /jpg or /terrain is answered with
+ * the same synthetic tile, e.g. "http://127.0.0.1:8085/png/{z}/{x}/{y}". Responses are held
+ * back to simulate latency and bandwidth, and sent from the core ticker so it must be ticked.
+ */
+class FTileStandInServer
+{
+public:
+	FTileStandInServer();
+	~FTileStandInServer();
+
+	/**
+	 * Generates the synthetic tiles and starts listening.
+	 * @return False if the tiles could not be encoded or the port is not available.
+	 */
+	bool Start(const FTileStandInSettings& InSettings);
+
+	/** Stops serving tiles, responses still waiting are dropped. The listener is left running for other servers on the port. */
+	void Stop();
+
+	/** Returns the URL template of the tiles in a format, to be used with FXYZTileAPI. */
+	FString GetURLTemplate(ETileStandInFormat Format) const;
+
+	/** Number of requests received since the server started */
+	int32 GetNumRequests() const { return NumRequests; }
+
+private:
+	/** A response waiting until its simulated latency has passed */
+	struct FPendingResponse
+	{
+		double SendTime;
+		ETileStandInFormat Format;
+		bool bFailed;
+		FHttpResultCallback OnComplete;
+	};
+
+	/** Holds back the response to a tile request. */
+	void QueueResponse(ETileStandInFormat Format, const FHttpResultCallback& OnComplete);
+
+	/** Sends the responses whose latency has passed. */
+	bool Tick(float DeltaTime);
+
+	/** Encodes a tile with some noise so the compressed size is close to real imagery. */
+	static TArray<uint8> CreateTile(ETileStandInFormat Format, int32 Resolution);
+
+	FTileStandInSettings Settings;
+
+	/** Encoded tile served for each format */
+	TMap<ETileStandInFormat, TArray<uint8>> Tiles;
+
+	TSharedPtr<IHttpRouter> Router;
+	TArray<FHttpRouteHandle> RouteHandles;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	TArray<FPendingResponse> PendingResponses;
+	FRandomStream Random;
+	int32 NumRequests;
+};
@@ -112,7 +112,9 @@ public class GDAL : ModuleRules
 		//Determine if we have precomputed dependency data for the target that is being built
 		if (ProcessPrecomputedData(Target, stagingDir) == false)
 		{
-			throw new Exception("Missing precomputed data!");
+			//Only Win64 binaries are bundled, other platforms need GDAL copied into the same layout first
+			throw new Exception(String.Format("Missing precomputed data for {0} in {1}!",
+				this.TargetIdentifier(Target), Path.Combine(ModuleDirectory, "precomputed")));
 		}
 	}
 }